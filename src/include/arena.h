@@ -0,0 +1,89 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Bump allocator owned by the active stroke. Blocks are kept across reset(),
+// so once the first few strokes have warmed it up, per-event scratch data
+// (points, spans, vertices) costs no heap allocation at all.
+class StrokeArena{
+private:
+    struct Block{
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t blockSize;
+    size_t currentBlock{0};
+    size_t offset{0};
+    size_t used{0};
+    Uint64 heapAllocations{0};    // blocks malloc'ed since the last reset()
+
+    void addBlock(size_t min_size){
+        size_t size = std::max(blockSize, min_size);
+        blocks.push_back({static_cast<char*>(SDL_malloc(size)), size});
+        ++heapAllocations;
+    }
+
+public:
+    explicit StrokeArena(size_t block_size = 64*1024): blockSize(block_size){
+        blocks.reserve(64);
+    }
+    ~StrokeArena(){
+        for(auto &block: blocks) SDL_free(block.data);
+    }
+    StrokeArena(const StrokeArena&) = delete;
+    StrokeArena& operator=(const StrokeArena&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)){
+        while(true){
+            if(currentBlock == blocks.size()) addBlock(bytes + alignment);
+            Block &block = blocks[currentBlock];
+            size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+            if(aligned + bytes <= block.size){
+                offset = aligned + bytes;
+                used += bytes;
+                return block.data + aligned;
+            }
+            ++currentBlock;
+            offset = 0;
+        }
+    }
+
+    // Drop everything allocated since the last reset, keeping the blocks
+    void reset(){
+        currentBlock = 0;
+        offset = 0;
+        used = 0;
+        heapAllocations = 0;
+    }
+
+    size_t bytesUsed(){return used;}
+    Uint64 getHeapAllocations(){return heapAllocations;}
+};
+
+// std allocator adapter so containers can live in a StrokeArena; deallocate
+// is a no-op, memory comes back when the arena is reset
+template<typename T>
+class ArenaAllocator{
+public:
+    typedef T value_type;
+    StrokeArena* arena;
+
+    explicit ArenaAllocator(StrokeArena* arena) noexcept: arena(arena){}
+    template<typename U> ArenaAllocator(const ArenaAllocator<U> &other) noexcept: arena(other.arena){}
+
+    T* allocate(size_t n){return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T)));}
+    void deallocate(T*, size_t) noexcept{}
+
+    template<typename U> bool operator==(const ArenaAllocator<U> &other) const noexcept{return arena == other.arena;}
+    template<typename U> bool operator!=(const ArenaAllocator<U> &other) const noexcept{return arena != other.arena;}
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
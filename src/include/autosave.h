@@ -0,0 +1,366 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <sys/file.h>
+#endif
+#include "paintdoc.h"
+
+const Uint64 AUTOSAVE_INTERVAL_MS = 10000;
+const Uint64 AUTOSAVE_COMPACT_FACTOR = 4;    // rewrite the file once it is this many times the live payloads
+
+// Flushes the OS buffers of file to the disk
+inline bool syncFile(FILE* file){
+    if(fflush(file) != 0) return false;
+#if defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Renames from over to in one step: readers see the old or the new file, never a mix
+inline bool replaceFile(const char* from, const char* to){
+#if defined(_WIN32)
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+// Keeps a single state .paint recovery file in step with the canvas. Changed
+// tiles are copied out on the main thread (cheap) and a worker thread encodes
+// and appends only those, then writes a new index and finally repoints the
+// header at it. Until that last 8 byte write the old index still describes a
+// complete image, so a crash at any point leaves a readable file. When the
+// dead payloads pile up, the file is rewritten from scratch beside the old one
+// and swapped in with an atomic rename. The journal sequence the snapshot
+// covers follows the index, so recovery knows which records to replay on top.
+class Autosave{
+private:
+    struct Entry{Uint64 offset; Uint32 size; TileCodec codec;};
+
+    std::string path;
+    int width{0}, height{0};
+    int tilesX{0}, tilesY{0};
+    std::vector<Uint32> snapshot;    // the canvas as of the last save started, updated tile by tile
+    std::vector<char> dirty;         // tiles changed since then (main thread)
+    std::vector<char> writing;       // tiles the worker writes (worker thread)
+    std::vector<Entry> entries;      // index of the file on disk
+    Uint64 fileEnd{0};
+    Uint64 liveBytes{0};
+    bool fileValid{false};
+    std::thread worker;
+    std::atomic<bool> working{false};
+    std::atomic<bool> failed{false};
+    Uint64 lastSave{0};
+    Uint64 sequence{0};                       // journal sequence of the snapshot being written
+    std::atomic<Uint64> savedSequence{0};     // ... and of the last one that reached the disk
+
+    int tileWidth(int tile){return std::min(PAINT_TILE_SIZE, width - (tile % tilesX)*PAINT_TILE_SIZE);}
+    int tileHeight(int tile){return std::min(PAINT_TILE_SIZE, height - (tile / tilesX)*PAINT_TILE_SIZE);}
+    const Uint32* tilePixels(int tile){return snapshot.data() + (size_t)(tile / tilesX)*PAINT_TILE_SIZE*width + (tile % tilesX)*PAINT_TILE_SIZE;}
+
+    static void put32(std::vector<Uint8> &out, Uint32 v){for(int s = 0; s < 32; s += 8) out.push_back((Uint8)(v >> s));}
+    static void put64(std::vector<Uint8> &out, Uint64 v){put32(out, (Uint32)v); put32(out, (Uint32)(v >> 32));}
+
+    std::vector<Uint8> encodeIndex(){
+        std::vector<Uint8> index;
+        index.reserve(entries.size()*PAINT_INDEX_ENTRY_SIZE);
+        for(auto &entry: entries){
+            put64(index, entry.offset);
+            put32(index, entry.size);
+            put32(index, (Uint32)entry.codec);
+        }
+        return index;
+    }
+
+    // Appends the payloads of the tiles in writing, then the index, then switches the header over
+    bool append(){
+        FILE* file = fopen(path.c_str(), "r+b");
+        if(file == nullptr || fseek(file, (long)fileEnd, SEEK_SET) != 0){
+            if(file != nullptr) fclose(file);
+            return false;
+        }
+        bool ok = true;
+        std::vector<Uint8> payload;
+        Uint64 offset = fileEnd;
+        for(size_t i = 0; i < writing.size() && ok; ++i){
+            if(!writing[i]) continue;
+            TileCodec codec = encodePaintTile(tilePixels((int)i), width, tileWidth((int)i), tileHeight((int)i), payload);
+            ok = fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+            liveBytes += payload.size() - entries[i].size;
+            entries[i] = {offset, (Uint32)payload.size(), codec};
+            offset += payload.size();
+        }
+        std::vector<Uint8> index = encodeIndex();
+        put64(index, sequence);
+        Uint64 index_offset = offset;
+        if(ok) ok = fwrite(index.data(), 1, index.size(), file) == index.size() && syncFile(file);
+        std::vector<Uint8> pointer;
+        put64(pointer, index_offset);
+        if(ok) ok = fseek(file, 32, SEEK_SET) == 0 && fwrite(pointer.data(), 1, 8, file) == 8 && syncFile(file);
+        if(fclose(file) != 0) ok = false;
+        fileEnd = index_offset + index.size();
+        return ok;
+    }
+
+    // Writes every tile to a new file and renames it over the old one
+    bool rewrite(){
+        std::string temp = path + ".tmp";
+        FILE* file = fopen(temp.c_str(), "wb");
+        if(file == nullptr) return false;
+        std::vector<Uint8> header(PAINT_MAGIC, PAINT_MAGIC + 8);
+        for(Uint32 v: {PAINT_VERSION, (Uint32)width, (Uint32)height, (Uint32)PAINT_TILE_SIZE, 1u, 0u}) put32(header, v);
+        put64(header, 0);
+        bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+        std::vector<Uint8> payload;
+        Uint64 offset = PAINT_HEADER_SIZE;
+        liveBytes = 0;
+        for(size_t i = 0; i < entries.size() && ok; ++i){
+            TileCodec codec = encodePaintTile(tilePixels((int)i), width, tileWidth((int)i), tileHeight((int)i), payload);
+            ok = fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+            entries[i] = {offset, (Uint32)payload.size(), codec};
+            offset += payload.size();
+            liveBytes += payload.size();
+        }
+        std::vector<Uint8> index = encodeIndex();
+        put64(index, sequence);
+        if(ok) ok = fwrite(index.data(), 1, index.size(), file) == index.size();
+        std::vector<Uint8> pointer;
+        put64(pointer, offset);
+        if(ok) ok = fseek(file, 32, SEEK_SET) == 0 && fwrite(pointer.data(), 1, 8, file) == 8 && syncFile(file);
+        if(fclose(file) != 0) ok = false;
+        if(ok) ok = replaceFile(temp.c_str(), path.c_str());
+        if(!ok) remove(temp.c_str());
+        fileEnd = offset + index.size();
+        return ok;
+    }
+
+    void write(){
+        Uint64 start = SDL_GetPerformanceCounter();
+        int tiles = (int)std::count(writing.begin(), writing.end(), 1);
+        bool full = !fileValid || fileEnd > AUTOSAVE_COMPACT_FACTOR*(liveBytes + entries.size()*PAINT_INDEX_ENTRY_SIZE);
+        bool ok = full ? rewrite() : append();
+        fileValid = ok;
+        failed.store(!ok, std::memory_order_relaxed);
+        if(ok) savedSequence.store(sequence, std::memory_order_release);
+        double ms = (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency();
+        if(ok) SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Autosave: %d tiles %s in %.1f ms", full ? (int)entries.size() : tiles, full ? "rewritten" : "appended", ms);
+        else SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Autosave to %s failed", path.c_str());
+        working.store(false, std::memory_order_release);
+    }
+
+public:
+    Autosave() = default;
+    ~Autosave(){if(worker.joinable()) worker.join();}
+    Autosave(const Autosave&) = delete;
+    Autosave& operator=(const Autosave&) = delete;
+
+    // Starts tracking a width x height canvas; the first save writes every tile
+    void open(const std::string &recovery_path, int canvas_width, int canvas_height){
+        path = recovery_path;
+        width = canvas_width;
+        height = canvas_height;
+        tilesX = (width + PAINT_TILE_SIZE - 1)/PAINT_TILE_SIZE;
+        tilesY = (height + PAINT_TILE_SIZE - 1)/PAINT_TILE_SIZE;
+        snapshot.assign((size_t)width*height, 0);
+        dirty.assign((size_t)tilesX*tilesY, 1);
+        writing.assign(dirty.size(), 0);
+        entries.assign(dirty.size(), Entry{0, 0, TileCodec::RAW});
+        fileValid = false;
+        lastSave = SDL_GetTicks64();
+        savedSequence.store(0);
+    }
+
+    // Journal sequence stored in the recovery file at path, 0 if there is none
+    static Uint64 readSequence(const std::string &recovery_path){
+        PaintDocument document;
+        if(!document.open(recovery_path.c_str())) return 0;
+        FILE* file = fopen(recovery_path.c_str(), "rb");
+        if(file == nullptr) return 0;
+        Uint8 header[PAINT_HEADER_SIZE], tail[8];
+        Uint64 sequence = 0;
+        if(fread(header, 1, sizeof(header), file) == sizeof(header)){
+            Uint64 index_offset = 0;
+            for(int i = 7; i >= 0; --i) index_offset = (index_offset << 8) | header[32 + i];
+            int tiles_x = (document.getWidth() + PAINT_TILE_SIZE - 1)/PAINT_TILE_SIZE, tiles_y = (document.getHeight() + PAINT_TILE_SIZE - 1)/PAINT_TILE_SIZE;
+            Uint64 tail_offset = index_offset + (Uint64)tiles_x*tiles_y*PAINT_INDEX_ENTRY_SIZE;
+            if(fseek(file, (long)tail_offset, SEEK_SET) == 0 && fread(tail, 1, 8, file) == 8){
+                for(int i = 7; i >= 0; --i) sequence = (sequence << 8) | tail[i];
+            }
+        }
+        fclose(file);
+        return sequence;
+    }
+
+    const std::string &getPath(){return path;}
+
+    // Every rect of the canvas that changed, before it is uploaded
+    void markDirty(SDL_Rect rect){
+        if(dirty.empty() || rect.w <= 0 || rect.h <= 0) return;
+        int x0 = std::max(0, rect.x)/PAINT_TILE_SIZE, y0 = std::max(0, rect.y)/PAINT_TILE_SIZE;
+        int x1 = std::min(tilesX - 1, (rect.x + rect.w - 1)/PAINT_TILE_SIZE), y1 = std::min(tilesY - 1, (rect.y + rect.h - 1)/PAINT_TILE_SIZE);
+        for(int ty = y0; ty <= y1; ++ty) for(int tx = x0; tx <= x1; ++tx) dirty[(size_t)ty*tilesX + tx] = 1;
+    }
+
+    bool due(){
+        return !dirty.empty() && !working.load(std::memory_order_acquire) && SDL_GetTicks64() - lastSave >= AUTOSAVE_INTERVAL_MS
+            && std::find(dirty.begin(), dirty.end(), 1) != dirty.end();
+    }
+
+    bool isWriting(){return working.load(std::memory_order_acquire);}
+    bool hasFailed(){return failed.load(std::memory_order_relaxed);}
+    Uint64 getSavedSequence(){return savedSequence.load(std::memory_order_acquire);}
+
+    // Copies the dirty tiles of pixels (the whole canvas) and hands them to the
+    // worker; call between frames when nothing is being drawn. journal_sequence
+    // is the last journal record the pixels include.
+    void start(const Uint32* pixels, Uint64 journal_sequence){
+        if(working.load(std::memory_order_acquire)) return;
+        if(worker.joinable()) worker.join();
+        sequence = journal_sequence;
+        if(failed.load(std::memory_order_relaxed)) std::fill(dirty.begin(), dirty.end(), 1);    // retry everything
+        for(size_t i = 0; i < dirty.size(); ++i){
+            writing[i] = dirty[i];
+            if(!dirty[i]) continue;
+            int x0 = (int)(i % tilesX)*PAINT_TILE_SIZE, y0 = (int)(i / tilesX)*PAINT_TILE_SIZE;
+            for(int y = y0; y < y0 + tileHeight((int)i); ++y) std::copy_n(pixels + (size_t)y*width + x0, tileWidth((int)i), snapshot.data() + (size_t)y*width + x0);
+            dirty[i] = 0;
+        }
+        lastSave = SDL_GetTicks64();
+        working.store(true, std::memory_order_release);
+        worker = std::thread(&Autosave::write, this);
+    }
+
+    // Waits for a save in flight; with discard the recovery file is deleted too (clean exit)
+    void stop(bool discard){
+        if(worker.joinable()) worker.join();
+        if(discard && !path.empty()) remove(path.c_str());
+    }
+};
+
+// The recovery files of one session: recovery-<id>.paint and journal-<id>.wal,
+// next to recovery-<id>.lock, which the running instance keeps locked. The OS
+// drops the lock when the process ends, however it ends, so files whose lock
+// can be taken belong to a session that did not exit cleanly, and two
+// instances never write or offer the same files.
+class RecoverySession{
+private:
+    std::string lockPath;
+#if defined(_WIN32)
+    HANDLE lockHandle{INVALID_HANDLE_VALUE};
+#else
+    int lockFd{-1};
+#endif
+
+public:
+    std::string id;
+    std::string recoveryPath;
+    std::string journalPath;
+
+    RecoverySession() = default;
+    ~RecoverySession(){unlock(false);}
+    RecoverySession(const RecoverySession&) = delete;
+    RecoverySession& operator=(const RecoverySession&) = delete;
+
+    // Names the files of session id in dir (which ends in a separator, as SDL_GetPrefPath's does)
+    void open(const std::string &dir, const std::string &session_id){
+        unlock(false);
+        id = session_id;
+        lockPath = dir + "recovery-" + id + ".lock";
+        recoveryPath = dir + "recovery-" + id + ".paint";
+        journalPath = dir + "journal-" + id + ".wal";
+    }
+
+    // An id no other live instance uses: the process id, and the start time in
+    // case the id of a crashed process comes round again
+    static std::string newId(){
+#if defined(_WIN32)
+        unsigned long pid = GetCurrentProcessId();
+#else
+        unsigned long pid = (unsigned long)getpid();
+#endif
+        return std::to_string(pid) + "-" + std::to_string((long long)time(nullptr));
+    }
+
+    // false if another instance holds the lock
+    bool lock(){
+        if(isLocked()) return true;
+#if defined(_WIN32)
+        lockHandle = CreateFileA(lockPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);    // no sharing: the open itself is the lock
+#else
+        lockFd = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+        if(lockFd >= 0 && flock(lockFd, LOCK_EX | LOCK_NB) != 0){
+            close(lockFd);
+            lockFd = -1;
+        }
+#endif
+        return isLocked();
+    }
+
+    bool isLocked(){
+#if defined(_WIN32)
+        return lockHandle != INVALID_HANDLE_VALUE;
+#else
+        return lockFd >= 0;
+#endif
+    }
+
+    // Whether the session left a drawing behind
+    bool hasFiles(){
+        FILE* recovery = fopen(recoveryPath.c_str(), "rb");
+        FILE* journal = fopen(journalPath.c_str(), "rb");
+        bool has_journal = journal != nullptr && fgetc(journal) != EOF;
+        if(recovery != nullptr) fclose(recovery);
+        if(journal != nullptr) fclose(journal);
+        return recovery != nullptr || has_journal;
+    }
+
+    // Lets go of the lock; with discard the session's files go too, the lock file last
+    void unlock(bool discard){
+        if(!isLocked()) return;
+        if(discard){
+            remove(recoveryPath.c_str());
+            remove(journalPath.c_str());
+        }
+#if defined(_WIN32)
+        CloseHandle(lockHandle);
+        lockHandle = INVALID_HANDLE_VALUE;
+        if(discard) DeleteFileA(lockPath.c_str());
+#else
+        if(discard) remove(lockPath.c_str());
+        close(lockFd);
+        lockFd = -1;
+#endif
+    }
+
+    // Sessions in dir that ended without a clean exit, each returned locked so
+    // that no other instance offers it at the same time
+    static std::vector<std::unique_ptr<RecoverySession>> findAbandoned(const std::string &dir){
+        std::vector<std::unique_ptr<RecoverySession>> found;
+        std::error_code error;
+        for(const auto &entry: std::filesystem::directory_iterator(dir.empty() ? "." : dir, error)){
+            std::string name = entry.path().filename().string();
+            if(name.size() <= 14 || name.compare(0, 9, "recovery-") != 0 || name.compare(name.size() - 5, 5, ".lock") != 0) continue;
+            auto session = std::make_unique<RecoverySession>();
+            session->open(dir, name.substr(9, name.size() - 14));
+            if(session->lock()) found.push_back(std::move(session));
+        }
+        return found;
+    }
+};
+
+#endif
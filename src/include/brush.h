@@ -0,0 +1,129 @@
+#ifndef BRUSH_H
+#define BRUSH_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <vector>
+#include "vec2.h"
+#include "canvas.h"
+
+typedef struct BrushSettings{
+    double size{1.0};        // dab diameter in pixels
+    double hardness{0.8};    // fraction of the radius at full strength before the falloff
+    double opacity{1.0};     // scales the ink alpha
+    double flow{1.0};        // alpha of every single dab
+    double spacing{0.15};    // distance between dabs as a fraction of size
+} BrushSettings;
+
+// Pre-rasterized dab coverage for one size, hardness and sub-pixel phase
+typedef struct DabMask{
+    int side;
+    std::vector<Uint8> coverage;    // side*side bytes
+} DabMask;
+
+const int DAB_SUBPIXEL_STEPS = 4;    // dab centres are snapped to 1/4 pixel
+const size_t DAB_CACHE_MAX_ENTRIES = 512;
+
+class DabCache{
+private:
+    typedef std::tuple<int, int, int, int> Key;    // size*4, hardness*100, phase x, phase y
+    std::map<Key, DabMask> masks;
+
+    static DabMask rasterize(double size, double hardness, double phase_x, double phase_y){
+        DabMask mask;
+        double radius = size/2;
+        mask.side = 2*(int)ceil(radius) + 3;
+        mask.coverage.resize((size_t)mask.side*mask.side);
+        double center_x = ceil(radius) + 1 + phase_x, center_y = ceil(radius) + 1 + phase_y;
+        double core = radius*std::clamp(hardness, 0.0, 1.0);
+        for(int y = 0; y < mask.side; ++y){
+            for(int x = 0; x < mask.side; ++x){
+                double d = sqrt((x + 0.5 - center_x)*(x + 0.5 - center_x) + (y + 0.5 - center_y)*(y + 0.5 - center_y));
+                double value;
+                if(d <= core) value = 1.0;
+                else if(d >= radius + 0.5) value = 0.0;
+                else{
+                    double t = std::clamp((d - core)/(radius + 0.5 - core), 0.0, 1.0);
+                    value = 1.0 - t*t*(3 - 2*t);    // smoothstep falloff, also anti-aliases hard dabs
+                }
+                mask.coverage[(size_t)y*mask.side + x] = (Uint8)(value*255 + 0.5);
+            }
+        }
+        return mask;
+    }
+
+public:
+    const DabMask &get(double size, double hardness, int phase_x, int phase_y){
+        Key key((int)round(size*4), (int)round(hardness*100), phase_x, phase_y);
+        auto it = masks.find(key);
+        if(it != masks.end()) return it->second;
+        if(masks.size() >= DAB_CACHE_MAX_ENTRIES) masks.clear();
+        return masks[key] = rasterize(std::get<0>(key)/4.0, std::get<1>(key)/100.0, (double)phase_x/DAB_SUBPIXEL_STEPS, (double)phase_y/DAB_SUBPIXEL_STEPS);
+    }
+    size_t size(){return masks.size();}
+};
+
+// Places dabs along the stroke path at a fixed spacing, carrying the leftover
+// distance between events, so the result does not depend on the event rate.
+class BrushEngine{
+private:
+    DabCache cache;
+    vec2 lastPos;
+    double distanceToNextDab{0.0};
+
+    void stamp(Canvas &canvas, vec2 center, Uint32 color){
+        int phase_x = (int)floor((center.x - floor(center.x))*DAB_SUBPIXEL_STEPS);
+        int phase_y = (int)floor((center.y - floor(center.y))*DAB_SUBPIXEL_STEPS);
+        const DabMask &mask = cache.get(settings.size, settings.hardness, phase_x, phase_y);
+        // the mask centre sits at ceil(radius) + 1 + phase, see DabCache::rasterize
+        int mask_offset = (int)ceil(round(settings.size*4)/8) + 1;
+        int origin_x = (int)floor(center.x) - mask_offset;
+        int origin_y = (int)floor(center.y) - mask_offset;
+        SDL_Rect clip = canvas.getClip();
+        int x0 = std::max(clip.x, origin_x), x1 = std::min(clip.x + clip.w, origin_x + mask.side);
+        int y0 = std::max(clip.y, origin_y), y1 = std::min(clip.y + clip.h, origin_y + mask.side);
+        if(x1 <= x0 || y1 <= y0) return;
+        for(int y = y0; y < y1; ++y){
+            const Uint8* coverage = mask.coverage.data() + (size_t)(y - origin_y)*mask.side + (x0 - origin_x);
+            Canvas::blendCoverageSpan(canvas.getRow(y) + x0, coverage, x1 - x0, color);
+        }
+        canvas.markDirty({x0, y0, x1 - x0, y1 - y0});
+    }
+
+    Uint32 inkColor(SDL_Color color){
+        color.a = (Uint8)std::clamp(color.a*settings.opacity*settings.flow + 0.5, 0.0, 255.0);
+        return Canvas::mapColor(color);
+    }
+
+public:
+    BrushSettings settings;
+
+    double dabSpacing(){return std::max(0.5, settings.spacing*settings.size);}
+
+    void begin(Canvas &canvas, vec2 pos, SDL_Color color){
+        lastPos = pos;
+        distanceToNextDab = dabSpacing();
+        stamp(canvas, pos, inkColor(color));
+    }
+
+    void strokeTo(Canvas &canvas, vec2 pos, SDL_Color color){
+        Uint32 ink = inkColor(color);
+        double spacing = dabSpacing();
+        vec2 d = pos - lastPos;
+        double len = norm(d);
+        double travelled = 0.0;
+        while(len - travelled >= distanceToNextDab){
+            travelled += distanceToNextDab;
+            stamp(canvas, lastPos + (travelled/len)*d, ink);
+            distanceToNextDab = spacing;
+        }
+        distanceToNextDab -= len - travelled;
+        lastPos = pos;
+    }
+
+    size_t cachedMasks(){return cache.size();}
+};
+
+#endif
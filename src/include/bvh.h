@@ -0,0 +1,237 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <vector>
+
+typedef struct AABB{
+    float min_x, min_y, max_x, max_y;
+} AABB;
+
+inline AABB unionAABB(const AABB &a, const AABB &b){
+    return {std::min(a.min_x, b.min_x), std::min(a.min_y, b.min_y), std::max(a.max_x, b.max_x), std::max(a.max_y, b.max_y)};
+}
+inline float perimeterAABB(const AABB &a){return 2*((a.max_x - a.min_x) + (a.max_y - a.min_y));}
+inline bool overlapAABB(const AABB &a, const AABB &b){
+    return a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y;
+}
+inline bool containsPointAABB(const AABB &a, float x, float y){
+    return x >= a.min_x && x <= a.max_x && y >= a.min_y && y <= a.max_y;
+}
+
+// Dynamic bounding volume hierarchy (the incremental AABB tree of Box2D):
+// leaves are inserted next to the sibling that grows the tree the least and
+// AVL rotations keep it balanced, so insert, remove and queries stay O(log n)
+// no matter in which order objects arrive or move.
+class AABBTree{
+private:
+    static const int NULL_NODE = -1;
+
+    struct Node{
+        AABB box;
+        int parent{NULL_NODE};    // doubles as the free list link
+        int child1{NULL_NODE};
+        int child2{NULL_NODE};
+        int height{0};            // leaf = 0, free = -1
+        int object{-1};
+        bool isLeaf() const{return child1 == NULL_NODE;}
+    };
+
+    std::vector<Node> nodes;
+    int root{NULL_NODE};
+    int freeList{NULL_NODE};
+    int leafCount{0};
+
+    int allocateNode(){
+        if(freeList == NULL_NODE){
+            nodes.emplace_back();
+            return (int)nodes.size() - 1;
+        }
+        int node = freeList;
+        freeList = nodes[node].parent;
+        nodes[node] = Node();
+        return node;
+    }
+
+    void freeNode(int node){
+        nodes[node].parent = freeList;
+        nodes[node].height = -1;
+        freeList = node;
+    }
+
+    void insertLeaf(int leaf){
+        if(root == NULL_NODE){
+            root = leaf;
+            nodes[root].parent = NULL_NODE;
+            return;
+        }
+
+        // find the best sibling by the surface area heuristic
+        AABB leaf_box = nodes[leaf].box;
+        int index = root;
+        while(!nodes[index].isLeaf()){
+            int child1 = nodes[index].child1, child2 = nodes[index].child2;
+            float area = perimeterAABB(nodes[index].box);
+            float combined_area = perimeterAABB(unionAABB(nodes[index].box, leaf_box));
+            float cost = 2*combined_area;
+            float inheritance_cost = 2*(combined_area - area);
+            auto descend_cost = [&](int child){
+                float new_area = perimeterAABB(unionAABB(leaf_box, nodes[child].box));
+                if(nodes[child].isLeaf()) return new_area + inheritance_cost;
+                return new_area - perimeterAABB(nodes[child].box) + inheritance_cost;
+            };
+            float cost1 = descend_cost(child1), cost2 = descend_cost(child2);
+            if(cost < cost1 && cost < cost2) break;
+            index = cost1 < cost2 ? child1 : child2;
+        }
+        int sibling = index;
+
+        int old_parent = nodes[sibling].parent;
+        int new_parent = allocateNode();
+        nodes[new_parent].parent = old_parent;
+        nodes[new_parent].box = unionAABB(leaf_box, nodes[sibling].box);
+        nodes[new_parent].height = nodes[sibling].height + 1;
+        nodes[new_parent].child1 = sibling;
+        nodes[new_parent].child2 = leaf;
+        nodes[sibling].parent = new_parent;
+        nodes[leaf].parent = new_parent;
+        if(old_parent != NULL_NODE){
+            if(nodes[old_parent].child1 == sibling) nodes[old_parent].child1 = new_parent;
+            else nodes[old_parent].child2 = new_parent;
+        }
+        else root = new_parent;
+
+        refitFrom(nodes[leaf].parent);
+    }
+
+    void removeLeaf(int leaf){
+        if(leaf == root){
+            root = NULL_NODE;
+            return;
+        }
+        int parent = nodes[leaf].parent;
+        int grand_parent = nodes[parent].parent;
+        int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+        if(grand_parent != NULL_NODE){
+            if(nodes[grand_parent].child1 == parent) nodes[grand_parent].child1 = sibling;
+            else nodes[grand_parent].child2 = sibling;
+            nodes[sibling].parent = grand_parent;
+            freeNode(parent);
+            refitFrom(grand_parent);
+        }
+        else{
+            root = sibling;
+            nodes[sibling].parent = NULL_NODE;
+            freeNode(parent);
+        }
+    }
+
+    // Walk back to the root fixing boxes and heights, rebalancing on the way
+    void refitFrom(int index){
+        while(index != NULL_NODE){
+            index = balance(index);
+            int child1 = nodes[index].child1, child2 = nodes[index].child2;
+            nodes[index].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+            nodes[index].box = unionAABB(nodes[child1].box, nodes[child2].box);
+            index = nodes[index].parent;
+        }
+    }
+
+    // Rotate the taller grandchild up if the subtree of a is unbalanced; returns the new subtree root
+    int balance(int a){
+        Node &node_a = nodes[a];
+        if(node_a.isLeaf() || node_a.height < 2) return a;
+        int b = node_a.child1, c = node_a.child2;
+        int diff = nodes[c].height - nodes[b].height;
+        if(diff > 1) return rotate(a, c, b);
+        if(diff < -1) return rotate(a, b, c);
+        return a;
+    }
+
+    // Promote up (a child of a) above a; other is a's remaining child
+    int rotate(int a, int up, int other){
+        int f = nodes[up].child1, g = nodes[up].child2;
+        nodes[up].child1 = a;
+        nodes[up].parent = nodes[a].parent;
+        nodes[a].parent = up;
+        if(nodes[up].parent != NULL_NODE){
+            if(nodes[nodes[up].parent].child1 == a) nodes[nodes[up].parent].child1 = up;
+            else nodes[nodes[up].parent].child2 = up;
+        }
+        else root = up;
+
+        // the taller grandchild stays under up, the other one moves to a
+        int keep = nodes[f].height > nodes[g].height ? f : g;
+        int move = keep == f ? g : f;
+        nodes[up].child2 = keep;
+        if(nodes[a].child1 == up) nodes[a].child1 = move;
+        else nodes[a].child2 = move;
+        nodes[move].parent = a;
+        nodes[a].box = unionAABB(nodes[other].box, nodes[move].box);
+        nodes[a].height = 1 + std::max(nodes[other].height, nodes[move].height);
+        nodes[up].box = unionAABB(nodes[a].box, nodes[keep].box);
+        nodes[up].height = 1 + std::max(nodes[a].height, nodes[keep].height);
+        return up;
+    }
+
+public:
+    // Returns the leaf handle used by remove() and move()
+    int insert(const AABB &box, int object){
+        int leaf = allocateNode();
+        nodes[leaf].box = box;
+        nodes[leaf].object = object;
+        nodes[leaf].height = 0;
+        insertLeaf(leaf);
+        ++leafCount;
+        return leaf;
+    }
+
+    void remove(int leaf){
+        removeLeaf(leaf);
+        freeNode(leaf);
+        --leafCount;
+    }
+
+    void move(int leaf, const AABB &box){
+        removeLeaf(leaf);
+        nodes[leaf].box = box;
+        insertLeaf(leaf);
+    }
+
+    void clear(){
+        nodes.clear();
+        root = freeList = NULL_NODE;
+        leafCount = 0;
+    }
+
+    // Calls fn(object) for every leaf whose box overlaps box; safe to call
+    // from several threads as long as nobody modifies the tree meanwhile
+    template<typename Fn>
+    void query(const AABB &box, Fn fn) const{
+        if(root == NULL_NODE) return;
+        std::vector<int> stack;
+        stack.reserve(64);
+        stack.push_back(root);
+        while(!stack.empty()){
+            int index = stack.back();
+            stack.pop_back();
+            const Node &node = nodes[index];
+            if(!overlapAABB(node.box, box)) continue;
+            if(node.isLeaf()) fn(node.object);
+            else{
+                stack.push_back(node.child1);
+                stack.push_back(node.child2);
+            }
+        }
+    }
+
+    template<typename Fn>
+    void queryPoint(float x, float y, Fn fn) const{
+        query({x, y, x, y}, fn);
+    }
+
+    int size(){return leafCount;}
+    int height(){return root == NULL_NODE ? 0 : nodes[root].height;}
+};
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "vec2.h"
+
+// System-memory copy of the drawing, the single source of truth for pixels.
+// Every committed operation rasterizes here; the GPU texture only receives the
+// dirty region once per frame, so reading pixels never stalls on the GPU.
+// Pixels are SDL_PIXELFORMAT_RGBA8888 (0xRRGGBBAA).
+class Canvas{
+private:
+    int width, height;
+    std::vector<Uint32> pixels;
+    SDL_Texture* texture{nullptr};
+    SDL_Rect dirtyRect{0, 0, 0, 0};
+    SDL_Rect clipRect;    // drawing outside of it is discarded
+
+    // rounded x/255 for x <= 255*255, same arithmetic as the SIMD path
+    static inline Uint32 div255(Uint32 x){
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    // SDL_BLENDMODE_BLEND of src (its own alpha scaled by weight/255) over dst
+    static inline void blendWeighted(Uint32 &dst, Uint32 src, Uint32 weight){
+        Uint32 a = div255((src & 0xFF)*weight);
+        if(a == 255){dst = src | 0xFF; return;}
+        if(a == 0) return;
+        Uint32 inv = 255 - a;
+        Uint32 r = div255(((src >> 24) & 0xFF)*a + ((dst >> 24) & 0xFF)*inv);
+        Uint32 g = div255(((src >> 16) & 0xFF)*a + ((dst >> 16) & 0xFF)*inv);
+        Uint32 b = div255(((src >> 8) & 0xFF)*a + ((dst >> 8) & 0xFF)*inv);
+        Uint32 out_a = div255(255*a + (dst & 0xFF)*inv);
+        dst = (r << 24) | (g << 16) | (b << 8) | out_a;
+    }
+
+    static inline void blend(Uint32 &dst, Uint32 src){blendWeighted(dst, src, 255);}
+
+public:
+    Canvas(int width, int height): width(width), height(height), pixels((size_t)width*height, 0xFFFFFFFF), clipRect{0, 0, width, height}{}
+    ~Canvas(){
+        if(texture != nullptr) SDL_DestroyTexture(texture);
+    }
+    Canvas(const Canvas&) = delete;
+    Canvas& operator=(const Canvas&) = delete;
+
+    static inline Uint32 mapColor(SDL_Color color){
+        return ((Uint32)color.r << 24) | ((Uint32)color.g << 16) | ((Uint32)color.b << 8) | (Uint32)color.a;
+    }
+    static inline SDL_Color unmapColor(Uint32 pixel){
+        return {(Uint8)(pixel >> 24), (Uint8)(pixel >> 16), (Uint8)(pixel >> 8), (Uint8)pixel};
+    }
+
+    int getWidth(){return width;}
+    int getHeight(){return height;}
+    int getPitch(){return width*(int)sizeof(Uint32);}
+    Uint32* getPixels(){return pixels.data();}
+    Uint32* getRow(int y){return pixels.data() + (size_t)y*width;}
+    SDL_Texture* getTexture(){return texture;}
+    inline bool contains(int x, int y){return x >= 0 && y >= 0 && x < width && y < height;}
+    inline Uint32 getPixel(int x, int y){return pixels[(size_t)y*width + x];}
+
+    // Restrict drawing to rect (e.g. a damaged region being re-rasterized)
+    void setClip(SDL_Rect rect){
+        SDL_Rect bounds = {0, 0, width, height};
+        if(!SDL_IntersectRect(&rect, &bounds, &clipRect)) clipRect = {0, 0, 0, 0};
+    }
+    void resetClip(){clipRect = {0, 0, width, height};}
+    SDL_Rect getClip(){return clipRect;}
+    inline bool inClip(int x, int y){return x >= clipRect.x && y >= clipRect.y && x < clipRect.x + clipRect.w && y < clipRect.y + clipRect.h;}
+
+    bool createTexture(SDL_Renderer* renderer){
+        if(texture != nullptr) SDL_DestroyTexture(texture);
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+        if(texture == nullptr) return false;
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        markAllDirty();
+        return true;
+    }
+
+    void markDirty(SDL_Rect rect){
+        SDL_Rect bounds = {0, 0, width, height};
+        if(!SDL_IntersectRect(&rect, &bounds, &rect)) return;
+        if(SDL_RectEmpty(&dirtyRect)) dirtyRect = rect;
+        else SDL_UnionRect(&dirtyRect, &rect, &dirtyRect);
+    }
+    void markAllDirty(){dirtyRect = {0, 0, width, height};}
+    SDL_Rect getDirtyRect(){return dirtyRect;}
+
+    // Push the region changed since the last call to the GPU texture
+    void upload(){
+        if(texture == nullptr || SDL_RectEmpty(&dirtyRect)) return;
+        SDL_UpdateTexture(texture, &dirtyRect, getRow(dirtyRect.y) + dirtyRect.x, getPitch());
+        dirtyRect = {0, 0, 0, 0};
+    }
+
+    void clear(SDL_Color color){
+        std::fill(pixels.begin(), pixels.end(), mapColor(color));
+        markAllDirty();
+    }
+
+    // Replace the whole image with width*height pixels from src
+    void load(const Uint32* src){
+        std::copy(src, src + pixels.size(), pixels.begin());
+        markAllDirty();
+    }
+    void store(Uint32* dst){std::copy(pixels.begin(), pixels.end(), dst);}
+
+    // Copy rect from src, a full width*height image, ignoring the clip
+    void loadRegion(const Uint32* src, SDL_Rect rect){
+        SDL_Rect bounds = {0, 0, width, height};
+        if(!SDL_IntersectRect(&rect, &bounds, &rect)) return;
+        for(int y = rect.y; y < rect.y + rect.h; ++y){
+            const Uint32* row = src + (size_t)y*width + rect.x;
+            std::copy(row, row + rect.w, getRow(y) + rect.x);
+        }
+        markDirty(rect);
+    }
+
+    // Blend color over count pixels, each weighted by its coverage byte
+    // (anti-aliased spans, brush dabs). Four pixels per step with SSE2.
+    static void blendCoverageSpan(Uint32* dst, const Uint8* coverage, int count, Uint32 color){
+        int i = 0;
+#if defined(__SSE2__)
+        const Uint32 color_alpha = color & 0xFF;
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i all = _mm_set1_epi16(255);
+        const __m128i bias = _mm_set1_epi16(128);
+        const __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int)(color | 0xFF)), zero);
+        for(; i + 4 <= count; i += 4){
+            Uint32 c0 = coverage[i], c1 = coverage[i+1], c2 = coverage[i+2], c3 = coverage[i+3];
+            if((c0 | c1 | c2 | c3) == 0) continue;
+            short a0 = (short)div255(c0*color_alpha), a1 = (short)div255(c1*color_alpha);
+            short a2 = (short)div255(c2*color_alpha), a3 = (short)div255(c3*color_alpha);
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i w_lo = _mm_setr_epi16(a0, a0, a0, a0, a1, a1, a1, a1);
+            __m128i w_hi = _mm_setr_epi16(a2, a2, a2, a2, a3, a3, a3, a3);
+            __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+            __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+            __m128i v_lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(src, w_lo), _mm_mullo_epi16(d_lo, _mm_sub_epi16(all, w_lo))), bias);
+            __m128i v_hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(src, w_hi), _mm_mullo_epi16(d_hi, _mm_sub_epi16(all, w_hi))), bias);
+            v_lo = _mm_srli_epi16(_mm_add_epi16(v_lo, _mm_srli_epi16(v_lo, 8)), 8);
+            v_hi = _mm_srli_epi16(_mm_add_epi16(v_hi, _mm_srli_epi16(v_hi, 8)), 8);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(v_lo, v_hi));
+        }
+#endif
+        for(; i < count; ++i) if(coverage[i]) blendWeighted(dst[i], color, coverage[i]);
+    }
+
+    inline void blendPixel(int x, int y, Uint32 color){
+        if(inClip(x, y)) blend(pixels[(size_t)y*width + x], color);
+    }
+
+    // Blend color over [x0, x1) of row y, clipped to the clip rect
+    inline void blendSpan(int x0, int x1, int y, Uint32 color){
+        if(y < clipRect.y || y >= clipRect.y + clipRect.h) return;
+        x0 = std::max(x0, clipRect.x);
+        x1 = std::min(x1, clipRect.x + clipRect.w);
+        Uint32* row = getRow(y);
+        if((color & 0xFF) == 255) std::fill(row + x0, row + std::max(x0, x1), color);
+        else for(int x = x0; x < x1; ++x) blend(row[x], color);
+    }
+
+    void drawPoint(double x, double y, SDL_Color color){
+        int px = (int)floor(x), py = (int)floor(y);
+        blendPixel(px, py, mapColor(color));
+        markDirty({px, py, 1, 1});
+    }
+
+    // 1 pixel wide line including both end points, like SDL_RenderDrawLineF
+    void drawLine(double x0, double y0, double x1, double y1, SDL_Color color){
+        Uint32 pixel = mapColor(color);
+        int steps = (int)std::max(fabs(x1 - x0), fabs(y1 - y0));
+        for(int i = 0; i <= steps; ++i){
+            double t = steps > 0 ? (double)i/steps : 0.0;
+            blendPixel((int)floor(x0 + (x1 - x0)*t), (int)floor(y0 + (y1 - y0)*t), pixel);
+        }
+        int min_x = (int)floor(std::min(x0, x1)), min_y = (int)floor(std::min(y0, y1));
+        markDirty({min_x, min_y, (int)floor(std::max(x0, x1)) - min_x + 1, (int)floor(std::max(y0, y1)) - min_y + 1});
+    }
+
+    void fillRect(SDL_FRect rect, SDL_Color color){
+        int x0 = (int)round(rect.x), y0 = (int)round(rect.y);
+        int x1 = (int)round(rect.x + rect.w), y1 = (int)round(rect.y + rect.h);
+        Uint32 pixel = mapColor(color);
+        for(int y = std::max(y0, 0); y < std::min(y1, height); ++y) blendSpan(x0, x1, y, pixel);
+        markDirty({x0, y0, x1 - x0, y1 - y0});
+    }
+
+    // 1 pixel border on the inside of rect, like SDL_RenderDrawRectF
+    void drawRect(SDL_FRect rect, SDL_Color color){
+        int x0 = (int)round(rect.x), y0 = (int)round(rect.y);
+        int x1 = (int)round(rect.x + rect.w), y1 = (int)round(rect.y + rect.h);
+        if(x1 <= x0 || y1 <= y0) return;
+        Uint32 pixel = mapColor(color);
+        blendSpan(x0, x1, y0, pixel);
+        if(y1 - 1 > y0) blendSpan(x0, x1, y1 - 1, pixel);
+        for(int y = y0 + 1; y < y1 - 1; ++y){
+            blendPixel(x0, y, pixel);
+            if(x1 - 1 > x0) blendPixel(x1 - 1, y, pixel);
+        }
+        markDirty({x0, y0, x1 - x0, y1 - y0});
+    }
+
+    void fillEllipse(vec2 center, vec2 radius, SDL_Color color){
+        if(radius.x <= 0 || radius.y <= 0) return;
+        Uint32 pixel = mapColor(color);
+        int y0 = (int)floor(center.y - radius.y), y1 = (int)ceil(center.y + radius.y);
+        for(int y = std::max(y0, 0); y < std::min(y1, height); ++y){
+            double t = (y + 0.5 - center.y)/radius.y;
+            if(t*t >= 1.0) continue;
+            double half = radius.x*sqrt(1.0 - t*t);
+            blendSpan((int)ceil(center.x - half - 0.5), (int)floor(center.x + half - 0.5) + 1, y, pixel);
+        }
+        markDirty({(int)floor(center.x - radius.x), y0, (int)ceil(2*radius.x) + 1, y1 - y0 + 1});
+    }
+
+    // Same point sampling as Ellipse::drawEllipse so preview and result match
+    void drawEllipse(vec2 center, vec2 radius, SDL_Color color){
+        double max_radius = std::max(radius.x, radius.y);
+        if(max_radius <= 0) return;
+        Uint32 pixel = mapColor(color);
+        for(double i = 0; i < 180; i += 50.0/max_radius){
+            double angle = M_PI*i/180;
+            double x = center.x + radius.x*cos(angle);
+            double y = center.y + radius.y*sin(angle);
+            blendPixel((int)floor(x), (int)floor(y), pixel);
+            blendPixel((int)floor(2*center.x - x), (int)floor(2*center.y - y), pixel);
+        }
+        markDirty({(int)floor(center.x - radius.x) - 1, (int)floor(center.y - radius.y) - 1, (int)ceil(2*radius.x) + 3, (int)ceil(2*radius.y) + 3});
+    }
+
+    // Every pixel whose centre lies within radius of segment ab (a rotated
+    // rectangle with round caps), used by the eraser
+    void fillCapsule(vec2 a, vec2 b, double radius, SDL_Color color){
+        Uint32 pixel = mapColor(color);
+        int x0 = (int)floor(std::min(a.x, b.x) - radius), x1 = (int)ceil(std::max(a.x, b.x) + radius);
+        int y0 = (int)floor(std::min(a.y, b.y) - radius), y1 = (int)ceil(std::max(a.y, b.y) + radius);
+        vec2 ab = b - a;
+        double len_sq = sqnorm(ab);
+        for(int y = std::max(y0, clipRect.y); y < std::min(y1 + 1, clipRect.y + clipRect.h); ++y){
+            for(int x = std::max(x0, clipRect.x); x < std::min(x1 + 1, clipRect.x + clipRect.w); ++x){
+                vec2 p(x + 0.5, y + 0.5);
+                double t = len_sq > 0 ? std::clamp(dot(p - a, ab)/len_sq, 0.0, 1.0) : 0.0;
+                if(sqnorm(p - (a + t*ab)) <= radius*radius) blend(pixels[(size_t)y*width + x], pixel);
+            }
+        }
+        markDirty({x0, y0, x1 - x0 + 1, y1 - y0 + 1});
+    }
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef CURVEFIT_H
+#define CURVEFIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "vec2.h"
+#include "arena.h"
+
+typedef struct CubicBezier{
+    vec2 p0, p1, p2, p3;
+} CubicBezier;
+
+inline vec2 evaluateBezier(const CubicBezier &b, double t){
+    double s = 1 - t;
+    return (s*s*s)*b.p0 + (3*s*s*t)*b.p1 + (3*s*t*t)*b.p2 + (t*t*t)*b.p3;
+}
+
+inline vec2 bezierDerivative(const CubicBezier &b, double t){
+    double s = 1 - t;
+    return (3*s*s)*(b.p1 - b.p0) + (6*s*t)*(b.p2 - b.p1) + (3*t*t)*(b.p3 - b.p2);
+}
+
+inline vec2 bezierSecondDerivative(const CubicBezier &b, double t){
+    return (6*(1 - t))*(b.p2 - 2*b.p1 + b.p0) + (6*t)*(b.p3 - 2*b.p2 + b.p1);
+}
+
+// Appends points along the curve, spaced so the polyline stays within
+// tolerance pixels of it; the first point of every segment but the first is skipped
+inline void flattenBezierPath(const std::vector<CubicBezier> &path, double tolerance, std::vector<vec2> &out){
+    for(size_t i = 0; i < path.size(); ++i){
+        const CubicBezier &b = path[i];
+        // the second difference bounds the deviation of a uniform subdivision
+        double dd = std::max(norm(b.p0 - 2*b.p1 + b.p2), norm(b.p1 - 2*b.p2 + b.p3));
+        int steps = std::max(1, (int)ceil(sqrt(0.75*dd/std::max(tolerance, 1e-3))));
+        if(i == 0) out.push_back(b.p0);
+        for(int k = 1; k <= steps; ++k) out.push_back(evaluateBezier(b, (double)k/steps));
+    }
+}
+
+// Least-squares piecewise cubic fit of a digitized stroke (Schneider, "An Algorithm
+// for Automatically Fitting Digitized Curves", Graphics Gems 1990). Segments are
+// split at the point of worst error until every sample lies within tolerance
+// pixels; tangents are shared at the joints so the path stays G1 continuous.
+// The spans still to fit are kept on an explicit stack, and a span split more
+// than MAX_DEPTH times becomes straight segments: records from the journal and
+// from peers can hold paths that split next to one end every time, which would
+// otherwise mean recursion and work proportional to the square of the length.
+class CurveFitter{
+private:
+    struct Span{
+        int first, last;
+        vec2 tangent1, tangent2;
+        int depth;
+    };
+
+    const vec2* points{nullptr};
+    double maxSquaredError{1.0};
+    std::vector<CubicBezier>* out{nullptr};
+    ArenaVector<double> u, uPrime;
+    ArenaVector<Span> pending;
+
+    static const int MAX_ITERATIONS = 4;
+    static const int MAX_DEPTH = 32;
+
+    static vec2 unit(vec2 v){
+        double len = norm(v);
+        return len > 1e-12 ? v/len : v;
+    }
+
+    void chordLengthParameterize(int first, int last){
+        u[first] = 0.0;
+        for(int i = first + 1; i <= last; ++i) u[i] = u[i-1] + norm(points[i] - points[i-1]);
+        double total = u[last];
+        for(int i = first + 1; i <= last; ++i) u[i] = total > 0 ? u[i]/total : (double)(i - first)/(last - first);
+    }
+
+    CubicBezier generateBezier(int first, int last, const ArenaVector<double> &params, vec2 tangent1, vec2 tangent2){
+        double c00 = 0, c01 = 0, c11 = 0, x0 = 0, x1 = 0;
+        vec2 p0 = points[first], p3 = points[last];
+        for(int i = first; i <= last; ++i){
+            double t = params[i], s = 1 - t;
+            double b0 = s*s*s, b1 = 3*s*s*t, b2 = 3*s*t*t, b3 = t*t*t;
+            vec2 a1 = b1*tangent1, a2 = b2*tangent2;
+            c00 += dot(a1, a1);
+            c01 += dot(a1, a2);
+            c11 += dot(a2, a2);
+            vec2 tmp = points[i] - ((b0 + b1)*p0 + (b2 + b3)*p3);
+            x0 += dot(a1, tmp);
+            x1 += dot(a2, tmp);
+        }
+        double det = c00*c11 - c01*c01;
+        double alpha1 = 0, alpha2 = 0;
+        if(fabs(det) > 1e-12){
+            alpha1 = (x0*c11 - c01*x1)/det;
+            alpha2 = (c00*x1 - c01*x0)/det;
+        }
+        double seg_len = norm(p3 - p0);
+        double epsilon = 1e-6*seg_len;
+        if(alpha1 < epsilon || alpha2 < epsilon){
+            // degenerate system, fall back to Wu/Barsky's heuristic
+            alpha1 = alpha2 = seg_len/3;
+        }
+        return {p0, p0 + alpha1*tangent1, p3 + alpha2*tangent2, p3};
+    }
+
+    double computeMaxError(int first, int last, const CubicBezier &bezier, const ArenaVector<double> &params, int &split){
+        double max_error = 0.0;
+        split = (first + last)/2;
+        for(int i = first + 1; i < last; ++i){
+            double error = sqnorm(evaluateBezier(bezier, params[i]) - points[i]);
+            if(error >= max_error){
+                max_error = error;
+                split = i;
+            }
+        }
+        return max_error;
+    }
+
+    // One Newton-Raphson step per sample towards the closest point on the curve
+    void reparameterize(int first, int last, const CubicBezier &bezier){
+        for(int i = first; i <= last; ++i){
+            double t = u[i];
+            vec2 d = evaluateBezier(bezier, t) - points[i];
+            vec2 d1 = bezierDerivative(bezier, t), d2 = bezierSecondDerivative(bezier, t);
+            double denominator = dot(d1, d1) + dot(d, d2);
+            uPrime[i] = fabs(denominator) > 1e-12 ? std::clamp(t - dot(d, d1)/denominator, 0.0, 1.0) : t;
+        }
+    }
+
+    // Fits one span, or pushes its two halves (the first on top, so segments come out in order)
+    void fitSpan(const Span &span){
+        int first = span.first, last = span.last;
+        if(last - first == 1){
+            double dist = norm(points[last] - points[first])/3;
+            out->push_back({points[first], points[first] + dist*span.tangent1, points[last] + dist*span.tangent2, points[last]});
+            return;
+        }
+        if(span.depth >= MAX_DEPTH){
+            for(int i = first; i < last; ++i){
+                vec2 d = points[i+1] - points[i];
+                out->push_back({points[i], points[i] + (1.0/3)*d, points[i] + (2.0/3)*d, points[i+1]});
+            }
+            return;
+        }
+
+        chordLengthParameterize(first, last);
+        CubicBezier bezier = generateBezier(first, last, u, span.tangent1, span.tangent2);
+        int split;
+        double error = computeMaxError(first, last, bezier, u, split);
+        if(error < maxSquaredError){
+            out->push_back(bezier);
+            return;
+        }
+
+        // close enough that reparameterizing may bring it within tolerance
+        if(error < 4*maxSquaredError){
+            for(int iteration = 0; iteration < MAX_ITERATIONS; ++iteration){
+                reparameterize(first, last, bezier);
+                for(int i = first; i <= last; ++i) u[i] = uPrime[i];
+                bezier = generateBezier(first, last, u, span.tangent1, span.tangent2);
+                error = computeMaxError(first, last, bezier, u, split);
+                if(error < maxSquaredError){
+                    out->push_back(bezier);
+                    return;
+                }
+            }
+        }
+
+        split = std::clamp(split, first + 1, last - 1);
+        vec2 center_tangent = unit(points[split-1] - points[split+1]);
+        if(sqnorm(center_tangent) < 1e-24) center_tangent = unit(points[split-1] - points[split]);
+        pending.push_back({split, last, -1.0*center_tangent, span.tangent2, span.depth + 1});
+        pending.push_back({first, split, span.tangent1, center_tangent, span.depth + 1});
+    }
+
+public:
+    explicit CurveFitter(StrokeArena &scratch): u(ArenaAllocator<double>(&scratch)), uPrime(ArenaAllocator<double>(&scratch)), pending(ArenaAllocator<Span>(&scratch)){}
+
+    // Fits count samples (consecutive duplicates must already be removed) and
+    // appends the segments to path; a single sample gives a zero-length segment
+    void fit(const vec2* samples, size_t count, double tolerance, std::vector<CubicBezier> &path){
+        if(count == 0) return;
+        if(count == 1){
+            path.push_back({samples[0], samples[0], samples[0], samples[0]});
+            return;
+        }
+        points = samples;
+        maxSquaredError = tolerance*tolerance;
+        out = &path;
+        u.assign(count, 0.0);
+        uPrime.assign(count, 0.0);
+        int last = (int)count - 1;
+        pending.clear();
+        pending.push_back({0, last, unit(points[1] - points[0]), unit(points[last-1] - points[last]), 0});
+        while(!pending.empty()){
+            Span span = pending.back();
+            pending.pop_back();
+            fitSpan(span);
+        }
+    }
+};
+
+// Convenience wrapper: drops repeated samples, then fits them
+inline std::vector<CubicBezier> fitStroke(const vec2* samples, size_t count, double tolerance, StrokeArena &scratch){
+    ArenaVector<vec2> unique{ArenaAllocator<vec2>(&scratch)};
+    unique.reserve(count);
+    for(size_t i = 0; i < count; ++i) if(unique.empty() || sqnorm(samples[i] - unique.back()) > 1e-12) unique.push_back(samples[i]);
+    std::vector<CubicBezier> path;
+    CurveFitter fitter(scratch);
+    fitter.fit(unique.data(), unique.size(), tolerance, path);
+    return path;
+}
+
+#endif
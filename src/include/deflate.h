@@ -0,0 +1,326 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Streaming raw deflate (RFC 1951) compressor. Input is matched against the
+// last 32 KB through hash chains (greedy, bounded chain length) and every
+// block gets its own Huffman codes, so memory is fixed at about 200 KB
+// whatever the amount of data pushed through.
+class DeflateEncoder{
+private:
+    static const int WINDOW = 32768;
+    static const int MIN_MATCH = 3;
+    static const int MAX_MATCH = 258;
+    static const int HASH_BITS = 15;
+    static const int MAX_CHAIN = 32;           // candidates tried per position
+    static const int GOOD_MATCH = 64;          // stop looking once a match is this long
+    static const size_t BLOCK_SYMBOLS = 16384;
+    static const int BUFFER_SIZE = 2*WINDOW + MAX_MATCH;
+
+    struct Symbol{Uint16 litlen; Uint16 dist;};    // dist 0: literal byte, otherwise a (length, distance) pair
+
+    std::vector<Uint8> buffer;     // the window behind pos and the input ahead of it
+    int pos{0}, end{0};
+    std::vector<int> head;         // most recent position of each hash, -1 if none
+    std::vector<int> prev;         // the one before, by position & (WINDOW-1)
+    std::vector<Symbol> symbols;   // the block being collected
+    std::vector<Uint8> out;
+    Uint64 bits{0};
+    int bitCount{0};
+
+    static int lengthCode(int length){
+        static const Uint8* table = []{
+            static Uint8 codes[MAX_MATCH + 1];
+            int code = 0;
+            for(int length = MIN_MATCH; length <= MAX_MATCH; ++length){
+                while(code < 28 && length >= lengthBase(code + 1)) ++code;
+                codes[length] = (Uint8)code;
+            }
+            return codes;
+        }();
+        return table[length];
+    }
+    static int lengthBase(int code){
+        static const Uint16 base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        return base[code];
+    }
+    static int lengthExtra(int code){
+        static const Uint8 extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        return extra[code];
+    }
+    // zlib's trick: distances up to 256 directly, larger ones by distance/128
+    static int distanceCode(int distance){
+        static const Uint8* table = []{
+            static Uint8 codes[512];
+            int code = 0;
+            for(int d = 1; d <= 256; ++d){
+                while(code < 29 && d >= distanceBase(code + 1)) ++code;
+                codes[d - 1] = (Uint8)code;
+            }
+            for(int d = 257; d <= 32768; d += 128){
+                while(code < 29 && d >= distanceBase(code + 1)) ++code;
+                codes[256 + ((d - 1) >> 7)] = (Uint8)code;
+            }
+            return codes;
+        }();
+        return distance <= 256 ? table[distance - 1] : table[256 + ((distance - 1) >> 7)];
+    }
+    static int distanceBase(int code){
+        static const Uint16 base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        return base[code];
+    }
+    static int distanceExtra(int code){return code < 4 ? 0 : code/2 - 1;}
+
+    static int hash(const Uint8* p){return (((int)p[0] << 10) ^ ((int)p[1] << 5) ^ p[2]) & ((1 << HASH_BITS) - 1);}
+
+    void putBits(Uint32 value, int count){
+        bits |= (Uint64)value << bitCount;
+        bitCount += count;
+        while(bitCount >= 8){
+            out.push_back((Uint8)bits);
+            bits >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    // Huffman code lengths no longer than limit for the given frequencies
+    static void buildLengths(const std::vector<Uint32> &freq, int limit, std::vector<Uint8> &lengths){
+        int n = (int)freq.size();
+        lengths.assign(n, 0);
+        std::vector<Uint32> f(freq);
+        while(true){
+            std::vector<int> leaves;
+            for(int i = 0; i < n; ++i) if(f[i] > 0) leaves.push_back(i);
+            if(leaves.empty()) return;
+            if(leaves.size() == 1){
+                lengths[leaves[0]] = 1;
+                return;
+            }
+            std::sort(leaves.begin(), leaves.end(), [&f](int a, int b){return f[a] < f[b];});
+            // two queue Huffman: leaves by frequency, then internal nodes in creation order
+            std::vector<Uint64> weight;
+            std::vector<int> parent;
+            for(int leaf: leaves) weight.push_back(f[leaf]);
+            parent.assign(leaves.size(), -1);
+            size_t next_leaf = 0, next_node = leaves.size();
+            auto take = [&]{
+                if(next_leaf < leaves.size() && (next_node >= weight.size() || weight[next_leaf] <= weight[next_node])) return (int)next_leaf++;
+                return (int)next_node++;
+            };
+            for(size_t k = 1; k < leaves.size(); ++k){
+                int a = take(), b = take();
+                weight.push_back(weight[a] + weight[b]);
+                parent.push_back(-1);
+                parent[a] = parent[b] = (int)weight.size() - 1;
+            }
+            std::vector<int> depth(weight.size(), 0);
+            int deepest = 0;
+            for(int i = (int)weight.size() - 2; i >= 0; --i){
+                depth[i] = depth[parent[i]] + 1;
+                deepest = std::max(deepest, depth[i]);
+            }
+            if(deepest <= limit){
+                for(size_t i = 0; i < leaves.size(); ++i) lengths[leaves[i]] = (Uint8)depth[i];
+                return;
+            }
+            for(auto &v: f) if(v > 0) v = (v + 1)/2;    // flatten the distribution and try again
+        }
+    }
+
+    // Canonical codes, bit reversed because deflate sends them from the top bit
+    static void buildCodes(const std::vector<Uint8> &lengths, std::vector<Uint16> &codes){
+        int count[16] = {0}, next[16] = {0};
+        for(Uint8 l: lengths) ++count[l];
+        count[0] = 0;
+        for(int b = 1, code = 0; b < 16; ++b){
+            code = (code + count[b - 1]) << 1;
+            next[b] = code;
+        }
+        codes.assign(lengths.size(), 0);
+        for(size_t i = 0; i < lengths.size(); ++i){
+            int l = lengths[i];
+            if(l == 0) continue;
+            int code = next[l]++, reversed = 0;
+            for(int b = 0; b < l; ++b) reversed |= ((code >> b) & 1) << (l - 1 - b);
+            codes[i] = (Uint16)reversed;
+        }
+    }
+
+    void writeBlock(bool final){
+        std::vector<Uint32> lit_freq(286, 0), dist_freq(30, 0);
+        for(const Symbol &s: symbols){
+            if(s.dist == 0) ++lit_freq[s.litlen];
+            else{
+                ++lit_freq[257 + lengthCode(s.litlen)];
+                ++dist_freq[distanceCode(s.dist)];
+            }
+        }
+        lit_freq[256] = 1;
+        // some decoders reject a code with a single symbol
+        int used = (int)std::count_if(dist_freq.begin(), dist_freq.end(), [](Uint32 v){return v > 0;});
+        for(int i = 0; i < 2 && used < 2; ++i) if(dist_freq[i] == 0){
+            dist_freq[i] = 1;
+            ++used;
+        }
+        std::vector<Uint8> lit_len, dist_len;
+        buildLengths(lit_freq, 15, lit_len);
+        buildLengths(dist_freq, 15, dist_len);
+        int hlit = 286, hdist = 30;
+        while(hlit > 257 && lit_len[hlit - 1] == 0) --hlit;
+        while(hdist > 1 && dist_len[hdist - 1] == 0) --hdist;
+
+        // code lengths of both trees, run length coded with 16 (repeat), 17 and 18 (zeros)
+        std::vector<Uint8> all(lit_len.begin(), lit_len.begin() + hlit);
+        all.insert(all.end(), dist_len.begin(), dist_len.begin() + hdist);
+        std::vector<Uint8> cl_symbols, cl_extra;
+        for(size_t i = 0; i < all.size();){
+            size_t run = 1;
+            while(i + run < all.size() && all[i + run] == all[i]) ++run;
+            if(all[i] == 0 && run >= 3){
+                size_t n = std::min<size_t>(run, 138);
+                cl_symbols.push_back(n >= 11 ? 18 : 17);
+                cl_extra.push_back((Uint8)(n >= 11 ? n - 11 : n - 3));
+                i += n;
+            }
+            else if(all[i] != 0 && run >= 4){
+                cl_symbols.push_back(all[i]);
+                cl_extra.push_back(0);
+                size_t n = std::min<size_t>(run - 1, 6);
+                cl_symbols.push_back(16);
+                cl_extra.push_back((Uint8)(n - 3));
+                i += 1 + n;
+            }
+            else{
+                cl_symbols.push_back(all[i]);
+                cl_extra.push_back(0);
+                ++i;
+            }
+        }
+        std::vector<Uint32> cl_freq(19, 0);
+        for(Uint8 s: cl_symbols) ++cl_freq[s];
+        std::vector<Uint8> cl_len;
+        buildLengths(cl_freq, 7, cl_len);
+        static const Uint8 order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        int hclen = 19;
+        while(hclen > 4 && cl_len[order[hclen - 1]] == 0) --hclen;
+
+        std::vector<Uint16> lit_codes, dist_codes, cl_codes;
+        buildCodes(lit_len, lit_codes);
+        buildCodes(dist_len, dist_codes);
+        buildCodes(cl_len, cl_codes);
+
+        putBits(final ? 1 : 0, 1);
+        putBits(2, 2);    // dynamic Huffman
+        putBits(hlit - 257, 5);
+        putBits(hdist - 1, 5);
+        putBits(hclen - 4, 4);
+        for(int i = 0; i < hclen; ++i) putBits(cl_len[order[i]], 3);
+        for(size_t i = 0; i < cl_symbols.size(); ++i){
+            Uint8 s = cl_symbols[i];
+            putBits(cl_codes[s], cl_len[s]);
+            if(s == 16) putBits(cl_extra[i], 2);
+            else if(s == 17) putBits(cl_extra[i], 3);
+            else if(s == 18) putBits(cl_extra[i], 7);
+        }
+        for(const Symbol &s: symbols){
+            if(s.dist == 0){
+                putBits(lit_codes[s.litlen], lit_len[s.litlen]);
+                continue;
+            }
+            int lc = lengthCode(s.litlen), dc = distanceCode(s.dist);
+            putBits(lit_codes[257 + lc], lit_len[257 + lc]);
+            putBits(s.litlen - lengthBase(lc), lengthExtra(lc));
+            putBits(dist_codes[dc], dist_len[dc]);
+            putBits(s.dist - distanceBase(dc), distanceExtra(dc));
+        }
+        putBits(lit_codes[256], lit_len[256]);
+        symbols.clear();
+    }
+
+    void insert(int at){
+        int h = hash(buffer.data() + at);
+        prev[at & (WINDOW - 1)] = head[h];
+        head[h] = at;
+    }
+
+    // Turns input up to limit into symbols; stops short of the end unless flushing, so matches can run on
+    void compress(bool flush){
+        int limit = flush ? end : end - MAX_MATCH;
+        while(pos < limit){
+            int best_length = 0, best_distance = 0;
+            if(end - pos >= MIN_MATCH){
+                int max_length = std::min(MAX_MATCH, end - pos);
+                int candidate = head[hash(buffer.data() + pos)];
+                const Uint8* current = buffer.data() + pos;
+                for(int chain = MAX_CHAIN; candidate >= 0 && pos - candidate <= WINDOW && chain > 0; --chain){
+                    const Uint8* match = buffer.data() + candidate;
+                    if(match[best_length] == current[best_length] && match[0] == current[0]){
+                        int length = 0;
+                        while(length < max_length && match[length] == current[length]) ++length;
+                        if(length > best_length){
+                            best_length = length;
+                            best_distance = pos - candidate;
+                            if(length >= GOOD_MATCH || length == max_length) break;
+                        }
+                    }
+                    int next = prev[candidate & (WINDOW - 1)];
+                    if(next >= candidate) break;    // overwritten by a newer position
+                    candidate = next;
+                }
+            }
+            if(best_length >= MIN_MATCH){
+                symbols.push_back({(Uint16)best_length, (Uint16)best_distance});
+                for(int i = 0; i < best_length; ++i, ++pos) if(end - pos >= MIN_MATCH) insert(pos);
+            }
+            else{
+                symbols.push_back({buffer[pos], 0});
+                if(end - pos >= MIN_MATCH) insert(pos);
+                ++pos;
+            }
+            if(symbols.size() >= BLOCK_SYMBOLS) writeBlock(false);
+        }
+    }
+
+    // Drops the oldest WINDOW bytes once the buffer is full
+    void slide(){
+        memmove(buffer.data(), buffer.data() + WINDOW, end - WINDOW);
+        pos -= WINDOW;
+        end -= WINDOW;
+        for(int &v: head) v = v >= WINDOW ? v - WINDOW : -1;
+        for(int &v: prev) v = v >= WINDOW ? v - WINDOW : -1;
+    }
+
+public:
+    DeflateEncoder(): buffer(BUFFER_SIZE), head(1 << HASH_BITS, -1), prev(WINDOW, -1){
+        symbols.reserve(BLOCK_SYMBOLS);
+    }
+
+    void write(const Uint8* data, size_t size){
+        while(size > 0){
+            if(end == BUFFER_SIZE) slide();
+            size_t n = std::min(size, (size_t)(BUFFER_SIZE - end));
+            memcpy(buffer.data() + end, data, n);
+            end += (int)n;
+            data += n;
+            size -= n;
+            compress(false);
+        }
+    }
+
+    // Compresses what is left and ends the stream on a byte boundary
+    void finish(){
+        compress(true);
+        writeBlock(true);
+        if(bitCount > 0) putBits(0, 8 - bitCount);
+    }
+
+    // Compressed bytes produced so far; take them out with clearOutput()
+    const std::vector<Uint8> &output(){return out;}
+    void clearOutput(){out.clear();}
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "canvas.h"
+#include "jobs.h"
+#include "png.h"
+#include "scene.h"
+#include "scheduler.h"
+
+const int EXPORT_TILE_SIZE = 256;    // output pixels per tile side; one band of tiles is in memory at a time
+const double EXPORT_MAX_SCALE = 64.0;
+const int EXPORT_MAX_SIDE = 65535;    // larger than any PNG viewer will open
+
+// Re-rasterizes scene at scale into a PNG at path. Output is produced one band
+// of EXPORT_TILE_SIZE rows at a time: the tiles of a band are rendered on the
+// job system while the task yields (without workers it renders a tile a slice),
+// then its rows are compressed into the file, so memory stays bounded by
+// width*EXPORT_TILE_SIZE pixels whatever the size of the image. The scene must
+// not change until the task is done. Removes the partial file if cancelled.
+inline SlicedTask exportScaled(Scene &scene, JobSystem &jobs, double scale, std::string path, TimeSlice &slice){
+    // one scale for both sides, so a clamped export keeps the aspect ratio
+    double max_scale = std::min((double)EXPORT_MAX_SIDE/std::max(1, scene.getWidth()), (double)EXPORT_MAX_SIDE/std::max(1, scene.getHeight()));
+    if(scale > max_scale){
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Export: x%.2f would exceed %d pixels a side, using x%.2f", scale, EXPORT_MAX_SIDE, max_scale);
+        scale = max_scale;
+    }
+    int out_width = std::min((int)(scene.getWidth()*scale + 0.5), EXPORT_MAX_SIDE);
+    int out_height = std::min((int)(scene.getHeight()*scale + 0.5), EXPORT_MAX_SIDE);
+    PNGWriter writer;
+    if(!writer.open(path.c_str(), out_width, out_height)){
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Export: cannot write %s", path.c_str());
+        co_return;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::vector<std::unique_ptr<SceneRasterizer>> rasterizers(jobs.concurrency());
+    for(auto &rasterizer: rasterizers) rasterizer = std::make_unique<SceneRasterizer>();
+    std::vector<Uint32> band((size_t)out_width*EXPORT_TILE_SIZE);
+    bool ok = true;
+
+    for(int band_y = 0; band_y < out_height && ok; band_y += EXPORT_TILE_SIZE){
+        int band_h = std::min(EXPORT_TILE_SIZE, out_height - band_y);
+        JobCounter tiles;
+        for(int x = 0; x < out_width; x += EXPORT_TILE_SIZE){
+            SDL_Rect area = {x, band_y, std::min(EXPORT_TILE_SIZE, out_width - x), band_h};
+            jobs.run(tiles, [&, area]{
+                Canvas tile(area.w, area.h);
+                scene.renderTile(tile, scale, {area.x, area.y}, *rasterizers[JobSystem::currentSlot()]);
+                for(int y = 0; y < area.h; ++y){
+                    const Uint32* src = tile.getRow(y);
+                    std::copy(src, src + area.w, band.data() + (size_t)(area.y - band_y + y)*out_width + area.x);
+                }
+            }, "export_tile");
+        }
+        double band_progress = (double)band_y/out_height;
+        while(!tiles.isDone() && !slice.cancelled()) co_await (jobs.workerCount() == 0 && jobs.runOne() ? slice.yield(band_progress) : slice.wait(band_progress));
+        jobs.wait(tiles);    // a cancelled band still has tiles writing into band
+        // compressing a row of a wide image takes a while: give the frame back between rows
+        for(int y = 0; y < band_h && ok && !slice.cancelled(); ++y){
+            ok = writer.writeRow(band.data() + (size_t)y*out_width);
+            co_await slice.yield((double)(band_y + y + 1)/out_height);
+        }
+        if(slice.cancelled()){
+            writer.finish();
+            remove(path.c_str());
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Export cancelled");
+            co_return;
+        }
+    }
+
+    if(!writer.finish() || !ok){
+        remove(path.c_str());
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Export: writing %s failed", path.c_str());
+        co_return;
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start)/SDL_GetPerformanceFrequency();
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Exported %dx%d (x%.2f) to %s in %.2f s", out_width, out_height, scale, path.c_str(), seconds);
+}
+
+#endif
@@ -0,0 +1,396 @@
+#ifndef GIF_H
+#define GIF_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include "jobs.h"
+#include "scheduler.h"
+
+const int GIF_HISTOGRAM_BITS = 5;    // per channel: colours are counted in 32x32x32 bins
+const int GIF_MAX_CODES = 4096;
+const int GIF_FRAME_DELAY = 10;    // 1/100 s per frame
+
+enum class GifDither: int{
+    NONE,
+    ORDERED,            // 4x4 Bayer matrix: stable between frames, compresses well
+    FLOYD_STEINBERG     // error diffusion: smoothest gradients
+};
+
+// One encoded animation frame: the rect that changed since the frame before,
+// its own palette and the LZW stream of palette indices
+typedef struct GifFrame{
+    SDL_Rect rect{0, 0, 0, 0};
+    std::vector<Uint8> palette;    // r, g, b per entry, padded to a power of two
+    bool transparent{false};       // nothing changed: a single transparent pixel
+    std::vector<Uint8> lzw;
+} GifFrame;
+
+inline int gifBin(int r, int g, int b){
+    const int shift = 8 - GIF_HISTOGRAM_BITS;
+    return (r >> shift) << (2*GIF_HISTOGRAM_BITS) | (g >> shift) << GIF_HISTOGRAM_BITS | (b >> shift);
+}
+
+// Smallest rect holding every pixel of frame that differs from previous (null: the whole frame)
+inline SDL_Rect gifChangedRect(const Uint32* frame, const Uint32* previous, int width, int height){
+    if(previous == nullptr) return {0, 0, width, height};
+    int x0 = width, y0 = height, x1 = -1, y1 = -1;
+    for(int y = 0; y < height; ++y){
+        const Uint32* a = frame + (size_t)y*width;
+        const Uint32* b = previous + (size_t)y*width;
+        if(memcmp(a, b, (size_t)width*sizeof(Uint32)) == 0) continue;
+        int left = 0, right = width - 1;
+        while(a[left] == b[left]) ++left;
+        while(a[right] == b[right]) --right;
+        x0 = std::min(x0, left);
+        x1 = std::max(x1, right);
+        y0 = std::min(y0, y);
+        y1 = y;
+    }
+    if(x1 < 0) return {0, 0, 0, 0};
+    return {x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+}
+
+// Median cut over the colour histogram of rect: the box with the most pixels
+// times its longest side is split at the median of that side until there
+// are max_colors boxes; each box becomes the mean of the colours in it
+inline std::vector<Uint8> gifMedianCut(const Uint32* frame, int width, SDL_Rect rect, int max_colors){
+    const int bins = 1 << (3*GIF_HISTOGRAM_BITS);
+    std::vector<Uint32> count(bins, 0);
+    std::vector<Uint64> sum((size_t)bins*3, 0);
+    for(int y = rect.y; y < rect.y + rect.h; ++y){
+        const Uint32* row = frame + (size_t)y*width;
+        for(int x = rect.x; x < rect.x + rect.w; ++x){
+            int r = row[x] >> 24, g = (row[x] >> 16) & 0xFF, b = (row[x] >> 8) & 0xFF;
+            int bin = gifBin(r, g, b);
+            ++count[bin];
+            sum[3*bin] += r;
+            sum[3*bin + 1] += g;
+            sum[3*bin + 2] += b;
+        }
+    }
+    std::vector<int> used;
+    for(int bin = 0; bin < bins; ++bin) if(count[bin] > 0) used.push_back(bin);
+
+    struct Box{int lo, hi; Uint64 pixels; int axis, range;};
+    auto channel = [](int bin, int axis){return (bin >> (GIF_HISTOGRAM_BITS*(2 - axis))) & ((1 << GIF_HISTOGRAM_BITS) - 1);};
+    auto measure = [&](Box &box){
+        int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+        box.pixels = 0;
+        for(int i = box.lo; i < box.hi; ++i){
+            for(int axis = 0; axis < 3; ++axis){
+                lo[axis] = std::min(lo[axis], channel(used[i], axis));
+                hi[axis] = std::max(hi[axis], channel(used[i], axis));
+            }
+            box.pixels += count[used[i]];
+        }
+        box.axis = 0;
+        for(int axis = 1; axis < 3; ++axis) if(hi[axis] - lo[axis] > hi[box.axis] - lo[box.axis]) box.axis = axis;
+        box.range = hi[box.axis] - lo[box.axis];
+    };
+    std::vector<Box> boxes;
+    if(!used.empty()){
+        boxes.push_back({0, (int)used.size(), 0, 0, 0});
+        measure(boxes[0]);
+    }
+    while((int)boxes.size() < max_colors){
+        int best = -1;
+        Uint64 best_score = 0;
+        for(size_t i = 0; i < boxes.size(); ++i){
+            Uint64 score = boxes[i].pixels*(Uint64)boxes[i].range;
+            if(boxes[i].hi - boxes[i].lo > 1 && boxes[i].range > 0 && score >= best_score){
+                best = (int)i;
+                best_score = score;
+            }
+        }
+        if(best < 0) break;
+        Box &box = boxes[best];
+        int axis = box.axis;
+        std::sort(used.begin() + box.lo, used.begin() + box.hi, [&](int a, int b){return channel(a, axis) < channel(b, axis);});
+        Uint64 half = box.pixels/2, seen = 0;
+        int split = box.lo;
+        while(split < box.hi - 1 && seen + count[used[split]] <= half) seen += count[used[split++]];
+        if(split == box.lo) ++split;
+        Box upper = {split, box.hi, 0, 0, 0};
+        box.hi = split;
+        measure(box);
+        measure(upper);
+        boxes.push_back(upper);
+    }
+
+    std::vector<Uint8> palette;
+    for(const Box &box: boxes){
+        Uint64 rgb[3] = {0, 0, 0}, n = 0;
+        for(int i = box.lo; i < box.hi; ++i){
+            for(int c = 0; c < 3; ++c) rgb[c] += sum[3*used[i] + c];
+            n += count[used[i]];
+        }
+        for(int c = 0; c < 3; ++c) palette.push_back((Uint8)((rgb[c] + n/2)/n));
+    }
+    if(palette.empty()) palette.assign(3, 0);
+    return palette;
+}
+
+// Nearest palette entry per histogram bin, looked up lazily
+class GifColorMap{
+private:
+    const std::vector<Uint8> &palette;
+    std::vector<Sint16> cache;
+
+public:
+    GifColorMap(const std::vector<Uint8> &palette): palette(palette), cache(1 << (3*GIF_HISTOGRAM_BITS), -1){}
+
+    int lookup(int r, int g, int b){
+        Sint16 &index = cache[gifBin(r, g, b)];
+        if(index >= 0) return index;
+        int best = 0, best_distance = 1 << 30;
+        for(size_t i = 0; i < palette.size()/3; ++i){
+            int dr = palette[3*i] - r, dg = palette[3*i + 1] - g, db = palette[3*i + 2] - b;
+            int distance = 2*dr*dr + 4*dg*dg + 3*db*db;
+            if(distance < best_distance){
+                best_distance = distance;
+                best = (int)i;
+            }
+        }
+        return index = (Sint16)best;
+    }
+};
+
+// Palette indices of rect, dithered as asked
+inline std::vector<Uint8> gifMapPixels(const Uint32* frame, int width, SDL_Rect rect, const std::vector<Uint8> &palette, GifDither dither){
+    static const int bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+    GifColorMap map(palette);
+    std::vector<Uint8> indices((size_t)rect.w*rect.h);
+    std::vector<int> error_now, error_next;    // r, g, b per pixel with a pixel of margin on both sides
+    if(dither == GifDither::FLOYD_STEINBERG){
+        error_now.assign((size_t)(rect.w + 2)*3, 0);
+        error_next.assign((size_t)(rect.w + 2)*3, 0);
+    }
+    for(int y = 0; y < rect.h; ++y){
+        const Uint32* row = frame + (size_t)(rect.y + y)*width + rect.x;
+        Uint8* out = indices.data() + (size_t)y*rect.w;
+        for(int x = 0; x < rect.w; ++x){
+            int c[3] = {(int)(row[x] >> 24), (int)((row[x] >> 16) & 0xFF), (int)((row[x] >> 8) & 0xFF)};
+            if(dither == GifDither::ORDERED){
+                int offset = (bayer[y & 3][x & 3] - 8)*2;    // about a histogram bin either way
+                for(int &v: c) v = std::clamp(v + offset, 0, 255);
+            }
+            else if(dither == GifDither::FLOYD_STEINBERG){
+                for(int k = 0; k < 3; ++k) c[k] = std::clamp(c[k] + error_now[(size_t)(x + 1)*3 + k]/16, 0, 255);
+            }
+            int index = map.lookup(c[0], c[1], c[2]);
+            out[x] = (Uint8)index;
+            if(dither == GifDither::FLOYD_STEINBERG){
+                for(int k = 0; k < 3; ++k){
+                    int e = c[k] - palette[3*index + k];
+                    error_now[(size_t)(x + 2)*3 + k] += e*7;
+                    error_next[(size_t)x*3 + k] += e*3;
+                    error_next[(size_t)(x + 1)*3 + k] += e*5;
+                    error_next[(size_t)(x + 2)*3 + k] += e;
+                }
+            }
+        }
+        if(dither == GifDither::FLOYD_STEINBERG){
+            error_now.swap(error_next);
+            std::fill(error_next.begin(), error_next.end(), 0);
+        }
+    }
+    return indices;
+}
+
+// GIF flavoured LZW (variable code size from 9 to 12 bits, 8 bit symbols)
+inline std::vector<Uint8> gifLZW(const std::vector<Uint8> &indices){
+    const int clear_code = 256, end_code = 257;
+    const int table_size = 8192;    // open addressing, never more than half full
+    std::vector<Uint32> keys(table_size);
+    std::vector<Sint16> codes(table_size);
+    std::vector<Uint8> out;
+    Uint32 bits = 0;
+    int bit_count = 0, code_size = 9, next_code = 258;
+    auto emit = [&](int code){
+        bits |= (Uint32)code << bit_count;
+        bit_count += code_size;
+        while(bit_count >= 8){
+            out.push_back((Uint8)bits);
+            bits >>= 8;
+            bit_count -= 8;
+        }
+    };
+    auto reset = [&]{
+        std::fill(codes.begin(), codes.end(), (Sint16)-1);
+        code_size = 9;
+        next_code = 258;
+    };
+    reset();
+    emit(clear_code);
+    if(indices.empty()){
+        emit(end_code);
+        if(bit_count > 0) out.push_back((Uint8)bits);
+        return out;
+    }
+    int current = indices[0];
+    for(size_t i = 1; i < indices.size(); ++i){
+        int symbol = indices[i];
+        Uint32 key = (Uint32)current << 8 | symbol;
+        int slot = (int)((key*2654435761u) >> 19);
+        while(codes[slot] >= 0 && keys[slot] != key) slot = (slot + 1) & (table_size - 1);
+        if(codes[slot] >= 0){
+            current = codes[slot];
+            continue;
+        }
+        emit(current);
+        if(next_code < GIF_MAX_CODES){
+            keys[slot] = key;
+            codes[slot] = (Sint16)next_code++;
+            // the decoder adds its entry one code later, so it widens one code later too
+            if(next_code > (1 << code_size) && code_size < 12) ++code_size;
+        }
+        else{
+            emit(clear_code);
+            reset();
+        }
+        current = symbol;
+    }
+    emit(current);
+    emit(end_code);
+    if(bit_count > 0) out.push_back((Uint8)bits);
+    return out;
+}
+
+// Everything about frame that can be done apart from the other frames
+inline void encodeGifFrame(const Uint32* frame, const Uint32* previous, int width, int height, GifDither dither, GifFrame &out){
+    out.rect = gifChangedRect(frame, previous, width, height);
+    out.transparent = out.rect.w == 0;
+    std::vector<Uint8> indices;
+    if(out.transparent){
+        out.rect = {0, 0, 1, 1};
+        out.palette.assign(6, 0);
+        indices.assign(1, 0);
+    }
+    else{
+        out.palette = gifMedianCut(frame, width, out.rect, 256);
+        indices = gifMapPixels(frame, width, out.rect, out.palette, dither);
+        size_t size = 6;
+        while(size < out.palette.size()) size *= 2;
+        out.palette.resize(size, 0);
+    }
+    out.lzw = gifLZW(indices);
+}
+
+// Writes the frames in order; disposal "leave in place" makes each one an
+// update of the rect that changed
+class GIFWriter{
+private:
+    FILE* file{nullptr};
+    bool failed{false};
+
+    void put(const void* data, size_t size){if(!failed && fwrite(data, 1, size, file) != size) failed = true;}
+    void put8(int v){Uint8 b = (Uint8)v; put(&b, 1);}
+    void put16(int v){put8(v & 0xFF); put8(v >> 8);}
+
+public:
+    GIFWriter() = default;
+    ~GIFWriter(){if(file != nullptr) fclose(file);}
+    GIFWriter(const GIFWriter&) = delete;
+    GIFWriter& operator=(const GIFWriter&) = delete;
+
+    bool open(const char* path, int width, int height){
+        file = fopen(path, "wb");
+        if(file == nullptr) return false;
+        put("GIF89a", 6);
+        put16(width);
+        put16(height);
+        put8(0);    // no global colour table
+        put8(0);
+        put8(0);
+        static const Uint8 loop[19] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00};    // loop forever
+        put(loop, sizeof(loop));
+        return !failed;
+    }
+
+    // delay in 1/100 s
+    bool writeFrame(const GifFrame &frame, int delay){
+        int table_bits = 0;
+        while((3 << (table_bits + 1)) < (int)frame.palette.size()) ++table_bits;
+        Uint8 control[8] = {0x21, 0xF9, 0x04, (Uint8)(1 << 2 | (frame.transparent ? 1 : 0)), (Uint8)(delay & 0xFF), (Uint8)(delay >> 8), 0, 0};
+        put(control, sizeof(control));
+        put8(0x2C);
+        put16(frame.rect.x);
+        put16(frame.rect.y);
+        put16(frame.rect.w);
+        put16(frame.rect.h);
+        put8(0x80 | table_bits);    // local colour table of 2^(table_bits+1) entries
+        put(frame.palette.data(), frame.palette.size());
+        put8(8);    // LZW minimum code size
+        for(size_t i = 0; i < frame.lzw.size(); i += 255){
+            size_t n = std::min<size_t>(255, frame.lzw.size() - i);
+            put8((int)n);
+            put(frame.lzw.data() + i, n);
+        }
+        put8(0);
+        return !failed;
+    }
+
+    bool finish(){
+        if(file == nullptr) return false;
+        put8(0x3B);
+        if(fclose(file) != 0) failed = true;
+        file = nullptr;
+        return !failed;
+    }
+};
+
+// Encodes count frames of width x height as an animated GIF at path. Frames
+// are quantized, dithered and compressed on the job system a batch at a time
+// while the task yields, then written in order, so memory holds one batch of
+// encoded frames. frame(k) must
+// stay valid until the task is done. Removes the partial file if cancelled.
+inline SlicedTask exportGIF(std::function<const Uint32*(int)> frame, int count, int width, int height, GifDither dither, int delay, JobSystem &jobs, std::string path, TimeSlice &slice){
+    GIFWriter writer;
+    if(count <= 0 || !writer.open(path.c_str(), width, height)){
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "GIF export: cannot write %s", path.c_str());
+        co_return;
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+    int batch = std::max(1, 2*jobs.concurrency());
+    std::vector<GifFrame> frames(batch);
+    bool ok = true;
+    size_t bytes = 0;
+    for(int first = 0; first < count && ok; first += batch){
+        int n = std::min(batch, count - first);
+        JobCounter encoded;
+        for(int i = 0; i < n; ++i){
+            jobs.run(encoded, [&, i]{
+                int k = first + i;
+                encodeGifFrame(frame(k), k > 0 ? frame(k - 1) : nullptr, width, height, dither, frames[i]);
+            }, "gif_frame");
+        }
+        double batch_progress = (double)first/count;
+        while(!encoded.isDone() && !slice.cancelled()) co_await (jobs.workerCount() == 0 && jobs.runOne() ? slice.yield(batch_progress) : slice.wait(batch_progress));
+        jobs.wait(encoded);    // a cancelled batch still has frames encoding into frames
+        for(int i = 0; i < n && ok && !slice.cancelled(); ++i){
+            ok = writer.writeFrame(frames[i], first + i == count - 1 ? 4*delay : delay);    // hold the finished picture
+            bytes += frames[i].lzw.size();
+        }
+        co_await slice.yield((double)(first + n)/count);
+        if(slice.cancelled()){
+            writer.finish();
+            remove(path.c_str());
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "GIF export cancelled");
+            co_return;
+        }
+    }
+    if(!writer.finish() || !ok){
+        remove(path.c_str());
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "GIF export: writing %s failed", path.c_str());
+        co_return;
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start)/SDL_GetPerformanceFrequency();
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Exported %d frames to %s (%zu KB of image data) in %.2f s", count, path.c_str(), bytes/1024, seconds);
+}
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef IMAGELOAD_H
+#define IMAGELOAD_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "canvas.h"
+#include "jobs.h"
+#include "qoi.h"
+#include "scheduler.h"
+
+const int IMAGE_REFINE_BAND = 32;    // canvas rows resampled per step of the full quality pass
+
+// Result of a decode running on its own thread. Shared between that thread and
+// the task waiting for it, so whichever lets go last frees the surface, also
+// when the open is cancelled halfway.
+typedef struct ImageDecode{
+    std::atomic<bool> done{false};
+    SDL_Surface* surface{nullptr};    // SDL_PIXELFORMAT_RGBA8888, null if decoding failed
+    std::string error;
+    ~ImageDecode(){if(surface != nullptr) SDL_FreeSurface(surface);}
+} ImageDecode;
+
+// Owns the decode threads. A cancelled open stops waiting at once, but
+// IMG_Load cannot be interrupted, so its thread keeps running until the image
+// is decoded; stop() waits for those before SDL shuts down.
+class ImageDecoder{
+private:
+    struct Running{
+        std::thread thread;
+        std::shared_ptr<ImageDecode> decode;
+    };
+    std::vector<Running> running;
+
+public:
+    ImageDecoder() = default;
+    ~ImageDecoder(){stop();}
+    ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder& operator=(const ImageDecoder&) = delete;
+
+    // Decodes path on a thread of its own; threads of earlier decodes that are done are joined here
+    std::shared_ptr<ImageDecode> start(const std::string &path){
+        for(size_t i = 0; i < running.size();){
+            if(!running[i].decode->done.load(std::memory_order_acquire)){
+                ++i;
+                continue;
+            }
+            running[i].thread.join();
+            running.erase(running.begin() + i);
+        }
+        auto decode = std::make_shared<ImageDecode>();
+        std::thread thread([decode, path]{
+            if(path.size() >= 5 && path.substr(path.size()-4, 4) == ".qoi"){    // SDL_image has no QOI before 2.6
+                decode->surface = loadQOI(path.c_str());
+                if(decode->surface == nullptr) decode->error = SDL_GetError();
+                decode->done.store(true, std::memory_order_release);
+                return;
+            }
+            SDL_Surface* loaded = IMG_Load(path.c_str());
+            if(loaded != nullptr){
+                decode->surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA8888, 0);
+                SDL_FreeSurface(loaded);
+            }
+            if(decode->surface == nullptr) decode->error = IMG_GetError();
+            decode->done.store(true, std::memory_order_release);
+        });
+        running.push_back({std::move(thread), decode});
+        return decode;
+    }
+
+    // Waits for every decode still running
+    void stop(){
+        for(auto &entry: running) entry.thread.join();
+        running.clear();
+    }
+};
+
+// Where an image of the given size lands on the canvas: centred, shrunk to fit
+// (never enlarged); scale is canvas pixels per image pixel
+typedef struct ImagePlacement{
+    SDL_Rect rect;
+    double scale;
+} ImagePlacement;
+
+inline ImagePlacement placeImage(int image_w, int image_h, int canvas_w, int canvas_h){
+    double scale = std::min(1.0, std::min((double)canvas_w/image_w, (double)canvas_h/image_h));
+    int w = std::max(1, (int)(image_w*scale)), h = std::max(1, (int)(image_h*scale));
+    return {{(canvas_w - w)/2, (canvas_h - h)/2, w, h}, scale};
+}
+
+// Rows [y0, y1) of the placed rect; preview takes the nearest image pixel,
+// otherwise every image pixel under a canvas pixel is averaged
+inline void resampleImageRows(SDL_Surface* image, Canvas &canvas, const ImagePlacement &placement, int y0, int y1, bool preview){
+    const Uint8* base = static_cast<const Uint8*>(image->pixels);
+    double step = 1.0/placement.scale;
+    for(int y = y0; y < y1; ++y){
+        Uint32* out = canvas.getRow(placement.rect.y + y) + placement.rect.x;
+        int sy0 = std::min(image->h - 1, (int)(y*step)), sy1 = std::clamp((int)((y + 1)*step), sy0 + 1, image->h);
+        if(preview) sy0 = sy1 = std::min(image->h - 1, (int)((y + 0.5)*step));
+        for(int x = 0; x < placement.rect.w; ++x){
+            int sx0 = std::min(image->w - 1, (int)(x*step)), sx1 = std::clamp((int)((x + 1)*step), sx0 + 1, image->w);
+            if(preview){
+                int sx = std::min(image->w - 1, (int)((x + 0.5)*step));
+                out[x] = reinterpret_cast<const Uint32*>(base + (size_t)sy0*image->pitch)[sx];
+                continue;
+            }
+            Uint64 sum[4] = {0, 0, 0, 0};
+            for(int sy = sy0; sy < sy1; ++sy){
+                const Uint32* row = reinterpret_cast<const Uint32*>(base + (size_t)sy*image->pitch);
+                for(int sx = sx0; sx < sx1; ++sx){
+                    Uint32 p = row[sx];
+                    sum[0] += p >> 24;
+                    sum[1] += (p >> 16) & 0xFF;
+                    sum[2] += (p >> 8) & 0xFF;
+                    sum[3] += p & 0xFF;
+                }
+            }
+            Uint64 n = (Uint64)(sy1 - sy0)*(sx1 - sx0);
+            out[x] = (Uint32)((sum[0] + n/2)/n << 24 | (sum[1] + n/2)/n << 16 | (sum[2] + n/2)/n << 8 | (sum[3] + n/2)/n);
+        }
+    }
+}
+
+// Decodes path on a background thread while the UI keeps running, then shows
+// a nearest neighbour preview at once and replaces it band by band with the
+// averaged full quality version. Sets loaded once the canvas holds the image;
+// leaves the canvas untouched if decoding fails or is cancelled before it ends.
+inline SlicedTask openImage(Canvas &canvas, JobSystem &jobs, ImageDecoder &decoder, std::string path, std::shared_ptr<bool> loaded, TimeSlice &slice){
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::shared_ptr<ImageDecode> decode = decoder.start(path);
+    while(!decode->done.load(std::memory_order_acquire)){
+        co_await slice.wait(0.0);
+        if(slice.cancelled()) co_return;
+    }
+    SDL_Surface* image = decode->surface;
+    if(image == nullptr){
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Cannot open %s: %s", path.c_str(), decode->error.c_str());
+        co_return;
+    }
+    double decode_ms = (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency();
+
+    ImagePlacement placement = placeImage(image->w, image->h, canvas.getWidth(), canvas.getHeight());
+    canvas.clear({255, 255, 255, 255});
+    jobs.parallelFor(0, placement.rect.h, 16, [&](int lo, int hi){resampleImageRows(image, canvas, placement, lo, hi, true);}, "image_preview");
+    canvas.markAllDirty();
+    *loaded = true;
+    double preview_ms = (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency();
+
+    if(placement.scale < 1.0){
+        for(int y = 0; y < placement.rect.h; y += IMAGE_REFINE_BAND){
+            int band_end = std::min(placement.rect.h, y + IMAGE_REFINE_BAND);
+            jobs.parallelFor(y, band_end, 1, [&](int lo, int hi){resampleImageRows(image, canvas, placement, lo, hi, false);}, "image_refine");
+            canvas.markDirty({placement.rect.x, placement.rect.y + y, placement.rect.w, band_end - y});
+            co_await slice.yield((double)band_end/placement.rect.h);
+            if(slice.cancelled()) break;    // keep the preview for the rest
+        }
+    }
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Opened %s (%dx%d): decoded in %.0f ms, preview after %.0f ms, done after %.0f ms", path.c_str(), image->w, image->h, decode_ms, preview_ms, (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency());
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <SDL2/SDL.h>
+#include "vec2.h"
+
+// One pointer position as reported by SDL, with the event timestamp in ms
+typedef struct PointerSample{
+    vec2 pos;
+    Uint32 timestamp{0};
+} PointerSample;
+
+inline PointerSample motionSample(const SDL_Event &event){
+    PointerSample sample;
+    sample.pos = vec2(event.motion.x, event.motion.y);
+    sample.timestamp = event.motion.timestamp;
+    return sample;
+}
+
+// Keeps only the newest pointer position of a frame for tools that redraw a
+// preview on every move (Rect, Ellipse, Line). A high polling rate mouse then
+// costs one overlay redraw per frame instead of one per event.
+class MotionCoalescer{
+private:
+    PointerSample latest;
+    bool pending{false};
+    Uint64 received{0};
+    Uint64 applied{0};
+
+public:
+    void push(const PointerSample &sample){
+        latest = sample;
+        pending = true;
+        ++received;
+    }
+
+    // Hands out the pending position once; false if nothing moved since the last take
+    bool take(PointerSample &sample){
+        if(!pending) return false;
+        sample = latest;
+        pending = false;
+        ++applied;
+        return true;
+    }
+
+    bool hasPending(){return pending;}
+    Uint64 getReceived(){return received;}
+    Uint64 getApplied(){return applied;}
+};
+
+#endif
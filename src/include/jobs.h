@@ -0,0 +1,257 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class JobCounter;
+
+typedef struct JobTask{
+    std::function<void()> fn;
+    JobCounter* counter{nullptr};
+    const char* name{"task"};
+} JobTask;
+
+typedef struct JobTaskStats{
+    Uint64 count{0};
+    Uint64 total_ns{0};
+    Uint64 max_ns{0};
+} JobTaskStats;
+
+// Tracks the number of unfinished tasks of a group. Tasks submitted with a
+// counter as dependency are held back until that counter drops to zero.
+class JobCounter{
+private:
+    friend class JobSystem;
+    std::atomic<int> pending{0};
+    std::mutex continuationsMutex;
+    std::vector<JobTask> continuations;
+
+public:
+    bool isDone(){return pending.load(std::memory_order_acquire) == 0;}
+};
+
+// Work-stealing pool: every worker (and the thread that owns the pool, slot 0)
+// has its own deque. Owners pop newest-first, thieves take oldest-first.
+// With zero workers everything runs on the calling thread inside wait().
+class JobSystem{
+private:
+    struct WorkQueue{
+        std::mutex mutex;
+        std::deque<JobTask> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<WorkQueue*> queues;
+    std::atomic<int> queuedCount{0};
+    std::atomic<bool> running{true};
+    std::mutex sleepMutex;
+    std::condition_variable sleepCond;
+
+    std::atomic<bool> timingEnabled{false};
+    std::mutex statsMutex;
+    std::map<std::string, JobTaskStats> taskStats;
+    std::function<void(const char*, Uint64, int)> taskTimer;
+
+    static int &threadSlot(){
+        static thread_local int slot = 0;
+        return slot;
+    }
+
+    // The calling thread's queue; threads this pool did not start (or that
+    // belong to another JobSystem with more workers) share queue 0
+    int queueSlot(){
+        int slot = threadSlot();
+        return slot < (int)queues.size() ? slot : 0;
+    }
+
+    void push(JobTask &&task){
+        int slot = queueSlot();
+        {
+            std::lock_guard<std::mutex> lock(queues[slot]->mutex);
+            queues[slot]->tasks.push_back(std::move(task));
+        }
+        queuedCount.fetch_add(1, std::memory_order_release);
+        sleepCond.notify_one();
+    }
+
+    bool pop(JobTask &task){
+        int slot = queueSlot();
+        {
+            std::lock_guard<std::mutex> lock(queues[slot]->mutex);
+            if(!queues[slot]->tasks.empty()){
+                task = std::move(queues[slot]->tasks.back());
+                queues[slot]->tasks.pop_back();
+                queuedCount.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        for(size_t i = 1; i < queues.size(); ++i){
+            WorkQueue* victim = queues[(slot + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim->mutex);
+            if(!victim->tasks.empty()){
+                task = std::move(victim->tasks.front());
+                victim->tasks.pop_front();
+                queuedCount.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(JobTask &task){
+        if(timingEnabled.load(std::memory_order_relaxed)){
+            auto begin = std::chrono::steady_clock::now();
+            task.fn();
+            Uint64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+            std::lock_guard<std::mutex> lock(statsMutex);
+            JobTaskStats &stats = taskStats[task.name];
+            ++stats.count;
+            stats.total_ns += ns;
+            if(ns > stats.max_ns) stats.max_ns = ns;
+            if(taskTimer) taskTimer(task.name, ns, threadSlot());
+        }
+        else task.fn();
+        if(task.counter != nullptr) finish(*task.counter);
+    }
+
+    void finish(JobCounter &counter){
+        if(counter.pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        std::vector<JobTask> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter.continuationsMutex);
+            ready.swap(counter.continuations);
+        }
+        for(auto &task: ready) push(std::move(task));
+    }
+
+    void workerLoop(int slot){
+        threadSlot() = slot;
+        JobTask task;
+        while(running.load(std::memory_order_acquire)){
+            if(pop(task)){
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCond.wait_for(lock, std::chrono::milliseconds(2), [this]{
+                return queuedCount.load(std::memory_order_acquire) > 0 || !running.load(std::memory_order_acquire);
+            });
+        }
+    }
+
+public:
+    // num_workers < 0 picks one worker per core besides the calling thread
+    explicit JobSystem(int num_workers = -1){
+        if(num_workers < 0) num_workers = std::max(0, SDL_GetCPUCount() - 1);
+        queues.resize(num_workers + 1);
+        for(auto &queue: queues) queue = new WorkQueue();
+        for(int i = 1; i <= num_workers; ++i) workers.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+
+    ~JobSystem(){
+        running.store(false, std::memory_order_release);
+        sleepCond.notify_all();
+        for(auto &worker: workers) worker.join();
+        for(auto &queue: queues) delete queue;
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    int workerCount(){return (int)workers.size();}
+    // Slot of the calling thread: 0 for the owner, 1..workerCount() for workers
+    static int currentSlot(){return threadSlot();}
+    int concurrency(){return (int)workers.size() + 1;}
+
+    // Queue fn as part of group. If depends_on is given the task only becomes
+    // runnable once every task of that counter has finished.
+    void run(JobCounter &group, std::function<void()> fn, const char* name = "task", JobCounter* depends_on = nullptr){
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        JobTask task{std::move(fn), &group, name};
+        if(depends_on != nullptr){
+            std::lock_guard<std::mutex> lock(depends_on->continuationsMutex);
+            if(!depends_on->isDone()){
+                depends_on->continuations.push_back(std::move(task));
+                return;
+            }
+        }
+        push(std::move(task));
+    }
+
+    // Blocks until the group is finished, running queued tasks meanwhile.
+    void wait(JobCounter &group){
+        JobTask task;
+        while(!group.isDone()){
+            if(pop(task)) execute(task);
+            else std::this_thread::yield();
+        }
+    }
+
+    // Runs one queued task on the calling thread; false if none was queued. For
+    // a sliced operation that helps with its own tasks instead of blocking in wait().
+    bool runOne(){
+        JobTask task;
+        if(!pop(task)) return false;
+        execute(task);
+        return true;
+    }
+
+    // Splits [begin, end) into chunks of at least grain items and calls fn(lo, hi) for each.
+    void parallelFor(int begin, int end, int grain, const std::function<void(int, int)> &fn, const char* name = "parallel_for"){
+        if(end <= begin) return;
+        grain = std::max(1, grain);
+        int chunks = std::min((end - begin + grain - 1)/grain, 4*concurrency());
+        if(chunks <= 1 || workers.empty()){
+            fn(begin, end);
+            return;
+        }
+        JobCounter group;
+        int chunk_len = (end - begin + chunks - 1)/chunks;
+        for(int lo = begin; lo < end; lo += chunk_len){
+            int hi = std::min(end, lo + chunk_len);
+            run(group, [&fn, lo, hi]{fn(lo, hi);}, name);
+        }
+        wait(group);
+    }
+
+    // Calls fn once per tile_size x tile_size tile covering area.
+    void parallelForTiles(SDL_Rect area, int tile_size, const std::function<void(SDL_Rect)> &fn, const char* name = "parallel_for_tiles"){
+        if(area.w <= 0 || area.h <= 0) return;
+        int tiles_x = (area.w + tile_size - 1)/tile_size;
+        int tiles_y = (area.h + tile_size - 1)/tile_size;
+        parallelFor(0, tiles_x*tiles_y, 1, [&](int lo, int hi){
+            for(int i = lo; i < hi; ++i){
+                SDL_Rect tile;
+                tile.x = area.x + (i % tiles_x)*tile_size;
+                tile.y = area.y + (i / tiles_x)*tile_size;
+                tile.w = std::min(tile_size, area.x + area.w - tile.x);
+                tile.h = std::min(tile_size, area.y + area.h - tile.y);
+                fn(tile);
+            }
+        }, name);
+    }
+
+    // Per-task timing: aggregated by task name, optionally forwarded to a callback
+    // receiving (name, nanoseconds, worker slot).
+    void enableTiming(bool enable){timingEnabled.store(enable, std::memory_order_relaxed);}
+    void setTaskTimer(std::function<void(const char*, Uint64, int)> timer){
+        std::lock_guard<std::mutex> lock(statsMutex);
+        taskTimer = std::move(timer);
+    }
+    std::map<std::string, JobTaskStats> getTaskStats(){
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return taskStats;
+    }
+};
+
+#endif
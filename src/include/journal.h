@@ -0,0 +1,371 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "autosave.h"
+#include "png.h"
+#include "scene.h"
+
+// Records also come from peers and render service clients, so what they ask for is bounded
+const double JOURNAL_MAX_WIDTH = 64.0;              // brush size and line width, the editor's own limit
+const double JOURNAL_MAX_COORDINATE = 65536.0;      // shape positions and sizes, either way from the origin
+const Uint32 JOURNAL_MAX_POINTS = 1 << 20;          // brush or eraser positions in one record
+const double JOURNAL_MAX_PIXELS = 1024.0*1024*1024;    // pixels one scribble or erase may blend, counted before drawing
+
+enum class JournalOp: Uint8{
+    OBJECT = 1,     // rect, ellipse or line: a scene object
+    SCRIBBLE,       // brush settings, colour and every brush position
+    ERASE,          // eraser positions
+    FILL,           // bucket fill seed and colour
+    UNDO,
+    REDO,
+    VECTOR_MODE,    // new state of the vector mode toggle
+    STATE           // the whole canvas, tile encoded, for edits that can't be replayed from their inputs
+};
+
+// Little endian byte builder for record payloads
+class JournalEncoder{
+public:
+    std::vector<Uint8> bytes;
+
+    void put8(Uint8 v){bytes.push_back(v);}
+    void put32(Uint32 v){for(int s = 0; s < 32; s += 8) bytes.push_back((Uint8)(v >> s));}
+    void put64(Uint64 v){put32((Uint32)v); put32((Uint32)(v >> 32));}
+    void putDouble(double v){Uint64 bits; memcpy(&bits, &v, 8); put64(bits);}    // exact, replay must hit the same pixels
+    void putVec2(vec2 v){putDouble(v.x); putDouble(v.y);}
+    void putColor(SDL_Color c){put8(c.r); put8(c.g); put8(c.b); put8(c.a);}
+    void putBytes(const Uint8* data, size_t size){bytes.insert(bytes.end(), data, data + size);}
+};
+
+// Reads a payload back; every getter returns 0 once the data runs out and ok() turns false
+class JournalDecoder{
+private:
+    const Uint8* data;
+    size_t size;
+    size_t pos{0};
+    bool valid{true};
+
+    bool need(size_t n){
+        if(!valid || size - pos < n){valid = false; return false;}
+        return true;
+    }
+
+public:
+    JournalDecoder(const Uint8* data, size_t size): data(data), size(size){}
+
+    bool ok(){return valid;}
+    void fail(){valid = false;}    // a value that decoded but can't be used
+    bool atEnd(){return pos == size;}
+    Uint8 get8(){return need(1) ? data[pos++] : 0;}
+    Uint32 get32(){
+        if(!need(4)) return 0;
+        Uint32 v = (Uint32)data[pos] | ((Uint32)data[pos + 1] << 8) | ((Uint32)data[pos + 2] << 16) | ((Uint32)data[pos + 3] << 24);
+        pos += 4;
+        return v;
+    }
+    Uint64 get64(){Uint64 lo = get32(); return lo | ((Uint64)get32() << 32);}
+    double getDouble(){Uint64 bits = get64(); double v; memcpy(&v, &bits, 8); return v;}
+    vec2 getVec2(){double x = getDouble(); return vec2(x, getDouble());}
+    SDL_Color getColor(){SDL_Color c; c.r = get8(); c.g = get8(); c.b = get8(); c.a = get8(); return c;}
+    const Uint8* getBytes(size_t n){
+        if(!need(n)) return nullptr;
+        pos += n;
+        return data + pos - n;
+    }
+};
+
+// Rects, ellipses and lines; strokes have their own record
+inline void encodeSceneObject(JournalEncoder &out, const SceneObject &object){
+    out.put8((Uint8)object.type);
+    out.putVec2(object.pos);
+    out.putVec2(object.size);
+    out.putVec2(object.a);
+    out.putVec2(object.b);
+    out.putDouble(object.style.width);
+    out.put8((Uint8)object.style.cap);
+    out.put8((Uint8)object.style.join);
+    out.putDouble(object.style.miter_limit);
+    out.putColor(object.fill_color);
+    out.putColor(object.outline_color);
+    out.put8((Uint8)((object.filled ? 1 : 0) | (object.outlined ? 2 : 0)));
+}
+
+inline SceneObject decodeSceneObject(JournalDecoder &in){
+    SceneObject object;
+    object.type = (SceneObjectType)in.get8();
+    object.pos = in.getVec2();
+    object.size = in.getVec2();
+    object.a = in.getVec2();
+    object.b = in.getVec2();
+    object.style.width = in.getDouble();
+    object.style.cap = (LineCap)std::min<Uint8>(in.get8(), (Uint8)LineCap::NUM_CAPS - 1);
+    object.style.join = (LineJoin)std::min<Uint8>(in.get8(), (Uint8)LineJoin::NUM_JOINS - 1);
+    object.style.miter_limit = in.getDouble();
+    object.fill_color = in.getColor();
+    object.outline_color = in.getColor();
+    Uint8 flags = in.get8();
+    object.filled = flags & 1;
+    object.outlined = flags & 2;
+    if(object.type > SceneObjectType::LINE) object.type = SceneObjectType::RECT;
+    for(double* v: {&object.pos.x, &object.pos.y, &object.size.x, &object.size.y, &object.a.x, &object.a.y, &object.b.x, &object.b.y}){
+        if(!std::isfinite(*v)) in.fail();
+        *v = std::clamp(*v, -JOURNAL_MAX_COORDINATE, JOURNAL_MAX_COORDINATE);
+    }
+    if(!std::isfinite(object.style.width) || !std::isfinite(object.style.miter_limit)) in.fail();
+    object.style.width = std::clamp(object.style.width, 0.0, JOURNAL_MAX_WIDTH);
+    return object;
+}
+
+inline void encodeBrushSettings(JournalEncoder &out, const BrushSettings &brush){
+    out.putDouble(brush.size);
+    out.putDouble(brush.hardness);
+    out.putDouble(brush.opacity);
+    out.putDouble(brush.flow);
+    out.putDouble(brush.spacing);
+}
+
+inline BrushSettings decodeBrushSettings(JournalDecoder &in){
+    BrushSettings brush;
+    brush.size = in.getDouble();
+    brush.hardness = in.getDouble();
+    brush.opacity = in.getDouble();
+    brush.flow = in.getDouble();
+    brush.spacing = in.getDouble();
+    if(!std::isfinite(brush.size) || !std::isfinite(brush.hardness) || !std::isfinite(brush.opacity) || !std::isfinite(brush.flow) || !std::isfinite(brush.spacing)) in.fail();
+    brush.size = std::clamp(brush.size, 0.0, JOURNAL_MAX_WIDTH);
+    brush.hardness = std::clamp(brush.hardness, 0.0, 1.0);
+    brush.opacity = std::clamp(brush.opacity, 0.0, 1.0);
+    brush.flow = std::clamp(brush.flow, 0.0, 1.0);
+    return brush;
+}
+
+// A width x height image as codec, size and payload per PAINT_TILE_SIZE tile
+inline void encodeJournalImage(JournalEncoder &out, const Uint32* pixels, int width, int height){
+    out.put32((Uint32)width);
+    out.put32((Uint32)height);
+    std::vector<Uint8> payload;
+    for(int y0 = 0; y0 < height; y0 += PAINT_TILE_SIZE){
+        for(int x0 = 0; x0 < width; x0 += PAINT_TILE_SIZE){
+            TileCodec codec = encodePaintTile(pixels + (size_t)y0*width + x0, width, std::min(PAINT_TILE_SIZE, width - x0), std::min(PAINT_TILE_SIZE, height - y0), payload);
+            out.put8((Uint8)codec);
+            out.put32((Uint32)payload.size());
+            out.putBytes(payload.data(), payload.size());
+        }
+    }
+}
+
+// false unless the image is exactly width x height and intact
+inline bool decodeJournalImage(JournalDecoder &in, Uint32* pixels, int width, int height){
+    if((int)in.get32() != width || (int)in.get32() != height) return false;
+    for(int y0 = 0; y0 < height; y0 += PAINT_TILE_SIZE){
+        for(int x0 = 0; x0 < width; x0 += PAINT_TILE_SIZE){
+            int w = std::min(PAINT_TILE_SIZE, width - x0), h = std::min(PAINT_TILE_SIZE, height - y0);
+            TileCodec codec = (TileCodec)in.get8();
+            Uint32 size = in.get32();
+            const Uint8* payload = in.getBytes(size);
+            if(payload == nullptr) return false;
+            if(!decodePaintTile(codec, payload, size, pixels + (size_t)y0*width + x0, width, w, h)) return false;
+        }
+    }
+    return true;
+}
+
+// Write-ahead log of committed tool operations. append() only frames the
+// record and queues it; a writer thread takes everything queued, writes it in
+// one go and fsyncs once per batch (group commit), so the event loop never
+// waits on the disk and at most the batch in flight is lost in a crash.
+// appendImage() only copies the pixels: the writer tile-encodes them, so a
+// whole-canvas record costs the event loop a memcpy.
+// Frame: payload size (Uint32), op (Uint8), sequence (Uint64), payload, CRC-32
+// of op, sequence and payload; replay stops at the first torn or corrupt frame.
+class Journal{
+private:
+    std::string path;
+    FILE* file{nullptr};
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    struct Record{
+        std::vector<Uint8> frame;     // ready to write, or empty for an image still to encode
+        JournalOp op;
+        Uint64 sequence;
+        std::vector<Uint32> image;
+        int width, height;
+    };
+    std::vector<Record> queued;
+    bool stopping{false};
+    Uint64 nextSequence{1};
+    std::atomic<Uint64> durableSequence{0};
+    std::atomic<Uint64> truncateUpTo{0};    // records up to here are in a checkpoint
+    Uint64 queuedSequence{0};               // highest sequence handed to the writer (under mutex)
+
+    static std::vector<Uint8> frameRecord(JournalOp op, Uint64 sequence, const JournalEncoder &payload){
+        JournalEncoder frame;
+        frame.put32((Uint32)payload.bytes.size());
+        frame.put8((Uint8)op);
+        frame.put64(sequence);
+        frame.putBytes(payload.bytes.data(), payload.bytes.size());
+        frame.put32(crc32Update(0, frame.bytes.data() + 4, frame.bytes.size() - 4));
+        return std::move(frame.bytes);
+    }
+
+    void writerLoop(){
+        std::vector<Record> records;
+        std::vector<Uint8> batch;
+        Uint64 batch_sequence = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+            wake.wait(lock, [this]{return stopping || !queued.empty() || (truncateUpTo.load() > 0 && truncateUpTo.load() >= queuedSequence);});
+            if(queued.empty() && truncateUpTo.load() > 0 && truncateUpTo.load() >= queuedSequence){
+                // everything on disk is covered by the checkpoint: start the file over
+                truncateUpTo.store(0);
+                lock.unlock();
+                FILE* fresh = fopen(path.c_str(), "wb");
+                if(fresh == nullptr) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Journal: cannot start %s over, appending to it instead", path.c_str());
+                else{
+                    if(file != nullptr) fclose(file);
+                    file = fresh;
+                    syncFile(file);
+                }
+                lock.lock();
+                continue;
+            }
+            if(queued.empty() && stopping) break;
+            records.swap(queued);
+            batch_sequence = queuedSequence;
+            lock.unlock();
+            for(Record &record: records){
+                if(record.frame.empty()){
+                    JournalEncoder payload;
+                    encodeJournalImage(payload, record.image.data(), record.width, record.height);
+                    record.frame = frameRecord(record.op, record.sequence, payload);
+                }
+                batch.insert(batch.end(), record.frame.begin(), record.frame.end());
+            }
+            records.clear();
+            bool ok = file != nullptr && fwrite(batch.data(), 1, batch.size(), file) == batch.size() && syncFile(file);
+            if(ok) durableSequence.store(batch_sequence, std::memory_order_release);
+            else SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Journal: writing %s failed", path.c_str());
+            batch.clear();
+            lock.lock();
+        }
+    }
+
+public:
+    Journal() = default;
+    ~Journal(){close(false);}
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Appends to the journal at journal_path; records get sequence numbers from first_sequence on
+    bool open(const std::string &journal_path, Uint64 first_sequence){
+        path = journal_path;
+        file = fopen(path.c_str(), "ab");
+        if(file == nullptr) return false;
+        nextSequence = first_sequence;
+        queuedSequence = first_sequence - 1;
+        durableSequence.store(first_sequence - 1);
+        stopping = false;
+        writer = std::thread(&Journal::writerLoop, this);
+        return true;
+    }
+
+    bool isOpen(){return writer.joinable();}
+
+    // Queues one record, returns its sequence number (0 if the journal is closed)
+    Uint64 append(JournalOp op, const JournalEncoder &payload){
+        if(!isOpen()) return 0;
+        Uint64 sequence = nextSequence++;
+        Record record{frameRecord(op, sequence, payload), op, sequence, {}, 0, 0};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(std::move(record));
+            queuedSequence = sequence;
+        }
+        wake.notify_one();
+        return sequence;
+    }
+
+    // Queues a record whose payload is the width x height image (encodeJournalImage)
+    Uint64 appendImage(JournalOp op, const Uint32* pixels, int width, int height){
+        if(!isOpen()) return 0;
+        Uint64 sequence = nextSequence++;
+        Record record{{}, op, sequence, std::vector<Uint32>(pixels, pixels + (size_t)width*height), width, height};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(std::move(record));
+            queuedSequence = sequence;
+        }
+        wake.notify_one();
+        return sequence;
+    }
+
+    Uint64 lastSequence(){return nextSequence - 1;}
+    Uint64 getDurableSequence(){return durableSequence.load(std::memory_order_acquire);}
+
+    // A checkpoint holds every record up to sequence; the file is emptied once nothing newer is pending
+    void checkpointed(Uint64 sequence){
+        if(!isOpen() || sequence == 0) return;
+        truncateUpTo.store(sequence);
+        wake.notify_one();
+    }
+
+    // Flushes what is queued and stops the writer; with discard the file is deleted (clean exit)
+    void close(bool discard){
+        if(!isOpen()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        if(file != nullptr) fclose(file);
+        file = nullptr;
+        if(discard) remove(path.c_str());
+    }
+
+    // Calls apply(op, payload, sequence) for every intact record after after_sequence;
+    // returns the last sequence seen (after_sequence if there is none)
+    static Uint64 replay(const std::string &journal_path, Uint64 after_sequence, const std::function<void(JournalOp, JournalDecoder&, Uint64)> &apply){
+        FILE* file = fopen(journal_path.c_str(), "rb");
+        if(file == nullptr) return after_sequence;
+        std::vector<Uint8> data;
+        Uint8 buffer[1 << 16];
+        size_t n;
+        while((n = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + n);
+        fclose(file);
+
+        Uint64 last = after_sequence;
+        size_t pos = 0;
+        while(data.size() - pos >= 17){
+            JournalDecoder header(data.data() + pos, 13);
+            Uint32 size = header.get32();
+            JournalOp op = (JournalOp)header.get8();
+            Uint64 sequence = header.get64();
+            if(data.size() - pos - 17 < size) break;    // torn tail
+            JournalDecoder trailer(data.data() + pos + 13 + size, 4);
+            if(trailer.get32() != crc32Update(0, data.data() + pos + 4, 9 + (size_t)size)) break;
+            if(sequence > last){
+                JournalDecoder payload(data.data() + pos + 13, size);
+                apply(op, payload, sequence);
+                last = sequence;
+            }
+            pos += 17 + (size_t)size;
+        }
+        if(pos < data.size()) SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Journal: ignored %zu bytes after a damaged or unfinished record", data.size() - pos);
+        return last;
+    }
+};
+
+#endif
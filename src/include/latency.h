@@ -0,0 +1,111 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+const double LATENCY_BUCKET_MS = 0.1;
+const int LATENCY_NUM_BUCKETS = 5000;    // 0 - 500 ms, slower samples go to the last bucket
+
+// Fixed resolution latency histogram; percentiles are reported as the upper
+// edge of the bucket they fall in, so they are accurate to LATENCY_BUCKET_MS
+class LatencyHistogram{
+private:
+    std::vector<Uint32> buckets;
+    Uint64 count{0};
+    double total_ms{0.0};
+    double max_ms{0.0};
+
+public:
+    LatencyHistogram(): buckets(LATENCY_NUM_BUCKETS, 0){}
+
+    void record(double ms){
+        int bucket = std::clamp((int)(ms/LATENCY_BUCKET_MS), 0, LATENCY_NUM_BUCKETS - 1);
+        ++buckets[bucket];
+        ++count;
+        total_ms += ms;
+        max_ms = std::max(max_ms, ms);
+    }
+
+    double percentile(double p){
+        if(count == 0) return 0.0;
+        Uint64 rank = (Uint64)std::max(1.0, p/100*count + 0.5);
+        Uint64 seen = 0;
+        for(int i = 0; i < LATENCY_NUM_BUCKETS; ++i){
+            seen += buckets[i];
+            if(seen >= rank) return std::min((i + 1)*LATENCY_BUCKET_MS, max_ms);
+        }
+        return max_ms;
+    }
+
+    Uint64 getCount(){return count;}
+    double getMean(){return count ? total_ms/count : 0.0;}
+    double getMax(){return max_ms;}
+};
+
+// Input-to-photon latency per tool. Every input event gets a high resolution
+// stamp when it is polled, backdated by how long it waited in the SDL queue.
+// Tool handlers mark the stamps whose result they drew and the first
+// SDL_RenderPresent afterwards closes them. Without vsync the present returning
+// is the closest point to the photons we can observe.
+class LatencyTracker{
+private:
+    struct Pending{
+        const char* tool;
+        Uint64 stamp;
+    };
+    std::map<std::string, LatencyHistogram> histograms;
+    std::vector<Pending> pending;
+    double ticksPerMs;
+
+public:
+    LatencyTracker(): ticksPerMs(SDL_GetPerformanceFrequency()/1000.0){
+        pending.reserve(256);
+    }
+
+    // Call right after SDL_PollEvent returned the event
+    Uint64 stamp(const SDL_Event &event){
+        Uint64 now = SDL_GetPerformanceCounter();
+        Uint32 queued_ms = SDL_GetTicks() - event.common.timestamp;
+        if(queued_ms > 1000) queued_ms = 0;    // synthetic or stale timestamps
+        return now - (Uint64)(queued_ms*ticksPerMs);
+    }
+
+    // The result of the input stamped at stamp is on the canvas or overlay now
+    void track(const char* tool, Uint64 stamp){
+        pending.push_back({tool, stamp});
+    }
+
+    // Call right after SDL_RenderPresent
+    void presented(){
+        if(pending.empty()) return;
+        Uint64 now = SDL_GetPerformanceCounter();
+        for(auto &input: pending) histograms[input.tool].record((now - input.stamp)/ticksPerMs);
+        pending.clear();
+    }
+
+    std::map<std::string, LatencyHistogram> &getHistograms(){return histograms;}
+
+    void log(){
+        for(auto &[tool, histogram]: histograms){
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Latency %s: %llu inputs, p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms", tool.c_str(), (unsigned long long)histogram.getCount(), histogram.percentile(50), histogram.percentile(95), histogram.percentile(99), histogram.getMax());
+        }
+    }
+
+    // One row per tool: tool,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms
+    bool exportCSV(const char* path){
+        FILE* file = fopen(path, "w");
+        if(file == nullptr) return false;
+        fprintf(file, "tool,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+        for(auto &[tool, histogram]: histograms){
+            fprintf(file, "%s,%llu,%.2f,%.1f,%.1f,%.1f,%.2f\n", tool.c_str(), (unsigned long long)histogram.getCount(), histogram.getMean(), histogram.percentile(50), histogram.percentile(95), histogram.percentile(99), histogram.getMax());
+        }
+        return fclose(file) == 0;
+    }
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef LINE_H
+#define LINE_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstring>
+#include "vec2.h"
+#include "canvas.h"
+#include "arena.h"
+
+enum class LineCap: int{
+    BUTT,
+    ROUND,
+    SQUARE,
+    NUM_CAPS
+};
+
+enum class LineJoin: int{
+    ROUND,
+    BEVEL,
+    MITER,
+    NUM_JOINS
+};
+
+typedef struct StrokeStyle{
+    double width{1.0};
+    LineCap cap{LineCap::ROUND};
+    LineJoin join{LineJoin::ROUND};
+    double miter_limit{4.0};    // miter length / half width before falling back to bevel
+} StrokeStyle;
+
+// A stroke is rasterized as the union of convex pieces: a box per segment, discs
+// for round caps/joins and triangles or quads for bevel/miter joins. Coverage is
+// the max over pieces of clamp(0.5 - signed distance), so overlaps never double-blend.
+typedef struct LinePiece{
+    bool is_disc;
+    vec2 center;
+    double radius;
+    int num_edges;
+    double edge_a[4], edge_b[4], edge_c[4];    // a*x + b*y + c = distance outside the edge
+    double min_x, min_y, max_x, max_y;
+} LinePiece;
+
+inline LinePiece makeDiscPiece(vec2 center, double radius){
+    LinePiece piece;
+    piece.is_disc = true;
+    piece.center = center;
+    piece.radius = radius;
+    piece.num_edges = 0;
+    piece.min_x = center.x - radius; piece.max_x = center.x + radius;
+    piece.min_y = center.y - radius; piece.max_y = center.y + radius;
+    return piece;
+}
+
+inline LinePiece makePolygonPiece(const vec2* pts, int n){
+    LinePiece piece;
+    piece.is_disc = false;
+    piece.radius = 0;
+    piece.num_edges = n;
+    double area = 0;
+    for(int i = 0; i < n; ++i) area += pts[i].x*pts[(i+1)%n].y - pts[(i+1)%n].x*pts[i].y;
+    double sign = area >= 0 ? 1.0 : -1.0;
+    piece.min_x = piece.max_x = pts[0].x;
+    piece.min_y = piece.max_y = pts[0].y;
+    for(int i = 0; i < n; ++i){
+        vec2 p = pts[i], q = pts[(i+1)%n];
+        vec2 e = q - p;
+        double len = norm(e);
+        if(len < 1e-12){piece.edge_a[i] = piece.edge_b[i] = 0; piece.edge_c[i] = -1e9; continue;}
+        // outward normal for either winding
+        piece.edge_a[i] = sign*e.y/len;
+        piece.edge_b[i] = -sign*e.x/len;
+        piece.edge_c[i] = -(piece.edge_a[i]*p.x + piece.edge_b[i]*p.y);
+        piece.min_x = std::min(piece.min_x, p.x); piece.max_x = std::max(piece.max_x, p.x);
+        piece.min_y = std::min(piece.min_y, p.y); piece.max_y = std::max(piece.max_y, p.y);
+    }
+    return piece;
+}
+
+inline double pieceDistance(const LinePiece &piece, double x, double y){
+    if(piece.is_disc) return sqrt((x - piece.center.x)*(x - piece.center.x) + (y - piece.center.y)*(y - piece.center.y)) - piece.radius;
+    double d = -1e9;
+    for(int i = 0; i < piece.num_edges; ++i) d = std::max(d, piece.edge_a[i]*x + piece.edge_b[i]*y + piece.edge_c[i]);
+    return d;
+}
+
+// Anti-aliased polyline of the given style, blended into canvas in a single
+// pass over the rows it covers. Scratch memory comes from the stroke arena.
+inline void drawPolyline(Canvas &canvas, const vec2* points, size_t count, const StrokeStyle &style, SDL_Color color, StrokeArena &scratch){
+    if(count == 0) return;
+    double r = std::max(style.width, 0.5)/2;
+    ArenaVector<vec2> pts{ArenaAllocator<vec2>(&scratch)};
+    pts.reserve(count);
+    for(size_t i = 0; i < count; ++i) if(pts.empty() || sqnorm(points[i] - pts.back()) > 1e-12) pts.push_back(points[i]);
+
+    ArenaVector<LinePiece> pieces{ArenaAllocator<LinePiece>(&scratch)};
+    pieces.reserve(3*pts.size());
+    if(pts.size() == 1){
+        if(style.cap == LineCap::ROUND) pieces.push_back(makeDiscPiece(pts[0], r));
+        else{
+            vec2 quad[4] = {{pts[0].x - r, pts[0].y - r}, {pts[0].x + r, pts[0].y - r}, {pts[0].x + r, pts[0].y + r}, {pts[0].x - r, pts[0].y + r}};
+            pieces.push_back(makePolygonPiece(quad, 4));
+        }
+    }
+    for(size_t i = 0; i + 1 < pts.size(); ++i){
+        vec2 d = pts[i+1] - pts[i];
+        d = d/norm(d);
+        vec2 n(-d.y, d.x);
+        vec2 a = pts[i], b = pts[i+1];
+        if(style.cap == LineCap::SQUARE && i == 0) a = a - r*d;
+        if(style.cap == LineCap::SQUARE && i + 2 == pts.size()) b = b + r*d;
+        vec2 quad[4] = {a + r*n, b + r*n, b - r*n, a - r*n};
+        pieces.push_back(makePolygonPiece(quad, 4));
+
+        if(i + 2 < pts.size()){
+            vec2 v = pts[i+1];
+            vec2 d2 = pts[i+2] - v;
+            d2 = d2/norm(d2);
+            vec2 n2(-d2.y, d2.x);
+            double turn = d.x*d2.y - d.y*d2.x;
+            if(style.join == LineJoin::ROUND) pieces.push_back(makeDiscPiece(v, r));
+            else if(fabs(turn) > 1e-9){
+                double side = turn > 0 ? -1.0 : 1.0;    // the outer side of the bend
+                vec2 o1 = v + side*r*n, o2 = v + side*r*n2;
+                vec2 bisector = n + n2;
+                double cos_half = norm(bisector)/2;
+                if(style.join == LineJoin::MITER && cos_half > 1e-6 && 1.0/cos_half <= style.miter_limit){
+                    vec2 tip = v + (side*r/(cos_half*norm(bisector)))*bisector;
+                    vec2 quad_join[4] = {v, o1, tip, o2};
+                    pieces.push_back(makePolygonPiece(quad_join, 4));
+                }
+                else{
+                    vec2 tri[3] = {v, o1, o2};
+                    pieces.push_back(makePolygonPiece(tri, 3));
+                }
+            }
+        }
+    }
+    if(style.cap == LineCap::ROUND && pts.size() > 1){
+        pieces.push_back(makeDiscPiece(pts.front(), r));
+        pieces.push_back(makeDiscPiece(pts.back(), r));
+    }
+
+    double min_x = 1e18, min_y = 1e18, max_x = -1e18, max_y = -1e18;
+    for(auto &piece: pieces){
+        min_x = std::min(min_x, piece.min_x); min_y = std::min(min_y, piece.min_y);
+        max_x = std::max(max_x, piece.max_x); max_y = std::max(max_y, piece.max_y);
+    }
+    SDL_Rect clip = canvas.getClip();
+    int x0 = std::max(clip.x, (int)floor(min_x) - 1), x1 = std::min(clip.x + clip.w, (int)ceil(max_x) + 1);
+    int y0 = std::max(clip.y, (int)floor(min_y) - 1), y1 = std::min(clip.y + clip.h, (int)ceil(max_y) + 1);
+    if(x1 <= x0 || y1 <= y0) return;
+
+    Uint8* coverage = static_cast<Uint8*>(scratch.allocate(x1 - x0, 16));
+    Uint32 pixel = Canvas::mapColor(color);
+    for(int y = y0; y < y1; ++y){
+        memset(coverage, 0, x1 - x0);
+        double py = y + 0.5;
+        int span_x0 = x1, span_x1 = x0;
+        for(auto &piece: pieces){
+            if(py < piece.min_y - 0.5 || py > piece.max_y + 0.5) continue;
+            int px0 = std::max(x0, (int)floor(piece.min_x - 0.5)), px1 = std::min(x1, (int)ceil(piece.max_x + 0.5));
+            span_x0 = std::min(span_x0, px0);
+            span_x1 = std::max(span_x1, px1);
+            for(int x = px0; x < px1; ++x){
+                double c = 0.5 - pieceDistance(piece, x + 0.5, py);
+                if(c <= 0) continue;
+                Uint8 value = c >= 1 ? 255 : (Uint8)(c*255 + 0.5);
+                Uint8 &dst = coverage[x - x0];
+                if(value > dst) dst = value;
+            }
+        }
+        if(span_x1 > span_x0) Canvas::blendCoverageSpan(canvas.getRow(y) + span_x0, coverage + (span_x0 - x0), span_x1 - span_x0, pixel);
+    }
+    canvas.markDirty({x0, y0, x1 - x0, y1 - y0});
+}
+
+inline void drawLine(Canvas &canvas, vec2 a, vec2 b, const StrokeStyle &style, SDL_Color color, StrokeArena &scratch){
+    vec2 points[2] = {a, b};
+    drawPolyline(canvas, points, 2, style, color, scratch);
+}
+
+#endif
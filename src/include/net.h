@@ -0,0 +1,334 @@
+#ifndef NET_H
+#define NET_H
+
+// Minimal non-blocking sockets for Winsock and POSIX. Addresses are "port" or
+// "host:port" for TCP, "unix:/path" for a Unix domain socket.
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef FD_SETSIZE
+#define FD_SETSIZE 1024
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+typedef SOCKET NetSocket;
+const NetSocket NET_INVALID_SOCKET = INVALID_SOCKET;
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int NetSocket;
+const NetSocket NET_INVALID_SOCKET = -1;
+#endif
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+const size_t NET_MAX_MESSAGE = (size_t)1 << 28;
+
+inline bool netStartup(){
+#if defined(_WIN32)
+    static bool started = false;
+    if(!started){
+        WSADATA data;
+        if(WSAStartup(MAKEWORD(2, 2), &data) != 0) return false;
+        started = true;
+    }
+#endif
+    return true;
+}
+
+inline void netClose(NetSocket s){
+    if(s == NET_INVALID_SOCKET) return;
+#if defined(_WIN32)
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+inline bool netSetNonBlocking(NetSocket s){
+#if defined(_WIN32)
+    u_long on = 1;
+    return ioctlsocket(s, FIONBIO, &on) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+inline bool netWouldBlock(){
+#if defined(_WIN32)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// Small messages go out at once instead of waiting for more data (Nagle)
+inline void netSetLowLatency(NetSocket s){
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+}
+
+inline bool netIsUnixAddress(const std::string &address){return address.compare(0, 5, "unix:") == 0;}
+
+inline bool netUnixAddress(const std::string &address, sockaddr_un &out){
+    std::string path = address.substr(5);
+    memset(&out, 0, sizeof(out));
+    out.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(out.sun_path)) return false;
+    memcpy(out.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// TCP addresses: no host listens on every interface and connects to this machine
+inline addrinfo* netResolve(const std::string &address, bool listening){
+    size_t colon = address.rfind(':');
+    std::string host = colon == std::string::npos ? "" : address.substr(0, colon);
+    std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+    if(host.empty()) host = listening ? "0.0.0.0" : "127.0.0.1";
+    addrinfo hints, *result = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(listening) hints.ai_flags = AI_PASSIVE;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) return nullptr;
+    return result;
+}
+
+// Frees the path of addr for bind(). Only a socket nothing accepts on any more,
+// left behind by a process that did not exit cleanly, is removed; a live
+// socket or any other kind of file there means the address is in use.
+inline bool netClaimUnixPath(const sockaddr_un &addr){
+#if defined(_WIN32)
+    DWORD attributes = GetFileAttributesA(addr.sun_path);
+    if(attributes == INVALID_FILE_ATTRIBUTES) return GetLastError() == ERROR_FILE_NOT_FOUND;
+    bool is_socket = (attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;    // how Windows keeps AF_UNIX sockets
+#else
+    struct stat info;
+    if(lstat(addr.sun_path, &info) != 0) return errno == ENOENT;
+    bool is_socket = S_ISSOCK(info.st_mode);
+#endif
+    if(!is_socket) return false;
+    bool refused = false;
+    NetSocket probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(probe != NET_INVALID_SOCKET && connect(probe, (const sockaddr*)&addr, sizeof(addr)) != 0){
+#if defined(_WIN32)
+        refused = WSAGetLastError() == WSAECONNREFUSED;
+#else
+        refused = errno == ECONNREFUSED;
+#endif
+    }
+    netClose(probe);
+    return refused && remove(addr.sun_path) == 0;
+}
+
+// A non-blocking listening socket, NET_INVALID_SOCKET with SDL_GetError() set on failure
+inline NetSocket netListen(const std::string &address){
+    if(!netStartup()){
+        SDL_SetError("Cannot start the network");
+        return NET_INVALID_SOCKET;
+    }
+    NetSocket s = NET_INVALID_SOCKET;
+    if(netIsUnixAddress(address)){
+        sockaddr_un addr;
+        if(!netUnixAddress(address, addr)){
+            SDL_SetError("Bad socket path in %s", address.c_str());
+            return NET_INVALID_SOCKET;
+        }
+        if(!netClaimUnixPath(addr)){
+            SDL_SetError("Cannot listen on %s: address in use", address.c_str());
+            return NET_INVALID_SOCKET;
+        }
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(s != NET_INVALID_SOCKET && bind(s, (sockaddr*)&addr, sizeof(addr)) != 0){
+            netClose(s);
+            s = NET_INVALID_SOCKET;
+        }
+    }
+    else{
+        addrinfo* info = netResolve(address, true);
+        for(addrinfo* it = info; it != nullptr && s == NET_INVALID_SOCKET; it = it->ai_next){
+            s = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+            if(s == NET_INVALID_SOCKET) continue;
+            int on = 1;
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+            if(bind(s, it->ai_addr, (int)it->ai_addrlen) != 0){
+                netClose(s);
+                s = NET_INVALID_SOCKET;
+            }
+        }
+        if(info != nullptr) freeaddrinfo(info);
+    }
+    if(s == NET_INVALID_SOCKET || listen(s, 64) != 0 || !netSetNonBlocking(s)){
+        netClose(s);
+        SDL_SetError("Cannot listen on %s", address.c_str());
+        return NET_INVALID_SOCKET;
+    }
+    return s;
+}
+
+// Connects (blocking), then makes the socket non-blocking
+inline NetSocket netConnect(const std::string &address){
+    if(!netStartup()){
+        SDL_SetError("Cannot start the network");
+        return NET_INVALID_SOCKET;
+    }
+    NetSocket s = NET_INVALID_SOCKET;
+    if(netIsUnixAddress(address)){
+        sockaddr_un addr;
+        if(netUnixAddress(address, addr)){
+            s = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(s != NET_INVALID_SOCKET && connect(s, (sockaddr*)&addr, sizeof(addr)) != 0){
+                netClose(s);
+                s = NET_INVALID_SOCKET;
+            }
+        }
+    }
+    else{
+        addrinfo* info = netResolve(address, false);
+        for(addrinfo* it = info; it != nullptr && s == NET_INVALID_SOCKET; it = it->ai_next){
+            s = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+            if(s == NET_INVALID_SOCKET) continue;
+            if(connect(s, it->ai_addr, (int)it->ai_addrlen) != 0){
+                netClose(s);
+                s = NET_INVALID_SOCKET;
+            }
+        }
+        if(info != nullptr) freeaddrinfo(info);
+        if(s != NET_INVALID_SOCKET) netSetLowLatency(s);
+    }
+    if(s == NET_INVALID_SOCKET || !netSetNonBlocking(s)){
+        netClose(s);
+        SDL_SetError("Cannot connect to %s", address.c_str());
+        return NET_INVALID_SOCKET;
+    }
+    return s;
+}
+
+// The next pending connection, non-blocking, or NET_INVALID_SOCKET
+inline NetSocket netAccept(NetSocket listener){
+    NetSocket s = accept(listener, nullptr, nullptr);
+    if(s == NET_INVALID_SOCKET) return s;
+    if(!netSetNonBlocking(s)){
+        netClose(s);
+        return NET_INVALID_SOCKET;
+    }
+    netSetLowLatency(s);    // fails harmlessly on Unix domain sockets
+    return s;
+}
+
+// One socket with length prefixed (u32, little endian) messages buffered both
+// ways. Not thread-safe: callers that share one hold their own lock.
+class NetConnection{
+private:
+    std::vector<Uint8> in;
+    size_t inStart{0};     // bytes of in already handed out
+    std::vector<Uint8> out;
+    size_t outStart{0};    // bytes of out already sent
+
+public:
+    NetSocket handle{NET_INVALID_SOCKET};
+    bool closed{false};
+    Uint64 bytesSent{0}, bytesReceived{0};
+
+    NetConnection() = default;
+    explicit NetConnection(NetSocket s): handle(s){}
+    ~NetConnection(){netClose(handle);}
+    NetConnection(const NetConnection&) = delete;
+    NetConnection& operator=(const NetConnection&) = delete;
+
+    size_t pendingOutput(){return out.size() - outStart;}
+
+    void queue(const Uint8* message, size_t size){
+        if(closed) return;
+        for(int s = 0; s < 32; s += 8) out.push_back((Uint8)(size >> s));
+        out.insert(out.end(), message, message + size);
+    }
+
+    // Sends what the socket takes without blocking; false once the connection is lost
+    bool flush(){
+        while(!closed && outStart < out.size()){
+            int n = send(handle, (const char*)out.data() + outStart, (int)std::min<size_t>(out.size() - outStart, 1 << 20),
+#ifdef MSG_NOSIGNAL
+                         MSG_NOSIGNAL
+#else
+                         0
+#endif
+            );
+            if(n > 0){
+                outStart += n;
+                bytesSent += n;
+            }
+            else if(n < 0 && netWouldBlock()) break;
+            else closed = true;
+        }
+        if(outStart == out.size()){
+            out.clear();
+            outStart = 0;
+        }
+        else if(outStart > (1 << 20)){
+            out.erase(out.begin(), out.begin() + outStart);
+            outStart = 0;
+        }
+        return !closed;
+    }
+
+    // Reads whatever has arrived; false once the peer has closed or the connection failed
+    bool receive(){
+        Uint8 chunk[1 << 16];
+        while(!closed){
+            int n = recv(handle, (char*)chunk, sizeof(chunk), 0);
+            if(n > 0){
+                in.insert(in.end(), chunk, chunk + n);
+                bytesReceived += n;
+            }
+            else if(n < 0 && netWouldBlock()) break;
+            else closed = true;
+        }
+        return !closed;
+    }
+
+    // Pops the next complete message; oversized messages close the connection
+    bool nextMessage(std::vector<Uint8> &message){
+        if(in.size() - inStart < 4) return false;
+        const Uint8* head = in.data() + inStart;
+        size_t size = (size_t)head[0] | (size_t)head[1] << 8 | (size_t)head[2] << 16 | (size_t)head[3] << 24;
+        if(size > NET_MAX_MESSAGE){
+            closed = true;
+            return false;
+        }
+        if(in.size() - inStart < 4 + size) return false;
+        message.assign(head + 4, head + 4 + size);
+        inStart += 4 + size;
+        if(inStart == in.size()){
+            in.clear();
+            inStart = 0;
+        }
+        else if(inStart > (1 << 20)){
+            in.erase(in.begin(), in.begin() + inStart);
+            inStart = 0;
+        }
+        return true;
+    }
+};
+
+#endif
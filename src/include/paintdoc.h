@@ -0,0 +1,368 @@
+#ifndef PAINTDOC_H
+#define PAINTDOC_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "jobs.h"
+
+// Read-only view of a whole file through the OS page cache: nothing is read
+// until a byte is touched, so opening costs the same for any file size.
+class MappedFile{
+private:
+    const Uint8* bytes{nullptr};
+    size_t length{0};
+#if defined(_WIN32)
+    HANDLE file{INVALID_HANDLE_VALUE};
+    HANDLE mapping{nullptr};
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile(){close();}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path){
+        close();
+#if defined(_WIN32)
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER file_size;
+        if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0){close(); return false;}
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping == nullptr){close(); return false;}
+        bytes = static_cast<const Uint8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if(bytes == nullptr){close(); return false;}
+        length = (size_t)file_size.QuadPart;
+#else
+        int fd = ::open(path, O_RDONLY);
+        if(fd < 0) return false;
+        struct stat info;
+        if(fstat(fd, &info) != 0 || info.st_size == 0){::close(fd); return false;}
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);    // the mapping keeps the file alive
+        if(view == MAP_FAILED) return false;
+        bytes = static_cast<const Uint8*>(view);
+        length = (size_t)info.st_size;
+#endif
+        return true;
+    }
+
+    void close(){
+#if defined(_WIN32)
+        if(bytes != nullptr) UnmapViewOfFile(bytes);
+        if(mapping != nullptr) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(bytes != nullptr) munmap(const_cast<Uint8*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const Uint8* data(){return bytes;}
+    size_t size(){return length;}
+};
+
+// Tile payload encodings
+enum class TileCodec: Uint8{
+    RAW,      // tile_w*tile_h pixels
+    SOLID,    // one pixel repeated
+    RLE       // see encodeTileRLE
+};
+
+// Run-length encodes a w x h block of pixels (pitch in pixels). Tokens are a
+// little endian Uint16: bit 15 set means the next pixel repeats (n & 0x7FFF) + 1
+// times, clear means n + 1 literal pixels follow. Painted tiles are mostly flat
+// colour, so runs dominate and decoding is a handful of fills per row.
+inline void encodeTileRLE(const Uint32* src, int pitch, int w, int h, std::vector<Uint8> &out){
+    auto put16 = [&](Uint16 v){out.push_back((Uint8)v); out.push_back((Uint8)(v >> 8));};
+    auto put32 = [&](Uint32 v){for(int s = 0; s < 32; s += 8) out.push_back((Uint8)(v >> s));};
+    auto pixel = [&](size_t i){return src[(i / w)*(size_t)pitch + i % w];};
+    size_t count = (size_t)w*h, i = 0;
+    while(i < count){
+        size_t run = 1;
+        Uint32 p = pixel(i);
+        while(i + run < count && run < 0x8000 && pixel(i + run) == p) ++run;
+        if(run >= 3){
+            put16((Uint16)(0x8000 | (run - 1)));
+            put32(p);
+            i += run;
+            continue;
+        }
+        // literals until the next run of 3 or more
+        size_t start = i, literal = 0;
+        while(i < count && literal < 0x8000){
+            if(i + 2 < count && pixel(i) == pixel(i + 1) && pixel(i) == pixel(i + 2)) break;
+            ++i;
+            ++literal;
+        }
+        put16((Uint16)(literal - 1));
+        for(size_t k = start; k < start + literal; ++k) put32(pixel(k));
+    }
+}
+
+// false if data is truncated or does not cover exactly w*h pixels
+inline bool decodeTileRLE(const Uint8* data, size_t size, Uint32* dst, int pitch, int w, int h){
+    auto get32 = [](const Uint8* p){return (Uint32)p[0] | ((Uint32)p[1] << 8) | ((Uint32)p[2] << 16) | ((Uint32)p[3] << 24);};
+    size_t count = (size_t)w*h, i = 0, pos = 0;
+    while(i < count){
+        if(pos + 2 > size) return false;
+        Uint16 token = (Uint16)(data[pos] | (data[pos + 1] << 8));
+        pos += 2;
+        size_t n = (token & 0x7FFF) + 1u;
+        if(i + n > count) return false;
+        if(token & 0x8000){
+            if(pos + 4 > size) return false;
+            Uint32 p = get32(data + pos);
+            pos += 4;
+            while(n > 0){    // fill row by row
+                int x = (int)(i % w), y = (int)(i / w);
+                int span = (int)std::min(n, (size_t)(w - x));
+                std::fill_n(dst + (size_t)y*pitch + x, span, p);
+                i += span;
+                n -= span;
+            }
+        }
+        else{
+            if(pos + 4*n > size) return false;
+            for(size_t k = 0; k < n; ++k, ++i, pos += 4) dst[(i / w)*(size_t)pitch + i % w] = get32(data + pos);
+        }
+    }
+    return pos == size;
+}
+
+// Encodes a w x h block of pixels (pitch in pixels) with whichever codec gives the smallest payload
+inline TileCodec encodePaintTile(const Uint32* src, int pitch, int w, int h, std::vector<Uint8> &out){
+    out.clear();
+    encodeTileRLE(src, pitch, w, h, out);
+    if(out.size() == 6){    // one run: SOLID is just the pixel
+        out.erase(out.begin(), out.begin() + 2);
+        return TileCodec::SOLID;
+    }
+    if(out.size() >= (size_t)w*h*4){    // noise: RAW is smaller
+        out.clear();
+        for(int y = 0; y < h; ++y) for(int x = 0; x < w; ++x) for(int s = 0; s < 32; s += 8) out.push_back((Uint8)(src[(size_t)y*pitch + x] >> s));
+        return TileCodec::RAW;
+    }
+    return TileCodec::RLE;
+}
+
+// Inverse of encodePaintTile(); false if the payload does not fit the tile
+inline bool decodePaintTile(TileCodec codec, const Uint8* payload, size_t size, Uint32* dst, int pitch, int w, int h){
+    auto get32 = [](const Uint8* p){return (Uint32)p[0] | ((Uint32)p[1] << 8) | ((Uint32)p[2] << 16) | ((Uint32)p[3] << 24);};
+    switch(codec){
+        case TileCodec::SOLID:
+            if(size != 4) return false;
+            for(int y = 0; y < h; ++y) std::fill_n(dst + (size_t)y*pitch, w, get32(payload));
+            return true;
+        case TileCodec::RAW:
+            if(size != (size_t)w*h*4) return false;
+            for(int y = 0; y < h; ++y) for(int x = 0; x < w; ++x) dst[(size_t)y*pitch + x] = get32(payload + ((size_t)y*w + x)*4);
+            return true;
+        case TileCodec::RLE:
+            return decodeTileRLE(payload, size, dst, pitch, w, h);
+        default:
+            return false;
+    }
+}
+
+const char PAINT_MAGIC[8] = {'P', 'A', 'I', 'N', 'T', 'D', 'O', 'C'};
+const Uint32 PAINT_VERSION = 1;
+const int PAINT_TILE_SIZE = 256;
+const size_t PAINT_HEADER_SIZE = 40;
+const size_t PAINT_INDEX_ENTRY_SIZE = 16;
+const int PAINT_MAX_SIDE = 65535;          // width and height a file may claim
+const int PAINT_MAX_STATES = 1 << 20;     // undo states a file may claim
+
+// .paint project file, little endian:
+//   header   magic[8] version width height tile_size state_count current_state (Uint32 each) index_offset (Uint64)
+//   payloads tile data, each encoded on its own
+//   index    state_count x tiles_y x tiles_x entries: offset (Uint64) size (Uint32) codec (Uint8) 3 bytes padding
+// Every undo state has a full tile index, but a tile that did not change since
+// the previous state points at the same payload, so history costs only the
+// tiles each step touched. The index sits at the end so payloads can be
+// streamed out while it is built.
+class PaintDocument{
+private:
+    MappedFile file;
+    int width{0}, height{0};
+    int tileSize{PAINT_TILE_SIZE};
+    int tilesX{0}, tilesY{0};
+    int stateCount{0};
+    int currentState{0};
+    const Uint8* index{nullptr};
+
+    static Uint32 get32(const Uint8* p){return (Uint32)p[0] | ((Uint32)p[1] << 8) | ((Uint32)p[2] << 16) | ((Uint32)p[3] << 24);}
+    static Uint64 get64(const Uint8* p){return (Uint64)get32(p) | ((Uint64)get32(p + 4) << 32);}
+
+public:
+    // Checks the header and the index bounds; pixels are only read by readTile()
+    bool open(const char* path){
+        if(!file.open(path)) return false;
+        const Uint8* data = file.data();
+        if(file.size() < PAINT_HEADER_SIZE || memcmp(data, PAINT_MAGIC, 8) != 0 || get32(data + 8) != PAINT_VERSION){
+            file.close();
+            return false;
+        }
+        width = (int)get32(data + 12);
+        height = (int)get32(data + 16);
+        tileSize = (int)get32(data + 20);
+        stateCount = (int)get32(data + 24);
+        currentState = (int)get32(data + 28);
+        Uint64 index_offset = get64(data + 32);
+        // bounded before any arithmetic, so a damaged header cannot overflow the index size
+        if(width <= 0 || width > PAINT_MAX_SIDE || height <= 0 || height > PAINT_MAX_SIDE || tileSize <= 0 || tileSize > 4096 ||
+           stateCount <= 0 || stateCount > PAINT_MAX_STATES || currentState < 0 || currentState >= stateCount){
+            file.close();
+            return false;
+        }
+        tilesX = (int)(((Uint64)width + tileSize - 1)/tileSize);
+        tilesY = (int)(((Uint64)height + tileSize - 1)/tileSize);
+        Uint64 index_size = (Uint64)stateCount*(Uint64)tilesX*(Uint64)tilesY*PAINT_INDEX_ENTRY_SIZE;
+        if(index_offset < PAINT_HEADER_SIZE || index_offset > file.size() || index_size > file.size() - index_offset){
+            file.close();
+            return false;
+        }
+        index = data + index_offset;
+        return true;
+    }
+
+    // Decodes one tile of state into dst (pitch in pixels); false if the file is damaged
+    bool readTile(int state, int tile_x, int tile_y, Uint32* dst, int pitch){
+        const Uint8* entry = index + (((size_t)state*tilesY + tile_y)*tilesX + tile_x)*PAINT_INDEX_ENTRY_SIZE;
+        Uint64 offset = get64(entry);
+        Uint32 size = get32(entry + 8);
+        TileCodec codec = (TileCodec)entry[12];
+        if(offset > file.size() || size > file.size() - offset) return false;
+        return decodePaintTile(codec, file.data() + offset, size, dst, pitch, std::min(tileSize, width - tile_x*tileSize), std::min(tileSize, height - tile_y*tileSize));
+    }
+
+    // Decodes state into a dst_w x dst_h image, tiles in parallel. Only the
+    // tiles overlapping dst are touched; dst outside the document becomes white.
+    bool readState(int state, Uint32* dst, int dst_w, int dst_h, JobSystem &jobs){
+        if(state < 0 || state >= stateCount) return false;
+        std::atomic<bool> ok{true};
+        int used_w = std::min(width, dst_w), used_h = std::min(height, dst_h);
+        int tiles_x = (used_w + tileSize - 1)/tileSize, tiles_y = (used_h + tileSize - 1)/tileSize;
+        jobs.parallelFor(0, tiles_x*tiles_y, 1, [&](int lo, int hi){
+            std::vector<Uint32> clipped;
+            for(int i = lo; i < hi; ++i){
+                int tx = i % tiles_x, ty = i / tiles_x;
+                int x0 = tx*tileSize, y0 = ty*tileSize;
+                int w = std::min(tileSize, width - x0), h = std::min(tileSize, height - y0);
+                if(x0 + w <= dst_w && y0 + h <= dst_h){
+                    if(!readTile(state, tx, ty, dst + (size_t)y0*dst_w + x0, dst_w)) ok = false;
+                    continue;
+                }
+                // tile hangs over the edge of dst
+                clipped.resize((size_t)w*h);
+                if(!readTile(state, tx, ty, clipped.data(), w)) ok = false;
+                int copy_w = std::min(w, dst_w - x0), copy_h = std::min(h, dst_h - y0);
+                for(int y = 0; y < copy_h; ++y) std::copy_n(clipped.data() + (size_t)y*w, copy_w, dst + (size_t)(y0 + y)*dst_w + x0);
+            }
+        }, "paint_read_tiles");
+        for(int y = 0; y < dst_h; ++y){
+            Uint32* row = dst + (size_t)y*dst_w;
+            if(y < used_h) std::fill(row + used_w, row + dst_w, 0xFFFFFFFF);
+            else std::fill(row, row + dst_w, 0xFFFFFFFF);
+        }
+        return ok;
+    }
+
+    int getWidth(){return width;}
+    int getHeight(){return height;}
+    int getStateCount(){return stateCount;}
+    int getCurrentState(){return currentState;}
+};
+
+// Writes a .paint file of state_count width x height images, state(k) giving
+// the pixels of state k (both k and k - 1 must stay valid while k is written).
+// Tiles are compared and encoded in parallel; only changed tiles are stored.
+inline bool writePaintDocument(const char* path, int width, int height, int state_count, int current_state, const std::function<const Uint32*(int)> &state, JobSystem &jobs){
+    if(width > PAINT_MAX_SIDE || height > PAINT_MAX_SIDE || state_count > PAINT_MAX_STATES) return false;    // PaintDocument would refuse it
+    FILE* file = fopen(path, "wb");
+    if(file == nullptr) return false;
+    auto put32 = [](std::vector<Uint8> &out, Uint32 v){for(int s = 0; s < 32; s += 8) out.push_back((Uint8)(v >> s));};
+    auto put64 = [&](std::vector<Uint8> &out, Uint64 v){put32(out, (Uint32)v); put32(out, (Uint32)(v >> 32));};
+
+    std::vector<Uint8> header(PAINT_MAGIC, PAINT_MAGIC + 8);
+    for(Uint32 v: {PAINT_VERSION, (Uint32)width, (Uint32)height, (Uint32)PAINT_TILE_SIZE, (Uint32)state_count, (Uint32)current_state}) put32(header, v);
+    put64(header, 0);    // index offset, patched at the end
+    bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+
+    int tiles_x = (width + PAINT_TILE_SIZE - 1)/PAINT_TILE_SIZE, tiles_y = (height + PAINT_TILE_SIZE - 1)/PAINT_TILE_SIZE;
+    int tile_count = tiles_x*tiles_y;
+    struct Entry{Uint64 offset; Uint32 size; TileCodec codec;};
+    std::vector<Entry> entries((size_t)state_count*tile_count);
+    std::vector<std::vector<Uint8>> payloads(tile_count);
+    std::vector<char> changed(tile_count);
+    std::vector<TileCodec> codecs(tile_count);
+    Uint64 offset = PAINT_HEADER_SIZE;
+
+    for(int k = 0; k < state_count && ok; ++k){
+        const Uint32* pixels = state(k);
+        const Uint32* previous = k > 0 ? state(k - 1) : nullptr;
+        jobs.parallelFor(0, tile_count, 1, [&](int lo, int hi){
+            for(int i = lo; i < hi; ++i){
+                int x0 = (i % tiles_x)*PAINT_TILE_SIZE, y0 = (i / tiles_x)*PAINT_TILE_SIZE;
+                int w = std::min(PAINT_TILE_SIZE, width - x0), h = std::min(PAINT_TILE_SIZE, height - y0);
+                const Uint32* src = pixels + (size_t)y0*width + x0;
+                changed[i] = previous == nullptr;
+                for(int y = 0; y < h && !changed[i]; ++y) changed[i] = memcmp(src + (size_t)y*width, previous + (size_t)(y0 + y)*width + x0, w*sizeof(Uint32)) != 0;
+                if(changed[i]) codecs[i] = encodePaintTile(src, width, w, h, payloads[i]);
+            }
+        }, "paint_encode_tiles");
+
+        for(int i = 0; i < tile_count; ++i){
+            Entry &entry = entries[(size_t)k*tile_count + i];
+            if(!changed[i]){
+                entry = entries[(size_t)(k - 1)*tile_count + i];
+                continue;
+            }
+            std::vector<Uint8> &payload = payloads[i];
+            entry.offset = offset;
+            entry.size = (Uint32)payload.size();
+            entry.codec = codecs[i];
+            if(fwrite(payload.data(), 1, payload.size(), file) != payload.size()) ok = false;
+            offset += payload.size();
+        }
+    }
+
+    std::vector<Uint8> index;
+    index.reserve(entries.size()*PAINT_INDEX_ENTRY_SIZE);
+    for(auto &entry: entries){
+        put64(index, entry.offset);
+        put32(index, entry.size);
+        put32(index, (Uint32)entry.codec);    // codec byte and padding
+    }
+    if(ok) ok = fwrite(index.data(), 1, index.size(), file) == index.size();
+    std::vector<Uint8> index_offset;
+    put64(index_offset, offset);
+    if(ok) ok = fseek(file, 32, SEEK_SET) == 0 && fwrite(index_offset.data(), 1, 8, file) == 8;
+    if(fclose(file) != 0) ok = false;
+    if(!ok) remove(path);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include <SDL2/SDL.h>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+#include "deflate.h"
+
+inline Uint32 crc32Update(Uint32 crc, const Uint8* data, size_t size){
+    // built once, thread-safely: the journal, autosave, viewer and render service threads all get here
+    static const Uint32* table = []{
+        static Uint32 crcs[256];
+        for(Uint32 n = 0; n < 256; ++n){
+            Uint32 c = n;
+            for(int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crcs[n] = c;
+        }
+        return crcs;
+    }();
+    crc = ~crc;
+    for(size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline Uint32 adler32Update(Uint32 adler, const Uint8* data, size_t size){
+    Uint32 a = adler & 0xFFFF, b = adler >> 16;
+    while(size > 0){
+        size_t n = size < 5552 ? size : 5552;    // largest run before the sums can overflow
+        size -= n;
+        while(n--){
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Receives the encoded bytes when not writing to a file; false aborts the image
+typedef std::function<bool(const Uint8*, size_t)> PNGSink;
+
+// Streaming PNG encoder for 8 bit RGBA images of any size. Each row is
+// filtered (whichever of the five PNG filters leaves the smallest residuals)
+// and pushed through the deflate encoder, and compressed data goes to the file
+// (or sink) as IDAT chunks as soon as there is enough of it: memory holds two
+// rows and the compressor's window, whatever the height of the image.
+class PNGWriter{
+private:
+    static const size_t IDAT_SIZE = 65536;
+
+    FILE* file{nullptr};
+    PNGSink sink;
+    int width{0}, height{0};
+    int rowsWritten{0};
+    Uint32 adler{1};
+    bool headerWritten{false};
+    bool failed{false};
+    DeflateEncoder deflate;
+    std::vector<Uint8> previous;    // the last row, unfiltered
+    std::vector<Uint8> current;
+    std::vector<Uint8> filtered[5];    // the row with a filter type byte, per filter
+    std::vector<Uint8> chunk;
+
+    static void putU32(std::vector<Uint8> &out, Uint32 value){
+        out.push_back((Uint8)(value >> 24));
+        out.push_back((Uint8)(value >> 16));
+        out.push_back((Uint8)(value >> 8));
+        out.push_back((Uint8)value);
+    }
+
+    void put(const Uint8* data, size_t size){
+        if(failed || size == 0) return;
+        if(sink) failed = !sink(data, size);
+        else if(fwrite(data, 1, size, file) != size) failed = true;
+    }
+
+    void writeChunk(const char* type, const Uint8* data, size_t size){
+        Uint8 header[8] = {(Uint8)(size >> 24), (Uint8)(size >> 16), (Uint8)(size >> 8), (Uint8)size, (Uint8)type[0], (Uint8)type[1], (Uint8)type[2], (Uint8)type[3]};
+        Uint32 crc = crc32Update(0, header + 4, 4);
+        crc = crc32Update(crc, data, size);
+        Uint8 trailer[4] = {(Uint8)(crc >> 24), (Uint8)(crc >> 16), (Uint8)(crc >> 8), (Uint8)crc};
+        put(header, 8);
+        put(data, size);
+        put(trailer, 4);
+    }
+
+    // Moves the compressed bytes into IDAT chunks, all of them if final
+    void emitCompressed(bool final){
+        const std::vector<Uint8> &out = deflate.output();
+        if(out.size() < IDAT_SIZE && !final) return;
+        chunk.clear();
+        if(!headerWritten){
+            chunk.push_back(0x78);    // zlib: deflate, 32K window
+            chunk.push_back(0x01);
+            headerWritten = true;
+        }
+        chunk.insert(chunk.end(), out.begin(), out.end());
+        if(final){
+            chunk.push_back((Uint8)(adler >> 24));
+            chunk.push_back((Uint8)(adler >> 16));
+            chunk.push_back((Uint8)(adler >> 8));
+            chunk.push_back((Uint8)adler);
+        }
+        deflate.clearOutput();
+        writeChunk("IDAT", chunk.data(), chunk.size());
+    }
+
+    // Residuals of the row under filter type; sub uses the pixel to the left, up the one above
+    void filterRow(int type){
+        std::vector<Uint8> &out = filtered[type];
+        out[0] = (Uint8)type;
+        const Uint8* c = current.data();
+        const Uint8* p = previous.data();
+        Uint8* f = out.data() + 1;
+        size_t n = current.size();
+        switch(type){
+            case 0:
+                std::copy(c, c + n, f);
+                break;
+            case 1:
+                for(size_t i = 0; i < n; ++i) f[i] = (Uint8)(c[i] - (i >= 4 ? c[i - 4] : 0));
+                break;
+            case 2:
+                for(size_t i = 0; i < n; ++i) f[i] = (Uint8)(c[i] - p[i]);
+                break;
+            case 3:
+                for(size_t i = 0; i < n; ++i) f[i] = (Uint8)(c[i] - ((i >= 4 ? c[i - 4] : 0) + p[i])/2);
+                break;
+            default:
+                for(size_t i = 0; i < n; ++i){
+                    int a = i >= 4 ? c[i - 4] : 0, b = p[i], d = i >= 4 ? p[i - 4] : 0;
+                    int pa = abs(b - d), pb = abs(a - d), pc = abs(a + b - 2*d);
+                    f[i] = (Uint8)(c[i] - ((pa <= pb && pa <= pc) ? a : pb <= pc ? b : d));
+                }
+                break;
+        }
+    }
+
+    bool writeHeader(int image_width, int image_height){
+        width = image_width;
+        height = image_height;
+        static const Uint8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        put(signature, 8);
+        std::vector<Uint8> ihdr;
+        putU32(ihdr, (Uint32)width);
+        putU32(ihdr, (Uint32)height);
+        ihdr.push_back(8);    // bit depth
+        ihdr.push_back(6);    // colour type RGBA
+        ihdr.push_back(0);    // deflate
+        ihdr.push_back(0);    // adaptive filtering
+        ihdr.push_back(0);    // no interlace
+        writeChunk("IHDR", ihdr.data(), ihdr.size());
+        previous.assign((size_t)width*4, 0);
+        current.resize((size_t)width*4);
+        for(auto &f: filtered) f.resize(1 + (size_t)width*4);
+        return !failed;
+    }
+
+public:
+    PNGWriter() = default;
+    ~PNGWriter(){if(file != nullptr) fclose(file);}
+    PNGWriter(const PNGWriter&) = delete;
+    PNGWriter& operator=(const PNGWriter&) = delete;
+
+    bool open(const char* path, int image_width, int image_height){
+        if(image_width <= 0 || image_height <= 0) return false;
+        file = fopen(path, "wb");
+        if(file == nullptr) return false;
+        return writeHeader(image_width, image_height);
+    }
+
+    bool open(PNGSink output, int image_width, int image_height){
+        if(image_width <= 0 || image_height <= 0 || !output) return false;
+        sink = std::move(output);
+        return writeHeader(image_width, image_height);
+    }
+
+    // Append one row of width SDL_PIXELFORMAT_RGBA8888 pixels
+    bool writeRow(const Uint32* pixels){
+        if((file == nullptr && !sink) || rowsWritten >= height) return false;
+        Uint8* out = current.data();
+        for(int x = 0; x < width; ++x){
+            Uint32 p = pixels[x];
+            out[4*x] = (Uint8)(p >> 24);
+            out[4*x + 1] = (Uint8)(p >> 16);
+            out[4*x + 2] = (Uint8)(p >> 8);
+            out[4*x + 3] = (Uint8)p;
+        }
+        // the usual heuristic: smallest sum of residuals taken as signed bytes
+        int best = 0;
+        Uint64 best_sum = ~(Uint64)0;
+        for(int type = 0; type < 5; ++type){
+            filterRow(type);
+            Uint64 sum = 0;
+            for(size_t i = 1; i < filtered[type].size(); ++i) sum += abs((int)(signed char)filtered[type][i]);
+            if(sum < best_sum){
+                best_sum = sum;
+                best = type;
+            }
+        }
+        const std::vector<Uint8> &row = filtered[best];
+        adler = adler32Update(adler, row.data(), row.size());
+        deflate.write(row.data(), row.size());
+        emitCompressed(false);
+        previous.swap(current);
+        ++rowsWritten;
+        return !failed;
+    }
+
+    // Writes the last block and IEND; false if any write failed or rows are missing
+    bool finish(){
+        if(file == nullptr && !sink) return false;
+        bool complete = rowsWritten == height;
+        if(complete){
+            deflate.finish();
+            emitCompressed(true);
+            writeChunk("IEND", nullptr, 0);
+        }
+        if(file != nullptr && fclose(file) != 0) failed = true;
+        file = nullptr;
+        sink = nullptr;
+        return complete && !failed;
+    }
+
+    int getRowsWritten(){return rowsWritten;}
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <SDL2/SDL.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class ResourcePool;
+
+typedef struct PoolStats{
+    Uint64 allocations{0};    // fresh buffers allocated
+    Uint64 reuses{0};         // leases served from the free lists
+    Uint64 bytes_allocated{0};
+    Uint64 live_leases{0};
+} PoolStats;
+
+// RAII handle to a pooled, SIMD aligned buffer; returned to the pool on destruction
+class BufferLease{
+private:
+    friend class ResourcePool;
+    ResourcePool* pool{nullptr};
+    void* data{nullptr};
+    size_t capacity{0};
+    BufferLease(ResourcePool* pool, void* data, size_t capacity): pool(pool), data(data), capacity(capacity){}
+
+public:
+    BufferLease() = default;
+    BufferLease(BufferLease &&other) noexcept: pool(other.pool), data(other.data), capacity(other.capacity){
+        other.pool = nullptr; other.data = nullptr; other.capacity = 0;
+    }
+    BufferLease& operator=(BufferLease &&other) noexcept;
+    BufferLease(const BufferLease&) = delete;
+    BufferLease& operator=(const BufferLease&) = delete;
+    ~BufferLease();
+
+    template<typename T> T* as(){return static_cast<T*>(data);}
+    void* get(){return data;}
+    size_t size(){return capacity;}
+    explicit operator bool(){return data != nullptr;}
+};
+
+// Size-bucketed free lists for the large, short-lived buffers of pixel
+// operations, so repeated fills, saves and snapshots stop allocating once warm.
+// Thread-safe.
+class ResourcePool{
+private:
+    friend class BufferLease;
+
+    std::mutex mutex;
+    std::map<size_t, std::vector<void*>> freeBuffers;
+    PoolStats stats;
+
+    static size_t bucketSize(size_t bytes){
+        size_t bucket = 4096;
+        while(bucket < bytes) bucket <<= 1;
+        return bucket;
+    }
+
+    void releaseBuffer(void* data, size_t capacity){
+        std::lock_guard<std::mutex> lock(mutex);
+        freeBuffers[capacity].push_back(data);
+        --stats.live_leases;
+    }
+
+public:
+    ResourcePool() = default;
+    ~ResourcePool(){trim();}
+    ResourcePool(const ResourcePool&) = delete;
+    ResourcePool& operator=(const ResourcePool&) = delete;
+
+    // Buffer of at least bytes, aligned for SIMD loads; contents are undefined
+    BufferLease acquireBuffer(size_t bytes){
+        size_t capacity = bucketSize(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = freeBuffers.find(capacity);
+            if(it != freeBuffers.end() && !it->second.empty()){
+                void* data = it->second.back();
+                it->second.pop_back();
+                ++stats.reuses;
+                ++stats.live_leases;
+                return BufferLease(this, data, capacity);
+            }
+        }
+        void* data = SDL_SIMDAlloc(capacity);
+        if(data == nullptr) return BufferLease();
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.allocations;
+        ++stats.live_leases;
+        stats.bytes_allocated += capacity;
+        return BufferLease(this, data, capacity);
+    }
+
+    // Free every idle resource (leased ones stay valid)
+    void trim(){
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto &bucket: freeBuffers) for(auto data: bucket.second) SDL_SIMDFree(data);
+        freeBuffers.clear();
+    }
+
+    PoolStats getStats(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+};
+
+inline BufferLease::~BufferLease(){
+    if(pool != nullptr && data != nullptr) pool->releaseBuffer(data, capacity);
+}
+inline BufferLease& BufferLease::operator=(BufferLease &&other) noexcept{
+    if(this != &other){
+        if(pool != nullptr && data != nullptr) pool->releaseBuffer(data, capacity);
+        pool = other.pool; data = other.data; capacity = other.capacity;
+        other.pool = nullptr; other.data = nullptr; other.capacity = 0;
+    }
+    return *this;
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include <SDL2/SDL.h>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// "Quite OK Image" format (qoiformat.org): every pixel is encoded in one pass
+// as a run, a reference to one of 64 recently seen colours, a small difference
+// to the previous pixel or the literal value. No compression library, no
+// filtering, no second pass, so saving and loading cost little more than a copy.
+const size_t QOI_HEADER_SIZE = 14;
+const Uint8 QOI_END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+enum QOIOp: Uint8{
+    QOI_OP_INDEX = 0x00,    // 2 bit tags
+    QOI_OP_DIFF  = 0x40,
+    QOI_OP_LUMA  = 0x80,
+    QOI_OP_RUN   = 0xC0,
+    QOI_OP_RGB   = 0xFE,    // 8 bit tags
+    QOI_OP_RGBA  = 0xFF
+};
+
+// Receives the encoded bytes when not writing to a file; false aborts the image
+typedef std::function<bool(const Uint8*, size_t)> QOISink;
+
+// SDL_PIXELFORMAT_RGBA8888 is 0xRRGGBBAA, so the hash reads the channels straight from the pixel
+inline int qoiHash(Uint32 p){
+    return (int)(((p >> 24)*3 + ((p >> 16) & 0xFF)*5 + ((p >> 8) & 0xFF)*7 + (p & 0xFF)*11) % 64);
+}
+
+// Streaming encoder: rows go to the file (or sink) as they come, through a small buffer
+class QOIWriter{
+private:
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+    FILE* file{nullptr};
+    QOISink sink;
+    int width{0}, height{0};
+    int rowsWritten{0};
+    bool failed{false};
+    Uint32 index[64];
+    Uint32 previous{0x000000FF};
+    int run{0};
+    std::vector<Uint8> buffer;
+
+    void flush(){
+        if(!failed && !buffer.empty()){
+            if(file != nullptr) failed = fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size();
+            else failed = !sink(buffer.data(), buffer.size());
+        }
+        buffer.clear();
+    }
+
+    bool writeHeader(int image_width, int image_height){
+        width = image_width;
+        height = image_height;
+        memset(index, 0, sizeof(index));
+        buffer.reserve(BUFFER_SIZE + 5*(size_t)width + QOI_HEADER_SIZE);
+        buffer.insert(buffer.end(), {'q', 'o', 'i', 'f'});
+        putU32(buffer, (Uint32)width);
+        putU32(buffer, (Uint32)height);
+        buffer.push_back(4);    // RGBA
+        buffer.push_back(0);    // sRGB with linear alpha
+        return true;
+    }
+
+    static void putU32(std::vector<Uint8> &out, Uint32 value){
+        out.push_back((Uint8)(value >> 24));
+        out.push_back((Uint8)(value >> 16));
+        out.push_back((Uint8)(value >> 8));
+        out.push_back((Uint8)value);
+    }
+
+public:
+    QOIWriter() = default;
+    ~QOIWriter(){if(file != nullptr) fclose(file);}
+    QOIWriter(const QOIWriter&) = delete;
+    QOIWriter& operator=(const QOIWriter&) = delete;
+
+    bool open(const char* path, int image_width, int image_height){
+        if(image_width <= 0 || image_height <= 0) return false;
+        file = fopen(path, "wb");
+        if(file == nullptr) return false;
+        return writeHeader(image_width, image_height);
+    }
+
+    bool open(QOISink output, int image_width, int image_height){
+        if(image_width <= 0 || image_height <= 0 || !output) return false;
+        sink = std::move(output);
+        return writeHeader(image_width, image_height);
+    }
+
+    // Append one row of width SDL_PIXELFORMAT_RGBA8888 pixels
+    bool writeRow(const Uint32* pixels){
+        if((file == nullptr && !sink) || rowsWritten >= height) return false;
+        bool last_row = ++rowsWritten == height;
+        for(int x = 0; x < width; ++x){
+            Uint32 p = pixels[x];
+            if(p == previous){
+                // runs carry on across rows; the last pixel ends any open one
+                if(++run == 62 || (last_row && x == width - 1)){
+                    buffer.push_back((Uint8)(QOI_OP_RUN | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if(run > 0){
+                buffer.push_back((Uint8)(QOI_OP_RUN | (run - 1)));
+                run = 0;
+            }
+            int hash = qoiHash(p);
+            if(index[hash] == p) buffer.push_back((Uint8)(QOI_OP_INDEX | hash));
+            else{
+                index[hash] = p;
+                if((p & 0xFF) == (previous & 0xFF)){
+                    signed char dr = (signed char)((p >> 24) - (previous >> 24));
+                    signed char dg = (signed char)((p >> 16) - (previous >> 16));
+                    signed char db = (signed char)((p >> 8) - (previous >> 8));
+                    signed char dr_dg = (signed char)(dr - dg), db_dg = (signed char)(db - dg);
+                    if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1){
+                        buffer.push_back((Uint8)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                    }
+                    else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7){
+                        buffer.push_back((Uint8)(QOI_OP_LUMA | (dg + 32)));
+                        buffer.push_back((Uint8)((dr_dg + 8) << 4 | (db_dg + 8)));
+                    }
+                    else buffer.insert(buffer.end(), {QOI_OP_RGB, (Uint8)(p >> 24), (Uint8)(p >> 16), (Uint8)(p >> 8)});
+                }
+                else buffer.insert(buffer.end(), {QOI_OP_RGBA, (Uint8)(p >> 24), (Uint8)(p >> 16), (Uint8)(p >> 8), (Uint8)p});
+            }
+            previous = p;
+        }
+        if(buffer.size() >= BUFFER_SIZE) flush();
+        return !failed;
+    }
+
+    // Writes the end marker; false if any write failed or rows are missing
+    bool finish(){
+        if(file == nullptr && !sink) return false;
+        bool complete = rowsWritten == height;
+        if(complete){
+            buffer.insert(buffer.end(), QOI_END_MARKER, QOI_END_MARKER + 8);
+            flush();
+        }
+        if(file != nullptr && fclose(file) != 0) failed = true;
+        file = nullptr;
+        sink = nullptr;
+        return complete && !failed;
+    }
+};
+
+inline bool saveQOI(const char* path, const Uint32* pixels, int width, int height){
+    QOIWriter writer;
+    if(!writer.open(path, width, height)) return false;
+    for(int y = 0; y < height; ++y) writer.writeRow(pixels + (size_t)y*width);
+    return writer.finish();
+}
+
+// Decodes a QOI file into a new SDL_PIXELFORMAT_RGBA8888 surface; null with
+// SDL_GetError() set if the file can't be read or is damaged
+inline SDL_Surface* loadQOI(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr){
+        SDL_SetError("Cannot open %s", path);
+        return nullptr;
+    }
+    std::vector<Uint8> data;
+    Uint8 chunk[1 << 16];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), file)) > 0) data.insert(data.end(), chunk, chunk + n);
+    fclose(file);
+
+    auto get32 = [&data](size_t at){return (Uint32)data[at] << 24 | (Uint32)data[at + 1] << 16 | (Uint32)data[at + 2] << 8 | data[at + 3];};
+    if(data.size() < QOI_HEADER_SIZE + 8 || memcmp(data.data(), "qoif", 4) != 0){
+        SDL_SetError("%s is not a QOI image", path);
+        return nullptr;
+    }
+    Uint32 width = get32(4), height = get32(8);
+    if(width == 0 || height == 0 || width > 32768 || height > 32768){
+        SDL_SetError("%s: unsupported size %ux%u", path, width, height);
+        return nullptr;
+    }
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, (int)width, (int)height, 32, SDL_PIXELFORMAT_RGBA8888);
+    if(surface == nullptr) return nullptr;
+
+    Uint32 index[64] = {};
+    Uint32 p = 0x000000FF;
+    int run = 0;
+    size_t pos = QOI_HEADER_SIZE, end = data.size() - 8;    // the end marker never starts a chunk
+    for(Uint32 y = 0; y < height; ++y){
+        Uint32* out = reinterpret_cast<Uint32*>(static_cast<Uint8*>(surface->pixels) + (size_t)y*surface->pitch);
+        for(Uint32 x = 0; x < width; ++x){
+            if(run > 0){
+                --run;
+                out[x] = p;
+                continue;
+            }
+            if(pos >= end){
+                SDL_FreeSurface(surface);
+                SDL_SetError("%s is truncated", path);
+                return nullptr;
+            }
+            Uint8 b = data[pos++];
+            size_t operands = b == QOI_OP_RGB ? 3 : b == QOI_OP_RGBA ? 4 : (b & 0xC0) == QOI_OP_LUMA ? 1 : 0;
+            if(end - pos < operands){
+                SDL_FreeSurface(surface);
+                SDL_SetError("%s is truncated", path);
+                return nullptr;
+            }
+            if(b == QOI_OP_RGB){
+                p = (Uint32)data[pos] << 24 | (Uint32)data[pos + 1] << 16 | (Uint32)data[pos + 2] << 8 | (p & 0xFF);
+                pos += 3;
+            }
+            else if(b == QOI_OP_RGBA){
+                p = get32(pos);
+                pos += 4;
+            }
+            else if((b & 0xC0) == QOI_OP_INDEX) p = index[b];
+            else if((b & 0xC0) == QOI_OP_DIFF){
+                Uint8 r = (Uint8)((p >> 24) + ((b >> 4) & 3) - 2), g = (Uint8)((p >> 16) + ((b >> 2) & 3) - 2), bl = (Uint8)((p >> 8) + (b & 3) - 2);
+                p = (Uint32)r << 24 | (Uint32)g << 16 | (Uint32)bl << 8 | (p & 0xFF);
+            }
+            else if((b & 0xC0) == QOI_OP_LUMA){
+                int dg = (b & 0x3F) - 32;
+                Uint8 second = data[pos++];
+                Uint8 r = (Uint8)((p >> 24) + dg - 8 + (second >> 4)), g = (Uint8)((p >> 16) + dg), bl = (Uint8)((p >> 8) + dg - 8 + (second & 0x0F));
+                p = (Uint32)r << 24 | (Uint32)g << 16 | (Uint32)bl << 8 | (p & 0xFF);
+            }
+            else run = b & 0x3F;    // QOI_OP_RUN
+            index[qoiHash(p)] = p;
+            out[x] = p;
+        }
+    }
+    return surface;
+}
+
+#endif
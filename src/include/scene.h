@@ -0,0 +1,406 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "vec2.h"
+#include "shape.h"
+#include "canvas.h"
+#include "arena.h"
+#include "line.h"
+#include "brush.h"
+#include "curvefit.h"
+#include "bvh.h"
+
+enum class SceneObjectType: int{
+    RECT,
+    ELLIPSE,
+    LINE,
+    STROKE,
+    NUM_TYPES
+};
+
+const double SCENE_FLATTEN_TOLERANCE = 0.25;    // pixels, when a stroke curve is turned back into brush positions
+const double SCENE_HIT_SLOP = 3.0;              // pixels of tolerance when picking thin outlines, lines and strokes
+
+// A committed shape or stroke kept as geometry rather than pixels
+typedef struct SceneObject{
+    SceneObjectType type{SceneObjectType::RECT};
+    vec2 pos;                         // centre of rects and ellipses
+    vec2 size;                        // width/height of rects, radii of ellipses
+    vec2 a, b;                        // end points of lines
+    StrokeStyle style;                // lines
+    std::vector<CubicBezier> curve;   // strokes
+    BrushSettings brush;              // strokes
+    SDL_Color fill_color{255, 255, 255, 255};
+    SDL_Color outline_color{0, 0, 0, 255};    // also the colour of lines and strokes
+    bool filled{true};
+    bool outlined{true};
+} SceneObject;
+
+inline SceneObject makeRectObject(Rect &rect){
+    SceneObject object;
+    object.type = SceneObjectType::RECT;
+    object.pos = rect.getPos();
+    object.size = vec2(rect.getWidth(), rect.getHeight());
+    object.fill_color = rect.getFillColor();
+    object.outline_color = rect.getOutlineColor();
+    object.filled = rect.isFilled();
+    object.outlined = rect.isOutlined();
+    return object;
+}
+
+inline SceneObject makeEllipseObject(Ellipse &ellipse){
+    SceneObject object;
+    object.type = SceneObjectType::ELLIPSE;
+    object.pos = ellipse.getPos();
+    object.size = ellipse.getRadii();
+    object.fill_color = ellipse.getFillColor();
+    object.outline_color = ellipse.getOutlineColor();
+    object.filled = ellipse.isFilled();
+    object.outlined = ellipse.isOutlined();
+    return object;
+}
+
+inline SceneObject makeLineObject(vec2 a, vec2 b, const StrokeStyle &style, SDL_Color color){
+    SceneObject object;
+    object.type = SceneObjectType::LINE;
+    object.a = a;
+    object.b = b;
+    object.style = style;
+    object.outline_color = color;
+    return object;
+}
+
+inline SceneObject makeStrokeObject(std::vector<CubicBezier> curve, const BrushSettings &brush, SDL_Color color){
+    SceneObject object;
+    object.type = SceneObjectType::STROKE;
+    object.curve = std::move(curve);
+    object.brush = brush;
+    object.outline_color = color;
+    return object;
+}
+
+// Every pixel the object can touch when rasterized at scale 1
+inline SDL_Rect sceneObjectBounds(const SceneObject &object){
+    double min_x, min_y, max_x, max_y;
+    switch(object.type){
+        case SceneObjectType::RECT:
+            min_x = object.pos.x - object.size.x/2; max_x = object.pos.x + object.size.x/2;
+            min_y = object.pos.y - object.size.y/2; max_y = object.pos.y + object.size.y/2;
+            break;
+        case SceneObjectType::ELLIPSE:
+            min_x = object.pos.x - object.size.x; max_x = object.pos.x + object.size.x;
+            min_y = object.pos.y - object.size.y; max_y = object.pos.y + object.size.y;
+            break;
+        case SceneObjectType::LINE:{
+            double r = std::max(object.style.width, 0.5)/2*M_SQRT2;    // corners of square caps
+            min_x = std::min(object.a.x, object.b.x) - r; max_x = std::max(object.a.x, object.b.x) + r;
+            min_y = std::min(object.a.y, object.b.y) - r; max_y = std::max(object.a.y, object.b.y) + r;
+            break;
+        }
+        default:{
+            // a Bezier segment lies inside the hull of its control points
+            min_x = min_y = 1e18; max_x = max_y = -1e18;
+            for(auto &segment: object.curve){
+                for(const vec2 &p: {segment.p0, segment.p1, segment.p2, segment.p3}){
+                    min_x = std::min(min_x, p.x); max_x = std::max(max_x, p.x);
+                    min_y = std::min(min_y, p.y); max_y = std::max(max_y, p.y);
+                }
+            }
+            if(object.curve.empty()) min_x = min_y = max_x = max_y = 0;
+            double r = object.brush.size/2 + 1;
+            min_x -= r; min_y -= r; max_x += r; max_y += r;
+            break;
+        }
+    }
+    int x0 = (int)floor(min_x) - 2, y0 = (int)floor(min_y) - 2;
+    return {x0, y0, (int)ceil(max_x) + 3 - x0, (int)ceil(max_y) + 3 - y0};
+}
+
+inline double distanceToSegment(vec2 p, vec2 a, vec2 b){
+    vec2 ab = b - a;
+    double len_sq = sqnorm(ab);
+    double t = len_sq > 0 ? std::clamp(dot(p - a, ab)/len_sq, 0.0, 1.0) : 0.0;
+    return norm(p - (a + t*ab));
+}
+
+// Per-thread scratch state for rasterizing objects
+typedef struct SceneRasterizer{
+    BrushEngine brush;
+    StrokeArena scratch;
+    std::vector<vec2> flattened;
+} SceneRasterizer;
+
+// The object as it appears when the scene is scaled by scale and offset is the
+// top left corner of the target, in scaled pixels
+inline SceneObject scaleSceneObject(SceneObject object, double scale, vec2 offset){
+    auto map = [&](vec2 p){return scale*p - offset;};
+    object.pos = map(object.pos);
+    object.size = scale*object.size;
+    object.a = map(object.a);
+    object.b = map(object.b);
+    object.style.width *= scale;
+    for(auto &segment: object.curve){
+        segment.p0 = map(segment.p0);
+        segment.p1 = map(segment.p1);
+        segment.p2 = map(segment.p2);
+        segment.p3 = map(segment.p3);
+    }
+    object.brush.size *= scale;
+    return object;
+}
+
+// Draws one object into canvas (clipped to the canvas clip)
+inline void rasterizeSceneObject(Canvas &canvas, const SceneObject &object, SceneRasterizer &rasterizer){
+    switch(object.type){
+        case SceneObjectType::RECT:{
+            Rect rect(object.pos, object.size.x, object.size.y);
+            rect.setFillColor(object.fill_color);
+            rect.setOutlineColor(object.outline_color);
+            if(object.filled) rect.enableFill(); else rect.disableFill();
+            if(object.outlined) rect.enableOutline(); else rect.disableOutline();
+            rect.draw(canvas);
+            break;
+        }
+        case SceneObjectType::ELLIPSE:{
+            Ellipse ellipse(object.pos, object.size);
+            ellipse.setFillColor(object.fill_color);
+            ellipse.setOutlineColor(object.outline_color);
+            if(object.filled) ellipse.enableFill(); else ellipse.disableFill();
+            if(object.outlined) ellipse.enableOutline(); else ellipse.disableOutline();
+            ellipse.draw(canvas);
+            break;
+        }
+        case SceneObjectType::LINE:
+            drawLine(canvas, object.a, object.b, object.style, object.outline_color, rasterizer.scratch);
+            rasterizer.scratch.reset();
+            break;
+        default:{
+            if(object.curve.empty()) break;
+            rasterizer.flattened.clear();
+            flattenBezierPath(object.curve, SCENE_FLATTEN_TOLERANCE, rasterizer.flattened);
+            rasterizer.brush.settings = object.brush;
+            rasterizer.brush.begin(canvas, rasterizer.flattened[0], object.outline_color);
+            for(size_t i = 1; i < rasterizer.flattened.size(); ++i) rasterizer.brush.strokeTo(canvas, rasterizer.flattened[i], object.outline_color);
+            break;
+        }
+    }
+}
+
+// Retained vector mode: committed shapes and strokes stay objects drawn in id
+// (= z) order over a background image. An AABB tree over their footprints makes
+// picking and damage O(log n), so editing one object only re-rasterizes the
+// pixels it covered before and after the change.
+class Scene{
+private:
+    int width, height;
+    std::vector<Uint32> background;
+    std::vector<SceneObject> objects;
+    std::vector<int> leaves;    // AABB tree leaf of every object, -1 once removed
+    AABBTree tree;
+    SceneRasterizer rasterizer;
+    std::vector<vec2> flattened;
+    std::vector<int> hits;
+
+    static AABB toAABB(SDL_Rect rect){
+        return {(float)rect.x, (float)rect.y, (float)(rect.x + rect.w), (float)(rect.y + rect.h)};
+    }
+
+    bool hitObject(const SceneObject &object, vec2 p){
+        switch(object.type){
+            case SceneObjectType::RECT:{
+                vec2 d(fabs(p.x - object.pos.x), fabs(p.y - object.pos.y));
+                vec2 half = 0.5*object.size;
+                if(object.filled && d.x <= half.x && d.y <= half.y) return true;
+                if(!object.outlined) return false;
+                bool inside_outer = d.x <= half.x + SCENE_HIT_SLOP && d.y <= half.y + SCENE_HIT_SLOP;
+                bool inside_inner = d.x < half.x - SCENE_HIT_SLOP && d.y < half.y - SCENE_HIT_SLOP;
+                return inside_outer && !inside_inner;
+            }
+            case SceneObjectType::ELLIPSE:{
+                if(object.size.x <= 0 || object.size.y <= 0) return false;
+                vec2 d = p - object.pos;
+                double k = sqrt((d.x*d.x)/(object.size.x*object.size.x) + (d.y*d.y)/(object.size.y*object.size.y));
+                if(object.filled && k <= 1) return true;
+                // distance to the outline, approximated along the ray from the centre
+                return object.outlined && fabs(k - 1)*norm(d)/std::max(k, 1e-9) <= SCENE_HIT_SLOP;
+            }
+            case SceneObjectType::LINE:
+                return distanceToSegment(p, object.a, object.b) <= std::max(object.style.width/2, SCENE_HIT_SLOP);
+            default:{
+                flattened.clear();
+                flattenBezierPath(object.curve, 1.0, flattened);
+                double reach = std::max(object.brush.size/2, SCENE_HIT_SLOP);
+                if(flattened.size() == 1) return norm(p - flattened[0]) <= reach;
+                for(size_t i = 0; i + 1 < flattened.size(); ++i) if(distanceToSegment(p, flattened[i], flattened[i+1]) <= reach) return true;
+                return false;
+            }
+        }
+    }
+
+public:
+    Scene(int width, int height): width(width), height(height), background((size_t)width*height, 0xFFFFFFFF){}
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+
+    int getWidth(){return width;}
+    int getHeight(){return height;}
+    const Uint32* getBackground(){return background.data();}
+
+    // Start over with pixels (width*height) as the image under every object
+    void reset(const Uint32* pixels){
+        std::copy(pixels, pixels + background.size(), background.begin());
+        objects.clear();
+        leaves.clear();
+        tree.clear();
+    }
+
+    // Draws one object into canvas at scale 1 (clipped to the canvas clip)
+    void renderObject(Canvas &canvas, const SceneObject &object){
+        rasterizeSceneObject(canvas, object, rasterizer);
+    }
+
+    // Re-rasterize region from the background and the objects overlapping it
+    void renderRegion(Canvas &canvas, SDL_Rect region){
+        SDL_Rect bounds = {0, 0, width, height};
+        if(!SDL_IntersectRect(&region, &bounds, &region)) return;
+        canvas.loadRegion(background.data(), region);
+        hits.clear();
+        tree.query(toAABB(region), [this](int id){hits.push_back(id);});
+        std::sort(hits.begin(), hits.end());
+        canvas.setClip(region);
+        for(int id: hits) renderObject(canvas, objects[id]);
+        canvas.resetClip();
+        canvas.markDirty(region);
+    }
+
+    // Renders the scene scaled by scale into tile, whose top left corner is at
+    // origin in scaled pixels. The background is resampled bilinearly, objects
+    // are rasterized at the new size. Const apart from rasterizer, so tiles can
+    // be rendered in parallel with one rasterizer per thread.
+    void renderTile(Canvas &tile, double scale, SDL_Point origin, SceneRasterizer &tile_rasterizer) const{
+        int tile_w = tile.getWidth(), tile_h = tile.getHeight();
+        std::vector<int> src_x0(tile_w);
+        std::vector<Uint32> weight_x(tile_w);
+        for(int x = 0; x < tile_w; ++x){
+            double u = std::clamp((origin.x + x + 0.5)/scale - 0.5, 0.0, (double)width - 1);
+            src_x0[x] = std::min((int)u, width - 2 < 0 ? 0 : width - 2);
+            weight_x[x] = (Uint32)((u - src_x0[x])*256 + 0.5);
+        }
+        for(int y = 0; y < tile_h; ++y){
+            double v = std::clamp((origin.y + y + 0.5)/scale - 0.5, 0.0, (double)height - 1);
+            int src_y0 = std::min((int)v, height - 2 < 0 ? 0 : height - 2);
+            Uint32 wy = (Uint32)((v - src_y0)*256 + 0.5);
+            const Uint32* row0 = background.data() + (size_t)src_y0*width;
+            const Uint32* row1 = height > 1 ? row0 + width : row0;
+            Uint32* out = tile.getRow(y);
+            for(int x = 0; x < tile_w; ++x){
+                int sx = src_x0[x];
+                int sx1 = width > 1 ? sx + 1 : sx;
+                Uint32 wx = weight_x[x];
+                Uint32 pixel = 0;
+                for(int shift = 0; shift < 32; shift += 8){
+                    Uint32 top = ((row0[sx] >> shift) & 0xFF)*(256 - wx) + ((row0[sx1] >> shift) & 0xFF)*wx;
+                    Uint32 bottom = ((row1[sx] >> shift) & 0xFF)*(256 - wx) + ((row1[sx1] >> shift) & 0xFF)*wx;
+                    pixel |= (((top*(256 - wy) + bottom*wy + 32768) >> 16) & 0xFF) << shift;
+                }
+                out[x] = pixel;
+            }
+        }
+        tile.markAllDirty();
+
+        AABB area = {(float)(origin.x/scale - 1), (float)(origin.y/scale - 1), (float)((origin.x + tile_w)/scale + 1), (float)((origin.y + tile_h)/scale + 1)};
+        std::vector<int> found;
+        tree.query(area, [&found](int id){found.push_back(id);});
+        std::sort(found.begin(), found.end());
+        vec2 offset(origin.x, origin.y);
+        for(int id: found) rasterizeSceneObject(tile, scaleSceneObject(objects[id], scale, offset), tile_rasterizer);
+    }
+
+    // Appends object on top of everything; the caller draws it (renderObject)
+    int add(SceneObject object){
+        int id = (int)objects.size();
+        leaves.push_back(tree.insert(toAABB(sceneObjectBounds(object)), id));
+        objects.push_back(std::move(object));
+        return id;
+    }
+
+    // Raw state change without drawing, for undo/redo where the canvas comes from a snapshot
+    void restore(int id, const SceneObject &object, bool alive){
+        if(id >= (int)objects.size()){
+            objects.resize(id + 1);
+            leaves.resize(id + 1, -1);
+        }
+        objects[id] = object;
+        if(leaves[id] >= 0 && alive) tree.move(leaves[id], toAABB(sceneObjectBounds(object)));
+        else if(leaves[id] >= 0){tree.remove(leaves[id]); leaves[id] = -1;}
+        else if(alive) leaves[id] = tree.insert(toAABB(sceneObjectBounds(object)), id);
+    }
+
+    // Replace an object (move, recolour) and redraw its old and new footprint
+    void update(Canvas &canvas, int id, SceneObject object){
+        if(!isAlive(id)) return;
+        SDL_Rect old_bounds = sceneObjectBounds(objects[id]);
+        SDL_Rect new_bounds = sceneObjectBounds(object);
+        objects[id] = std::move(object);
+        tree.move(leaves[id], toAABB(new_bounds));
+        SDL_Rect overlap;
+        if(SDL_IntersectRect(&old_bounds, &new_bounds, &overlap)){
+            SDL_UnionRect(&old_bounds, &new_bounds, &old_bounds);
+            renderRegion(canvas, old_bounds);
+        }
+        else{
+            renderRegion(canvas, old_bounds);
+            renderRegion(canvas, new_bounds);
+        }
+    }
+
+    void remove(Canvas &canvas, int id){
+        if(!isAlive(id)) return;
+        tree.remove(leaves[id]);
+        leaves[id] = -1;
+        renderRegion(canvas, sceneObjectBounds(objects[id]));
+    }
+
+    // Topmost live object under p, -1 if none
+    int hitTest(vec2 p){
+        int best = -1;
+        tree.queryPoint((float)p.x, (float)p.y, [&](int id){
+            if(id > best && hitObject(objects[id], p)) best = id;
+        });
+        return best;
+    }
+
+    bool isAlive(int id){return id >= 0 && id < (int)leaves.size() && leaves[id] >= 0;}
+    const SceneObject &get(int id){return objects[id];}
+    int size(){return tree.size();}
+    int treeHeight(){return tree.height();}
+
+    // Calls fn(object) for the live objects overlapping rect, in z order
+    template<typename Fn>
+    void forEach(SDL_Rect rect, Fn fn){
+        std::vector<int> found;
+        tree.query(toAABB(rect), [&](int id){found.push_back(id);});
+        std::sort(found.begin(), found.end());
+        for(int id: found) fn(objects[id]);
+    }
+};
+
+// The same object shifted by delta
+inline SceneObject translateSceneObject(SceneObject object, vec2 delta){
+    object.pos = object.pos + delta;
+    object.a = object.a + delta;
+    object.b = object.b + delta;
+    for(auto &segment: object.curve){
+        segment.p0 = segment.p0 + delta;
+        segment.p1 = segment.p1 + delta;
+        segment.p2 = segment.p2 + delta;
+        segment.p3 = segment.p3 + delta;
+    }
+    return object;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <SDL2/SDL.h>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Return type of a cooperatively time-sliced operation. The coroutine starts
+// suspended and only runs when the Scheduler resumes it.
+class SlicedTask{
+public:
+    struct promise_type{
+        std::exception_ptr exception;
+        SlicedTask get_return_object(){return SlicedTask(std::coroutine_handle<promise_type>::from_promise(*this));}
+        std::suspend_always initial_suspend() noexcept{return {};}
+        std::suspend_always final_suspend() noexcept{return {};}
+        void return_void(){}
+        void unhandled_exception(){exception = std::current_exception();}
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle{nullptr};
+
+public:
+    SlicedTask() = default;
+    explicit SlicedTask(std::coroutine_handle<promise_type> handle): handle(handle){}
+    SlicedTask(SlicedTask &&other) noexcept: handle(other.handle){other.handle = nullptr;}
+    SlicedTask& operator=(SlicedTask &&other) noexcept{
+        if(this != &other){
+            if(handle) handle.destroy();
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+    SlicedTask(const SlicedTask&) = delete;
+    SlicedTask& operator=(const SlicedTask&) = delete;
+    ~SlicedTask(){if(handle) handle.destroy();}
+
+    bool valid(){return handle != nullptr;}
+    bool done(){return !handle || handle.done();}
+    void resume(){
+        if(done()) return;
+        handle.resume();
+        if(handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+    }
+};
+
+// Handed to a sliced operation: tells it when its share of the frame is used
+// up, carries its progress and whether the user asked to cancel it.
+class TimeSlice{
+private:
+    friend class Scheduler;
+    Uint64 deadline{0};
+    double progress{0.0};
+    bool cancelRequested{false};
+    bool waiting{false};    // parked until the next frame
+
+public:
+    struct Awaiter{
+        bool ready;
+        bool await_ready() noexcept{return ready;}
+        void await_suspend(std::coroutine_handle<>) noexcept{}
+        void await_resume() noexcept{}
+    };
+
+    bool expired(){return SDL_GetPerformanceCounter() >= deadline;}
+    bool cancelled(){return cancelRequested;}
+    double getProgress(){return progress;}
+    void setProgress(double progress){this->progress = progress;}
+
+    // co_await slice.yield(p): suspends only if the frame budget is spent;
+    // the operation must check cancelled() afterwards
+    Awaiter yield(double progress){
+        this->progress = progress;
+        return {cancelRequested || !expired()};
+    }
+
+    // co_await slice.wait(p): always suspends until the next frame, for an
+    // operation polling work done on another thread
+    Awaiter wait(double progress){
+        this->progress = progress;
+        waiting = !cancelRequested;
+        return {cancelRequested};
+    }
+};
+
+// Runs sliced operations from the main loop, a fixed time budget per frame.
+// Everything runs on the calling thread, so it works the same on one core.
+class Scheduler{
+private:
+    struct Job{
+        std::string label;
+        std::unique_ptr<TimeSlice> slice;
+        SlicedTask task;
+        std::function<void(bool)> onDone;    // argument: completed (false if cancelled)
+    };
+    std::vector<Job> jobs;
+
+public:
+    // make_task receives the TimeSlice the operation has to yield on
+    void start(const std::string &label, const std::function<SlicedTask(TimeSlice&)> &make_task, std::function<void(bool)> on_done = nullptr){
+        Job job;
+        job.label = label;
+        job.slice = std::make_unique<TimeSlice>();
+        job.task = make_task(*job.slice);
+        job.onDone = std::move(on_done);
+        jobs.push_back(std::move(job));
+    }
+
+    bool busy(){return !jobs.empty();}
+
+    // label and progress of the oldest running operation
+    std::string currentLabel(){return jobs.empty() ? "" : jobs.front().label;}
+    double currentProgress(){return jobs.empty() ? 1.0 : jobs.front().slice->getProgress();}
+
+    void cancelAll(){
+        for(auto &job: jobs) job.slice->cancelRequested = true;
+    }
+
+    // Resume pending operations round-robin until budget_ms has elapsed.
+    // Returns true if any operation finished during this call.
+    bool resume(double budget_ms){
+        if(jobs.empty()) return false;
+        Uint64 deadline = SDL_GetPerformanceCounter() + (Uint64)(budget_ms*SDL_GetPerformanceFrequency()/1000.0);
+        bool finished_any = false;
+        for(auto &job: jobs) job.slice->waiting = false;
+        do{
+            bool ran_any = false;
+            for(size_t i = 0; i < jobs.size();){
+                if(jobs[i].slice->waiting){
+                    ++i;
+                    continue;
+                }
+                ran_any = true;
+                jobs[i].slice->deadline = deadline;
+                jobs[i].task.resume();
+                if(jobs[i].task.done()){
+                    Job job = std::move(jobs[i]);
+                    jobs.erase(jobs.begin() + i);
+                    if(job.onDone) job.onDone(!job.slice->cancelled());
+                    finished_any = true;
+                }
+                else ++i;
+            }
+            if(!ran_any) break;
+        } while(!jobs.empty() && SDL_GetPerformanceCounter() < deadline);
+        return finished_any;
+    }
+};
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "brush.h"
+#include "canvas.h"
+#include "journal.h"
+#include "latency.h"
+#include "net.h"
+#include "png.h"
+#include "qoi.h"
+#include "scene.h"
+
+const int SERVICE_MAX_WORKERS = 64;
+const int SERVICE_QUEUE_PER_WORKER = 4;    // requests waiting per worker before connections stop being read
+const size_t SERVICE_MAX_UNSENT = (size_t)64 << 20;    // response bytes a client has not read yet before its connection stops being read
+const int SERVICE_MAX_SIDE = 8192;    // a worker keeps a canvas of up to 256 MB
+const int SERVICE_POLL_MS = 5;
+const int SERVICE_RATE_WINDOW_S = 10;    // recent throughput is taken over this many seconds
+
+enum class ServiceMessage: Uint8{
+    RENDER = 1,    // id, width, height, format, then records: op, size, journal payload
+    STATS          // id; answered with the metrics as "name value" lines, as of when it was read
+};
+
+enum class ServiceStatus: Uint8{
+    OK = 0,
+    BAD_REQUEST,    // the body is the reason, as text
+    FAILED
+};
+
+enum class RenderFormat: Uint8{
+    PNG = 0,
+    QOI
+};
+
+// What a worker keeps from one request to the next: the canvas (reallocated
+// only when the size changes), the brush with its cache of dab masks, the
+// shape rasterizer's buffers and the response buffer.
+struct RenderWorker{
+    std::unique_ptr<Canvas> canvas;
+    BrushEngine brush;
+    SceneRasterizer rasterizer;
+    std::vector<Uint8> response;
+};
+
+// Draws one journal record onto worker.canvas; false rejects the request
+typedef std::function<bool(RenderWorker&, JournalOp, JournalDecoder&)> RenderRecordFn;
+
+// Headless rendering daemon. Clients send batches of drawing operations (the
+// journal's records) and get the encoded image back. A network thread reads
+// requests and queues them; a fixed number of workers, each with warm state,
+// render and encode them and send the response themselves. Clients may
+// pipeline: requests on one connection are answered in the order they were
+// sent, whichever worker finishes first. Once the queue is full the network
+// thread stops reading, so a flood of requests waits in the clients' sockets
+// rather than in memory here; so do the requests of a client that does not
+// read its responses.
+class RenderService{
+private:
+    struct Client{
+        std::unique_ptr<NetConnection> connection;
+        Uint64 nextSequence{0};    // given to the next request read
+        Uint64 nextResponse{0};    // the response to send next
+        std::map<Uint64, std::vector<Uint8>> finished;    // responses that overtook an earlier one
+        size_t finishedBytes{0};
+
+        bool backedUp(){return connection->pendingOutput() + finishedBytes > SERVICE_MAX_UNSENT;}
+    };
+    struct Job{
+        std::shared_ptr<Client> client;
+        Uint64 sequence;
+        Uint64 arrived;
+        std::vector<Uint8> message;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread network;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping{false};
+    std::string address;
+    NetSocket listener{NET_INVALID_SOCKET};
+    RenderRecordFn drawRecord;
+    std::vector<std::shared_ptr<Client>> clients;
+    std::deque<Job> queue;
+    size_t maxQueued{0};
+    int busyWorkers{0};
+    // metrics, mutex held
+    Uint64 started{0};
+    Uint64 requests{0}, failed{0}, statsRequests{0}, pixelsRendered{0}, connectionsAccepted{0};
+    Uint64 bytesSent{0}, bytesReceived{0};    // of connections that are gone
+    LatencyHistogram latency, queued, rendering, encoding;
+    Uint64 recentCount[SERVICE_RATE_WINDOW_S] = {}, recentSecond[SERVICE_RATE_WINDOW_S] = {};
+
+    double elapsedMs(Uint64 from, Uint64 to){return (double)(to - from)*1000.0/SDL_GetPerformanceFrequency();}
+
+    static void responseHeader(std::vector<Uint8> &out, ServiceMessage kind, Uint32 id, ServiceStatus status){
+        out.clear();
+        out.push_back((Uint8)kind);
+        for(int s = 0; s < 32; s += 8) out.push_back((Uint8)(id >> s));
+        out.push_back((Uint8)status);
+    }
+
+    static void responseText(std::vector<Uint8> &out, ServiceMessage kind, Uint32 id, ServiceStatus status, const std::string &text){
+        responseHeader(out, kind, id, status);
+        out.insert(out.end(), text.begin(), text.end());
+    }
+
+    // mutex held: hands a response to the client in request order
+    void respond(Client &client, Uint64 sequence, std::vector<Uint8> &response){
+        if(sequence != client.nextResponse){
+            client.finished[sequence] = response;
+            client.finishedBytes += response.size();
+            return;
+        }
+        client.connection->queue(response.data(), response.size());
+        ++client.nextResponse;
+        for(auto it = client.finished.begin(); it != client.finished.end() && it->first == client.nextResponse; it = client.finished.erase(it)){
+            client.connection->queue(it->second.data(), it->second.size());
+            client.finishedBytes -= it->second.size();
+            ++client.nextResponse;
+        }
+        client.connection->flush();
+    }
+
+    // mutex held
+    void countCompletion(Uint64 arrived, Uint64 now){
+        latency.record(elapsedMs(arrived, now));
+        Uint64 second = (now - started)/SDL_GetPerformanceFrequency();
+        int slot = (int)(second % SERVICE_RATE_WINDOW_S);
+        if(recentSecond[slot] != second){
+            recentSecond[slot] = second;
+            recentCount[slot] = 0;
+        }
+        ++recentCount[slot];
+    }
+
+    // mutex held
+    std::string statsText(){
+        Uint64 now = SDL_GetPerformanceCounter();
+        double uptime = elapsedMs(started, now)/1000.0;
+        Uint64 second = (now - started)/SDL_GetPerformanceFrequency(), recent = 0;
+        for(int i = 0; i < SERVICE_RATE_WINDOW_S; ++i){
+            if(recentSecond[i] + SERVICE_RATE_WINDOW_S > second) recent += recentCount[i];
+        }
+        double window = std::min((double)SERVICE_RATE_WINDOW_S, std::max(uptime, 1e-3));
+        Uint64 sent = bytesSent, received = bytesReceived;
+        for(auto &client: clients){
+            sent += client->connection->bytesSent;
+            received += client->connection->bytesReceived;
+        }
+        char text[1024];
+        snprintf(text, sizeof(text),
+                 "uptime_s %.1f\nworkers %d\nbusy_workers %d\nqueued %zu\nconnections %zu\nconnections_accepted %llu\n"
+                 "requests %llu\nfailed %llu\nstats_requests %llu\nthroughput_rps %.1f\nrecent_rps %.1f\nmegapixels_per_s %.1f\n"
+                 "latency_ms_p50 %.1f\nlatency_ms_p95 %.1f\nlatency_ms_p99 %.1f\nlatency_ms_max %.1f\n"
+                 "queue_ms_mean %.2f\nrender_ms_mean %.2f\nencode_ms_mean %.2f\nbytes_in %llu\nbytes_out %llu\n",
+                 uptime, (int)workers.size(), busyWorkers, queue.size(), clients.size(), (unsigned long long)connectionsAccepted,
+                 (unsigned long long)requests, (unsigned long long)failed, (unsigned long long)statsRequests,
+                 requests/std::max(uptime, 1e-3), recent/window, pixelsRendered/1e6/std::max(uptime, 1e-3),
+                 latency.percentile(50), latency.percentile(95), latency.percentile(99), latency.getMax(),
+                 queued.getMean(), rendering.getMean(), encoding.getMean(), (unsigned long long)received, (unsigned long long)sent);
+        return text;
+    }
+
+    // Renders job into worker.response; false with the reason there if the request is malformed
+    bool render(RenderWorker &worker, const Job &job, double &render_ms, double &encode_ms){
+        JournalDecoder in(job.message.data(), job.message.size());
+        in.get8();
+        Uint32 id = in.get32();
+        int width = (int)in.get32(), height = (int)in.get32();
+        RenderFormat format = (RenderFormat)in.get8();
+        auto reject = [&worker, id](const std::string &reason){
+            responseText(worker.response, ServiceMessage::RENDER, id, ServiceStatus::BAD_REQUEST, reason);
+            return false;
+        };
+        if(!in.ok()) return reject("truncated header");
+        if(width <= 0 || height <= 0 || width > SERVICE_MAX_SIDE || height > SERVICE_MAX_SIDE) return reject("bad size");
+        if(format != RenderFormat::PNG && format != RenderFormat::QOI) return reject("unknown format");
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        if(!worker.canvas || worker.canvas->getWidth() != width || worker.canvas->getHeight() != height) worker.canvas = std::make_unique<Canvas>(width, height);
+        Canvas &canvas = *worker.canvas;
+        canvas.resetClip();
+        canvas.clear({255, 255, 255, 255});
+        for(int record = 0; !in.atEnd(); ++record){
+            JournalOp op = (JournalOp)in.get8();
+            Uint32 size = in.get32();
+            const Uint8* payload = in.getBytes(size);
+            if(payload == nullptr) return reject("truncated record " + std::to_string(record));
+            JournalDecoder record_in(payload, size);
+            if(!drawRecord(worker, op, record_in) || !record_in.ok()) return reject("bad record " + std::to_string(record));
+        }
+        Uint64 drawn = SDL_GetPerformanceCounter();
+
+        responseHeader(worker.response, ServiceMessage::RENDER, id, ServiceStatus::OK);
+        std::vector<Uint8> &out = worker.response;
+        auto sink = [&out](const Uint8* data, size_t size){
+            out.insert(out.end(), data, data + size);
+            return true;
+        };
+        bool encoded;
+        if(format == RenderFormat::QOI){
+            QOIWriter writer;
+            writer.open(sink, width, height);
+            for(int y = 0; y < height; ++y) writer.writeRow(canvas.getRow(y));
+            encoded = writer.finish();
+        }
+        else{
+            PNGWriter writer;
+            writer.open(sink, width, height);
+            for(int y = 0; y < height; ++y) writer.writeRow(canvas.getRow(y));
+            encoded = writer.finish();
+        }
+        if(!encoded) responseText(worker.response, ServiceMessage::RENDER, id, ServiceStatus::FAILED, "encoding failed");
+        render_ms = elapsedMs(start, drawn);
+        encode_ms = elapsedMs(drawn, SDL_GetPerformanceCounter());
+        return encoded;
+    }
+
+    void workerLoop(){
+        RenderWorker worker;
+        while(true){
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]{return stopping || !queue.empty();});
+                if(queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+                ++busyWorkers;
+                queued.record(elapsedMs(job.arrived, SDL_GetPerformanceCounter()));
+            }
+            double render_ms = 0.0, encode_ms = 0.0;
+            bool ok = render(worker, job, render_ms, encode_ms);
+            std::lock_guard<std::mutex> lock(mutex);
+            --busyWorkers;
+            respond(*job.client, job.sequence, worker.response);
+            ++requests;
+            if(!ok) ++failed;
+            else{
+                rendering.record(render_ms);
+                encoding.record(encode_ms);
+                pixelsRendered += (Uint64)worker.canvas->getWidth()*worker.canvas->getHeight();
+            }
+            countCompletion(job.arrived, SDL_GetPerformanceCounter());
+        }
+    }
+
+    // mutex held: takes complete requests off the connection while there is
+    // room in the queue and the client keeps up with reading its responses
+    void readRequests(const std::shared_ptr<Client> &client, std::vector<Uint8> &message){
+        while(queue.size() < maxQueued && !client->backedUp() && client->connection->nextMessage(message)){
+            Uint64 now = SDL_GetPerformanceCounter();
+            JournalDecoder in(message.data(), message.size());
+            ServiceMessage kind = (ServiceMessage)in.get8();
+            Uint32 id = in.get32();
+            Uint64 sequence = client->nextSequence++;
+            if(kind == ServiceMessage::RENDER && in.ok()){
+                queue.push_back({client, sequence, now, std::move(message)});
+                message = std::vector<Uint8>();
+                wake.notify_one();
+                continue;
+            }
+            std::vector<Uint8> response;
+            if(kind == ServiceMessage::STATS && in.ok()){
+                ++statsRequests;
+                responseText(response, kind, id, ServiceStatus::OK, statsText());
+            }
+            else responseText(response, kind, id, ServiceStatus::BAD_REQUEST, "unknown request");
+            respond(*client, sequence, response);
+        }
+    }
+
+    void networkLoop(){
+        std::vector<Uint8> message;
+        while(!stopping){
+            fd_set reads, writes;
+            FD_ZERO(&reads);
+            FD_ZERO(&writes);
+            NetSocket top = listener;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                FD_SET(listener, &reads);
+                bool room = queue.size() < maxQueued;
+                for(auto &client: clients){
+                    if(room && !client->backedUp()) FD_SET(client->connection->handle, &reads);
+                    if(client->connection->pendingOutput() > 0) FD_SET(client->connection->handle, &writes);
+                    top = std::max(top, client->connection->handle);
+                }
+            }
+            timeval timeout = {0, SERVICE_POLL_MS*1000};
+            if(select((int)top + 1, &reads, &writes, nullptr, &timeout) < 0) SDL_Delay(SERVICE_POLL_MS);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(FD_ISSET(listener, &reads)){
+                NetSocket s;
+                while((s = netAccept(listener)) != NET_INVALID_SOCKET){
+                    auto client = std::make_shared<Client>();
+                    client->connection = std::make_unique<NetConnection>(s);
+                    clients.push_back(client);
+                    ++connectionsAccepted;
+                }
+            }
+            for(auto &client: clients){
+                if(FD_ISSET(client->connection->handle, &reads)) client->connection->receive();
+                readRequests(client, message);    // also what was left while the queue was full
+                if(FD_ISSET(client->connection->handle, &writes)) client->connection->flush();
+            }
+            for(size_t i = 0; i < clients.size();){
+                if(!clients[i]->connection->closed){
+                    ++i;
+                    continue;
+                }
+                // queued requests of a client that left are still rendered, their responses dropped
+                bytesSent += clients[i]->connection->bytesSent;
+                bytesReceived += clients[i]->connection->bytesReceived;
+                clients.erase(clients.begin() + i);
+            }
+        }
+    }
+
+public:
+    RenderService() = default;
+    ~RenderService(){stop();}
+    RenderService(const RenderService&) = delete;
+    RenderService& operator=(const RenderService&) = delete;
+
+    // Listens at service_address (usually "unix:/path") with worker_count render threads
+    bool start(const std::string &service_address, int worker_count, RenderRecordFn draw_record){
+        listener = netListen(service_address);
+        if(listener == NET_INVALID_SOCKET) return false;
+        address = service_address;
+        drawRecord = std::move(draw_record);
+        worker_count = std::clamp(worker_count, 1, SERVICE_MAX_WORKERS);
+        maxQueued = (size_t)worker_count*SERVICE_QUEUE_PER_WORKER;
+        started = SDL_GetPerformanceCounter();
+        stopping = false;
+        for(int i = 0; i < worker_count; ++i) workers.emplace_back(&RenderService::workerLoop, this);
+        network = std::thread(&RenderService::networkLoop, this);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Render service: listening at %s with %d workers", address.c_str(), worker_count);
+        return true;
+    }
+
+    bool isRunning(){return network.joinable();}
+
+    // The stats response, for logging
+    std::string getStats(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return statsText();
+    }
+
+    // Finishes the queued requests, then closes every connection
+    void stop(){
+        if(!network.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        network.join();
+        wake.notify_all();
+        for(auto &worker: workers) worker.join();
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Render service stopped:\n%s", getStats().c_str());
+        workers.clear();
+        for(auto &client: clients) client->connection->flush();
+        clients.clear();
+        netClose(listener);
+        listener = NET_INVALID_SOCKET;
+        if(netIsUnixAddress(address)) remove(address.substr(5).c_str());
+    }
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <SDL2/SDL.h>
 #include "vec2.h"
+#include "canvas.h"
 #include <deque>
 
 class Shape{
@@ -62,6 +63,7 @@ public:
         pos = pos+vel; vel = vel+acc;
     }
     virtual void draw(SDL_Renderer* renderer) = 0;
+    virtual void draw(Canvas &canvas) = 0;    // rasterize into the CPU canvas
     void drawTrails(SDL_Renderer* renderer, std::deque<vec2> &trailsPos){
         auto prev_pos = pos;
         auto prev_fill_alpha = fillColor.a;
@@ -133,6 +135,10 @@ public:
             SDL_SetRenderDrawColor(renderer, prev_color.r, prev_color.g, prev_color.b, prev_color.a);    // restore previous draw color
         }
     }
+    void draw(Canvas &canvas) override{
+        if(isFill) canvas.fillRect(boundBox, fillColor);
+        if(hasOutline) canvas.drawRect(boundBox, outlineColor);
+    }
 
     static inline void drawRotatedFillRectangle(SDL_Renderer* renderer, SDL_FPoint center, double width, double height, double angle, SDL_Color fill_color){
         SDL_FRect rect;
@@ -148,6 +154,7 @@ public:
         SDL_RenderClear(renderer);
         SDL_SetRenderTarget(renderer, render_target);
         SDL_RenderCopyExF(renderer, texture, nullptr, &rect, angle, nullptr, SDL_FLIP_NONE);
+        SDL_DestroyTexture(texture);
         return;
     }
 };
@@ -253,6 +260,10 @@ public:
         if(isFill) drawEllipseSolid(renderer, fillColor, boundBox);
         if(hasOutline) drawEllipse(renderer, outlineColor, pos, radius);
     }
+    void draw(Canvas &canvas) override{
+        if(isFill) canvas.fillEllipse(pos, radius, fillColor);
+        if(hasOutline) canvas.drawEllipse(pos, radius, outlineColor);
+    }
 };
 
 #endif
\ No newline at end of file
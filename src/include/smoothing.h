@@ -0,0 +1,125 @@
+#ifndef SMOOTHING_H
+#define SMOOTHING_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cmath>
+#include "vec2.h"
+#include "input.h"
+
+enum class SmoothingMode: int{
+    NONE,
+    EMA,              // exponential moving average with a time constant
+    PULLED_STRING,    // the pen trails the cursor on a string of fixed length
+    NUM_MODES
+};
+
+inline const char* smoothingModeName(SmoothingMode mode){
+    switch(mode){
+        case SmoothingMode::EMA: return "exponential";
+        case SmoothingMode::PULLED_STRING: return "pulled string";
+        default: return "off";
+    }
+}
+
+// Filters the raw pointer samples of a Scribble stroke into the path the brush
+// follows. The EMA weight comes from the time between samples, so the amount of
+// smoothing does not depend on the mouse polling rate.
+class StrokeStabilizer{
+private:
+    vec2 pos;
+    vec2 lastRaw;
+    Uint32 lastTimestamp{0};
+
+public:
+    SmoothingMode mode{SmoothingMode::NONE};
+    double time_constant_ms{25.0};    // EMA
+    double string_length{10.0};       // pulled string, in pixels
+
+    void begin(const PointerSample &sample){
+        pos = lastRaw = sample.pos;
+        lastTimestamp = sample.timestamp;
+    }
+
+    vec2 filter(const PointerSample &sample){
+        lastRaw = sample.pos;
+        if(mode == SmoothingMode::EMA){
+            double dt = (double)(Uint32)(sample.timestamp - lastTimestamp);
+            double alpha = 1.0 - exp(-std::max(dt, 1.0)/time_constant_ms);
+            pos = pos + alpha*(sample.pos - pos);
+        }
+        else if(mode == SmoothingMode::PULLED_STRING){
+            vec2 d = sample.pos - pos;
+            double len = norm(d);
+            if(len > string_length) pos = pos + ((len - string_length)/len)*d;
+        }
+        else pos = sample.pos;
+        lastTimestamp = sample.timestamp;
+        return pos;
+    }
+
+    // Where the stroke ends on release: the smoothed path catches up with the cursor
+    vec2 finish(){
+        pos = lastRaw;
+        return pos;
+    }
+
+    vec2 getPos(){return pos;}
+};
+
+const int PREDICTOR_HISTORY = 32;    // enough for 40 ms of a 1000 Hz mouse to span several timestamps
+const double PREDICTION_HORIZON_MS = 16.0;     // about one frame of a 60 Hz display
+const double PREDICTION_MAX_DISTANCE = 40.0;
+const double PREDICTION_WINDOW_MS = 40.0;      // samples older than this are ignored
+
+// Extrapolates the stroke a short time ahead from the velocity and acceleration
+// of the recent samples. Only ever drawn on the overlay; every new real sample
+// replaces the previous guess.
+class StrokePredictor{
+private:
+    vec2 positions[PREDICTOR_HISTORY];
+    Uint32 timestamps[PREDICTOR_HISTORY];
+    int count{0};
+    int head{0};    // index of the newest sample
+
+    int at(int age){return (head - age + PREDICTOR_HISTORY) % PREDICTOR_HISTORY;}
+
+public:
+    bool enabled{true};
+
+    void reset(){count = 0; head = 0;}
+
+    void push(vec2 pos, Uint32 timestamp){
+        head = (head + 1) % PREDICTOR_HISTORY;
+        positions[head] = pos;
+        timestamps[head] = timestamp;
+        if(count < PREDICTOR_HISTORY) ++count;
+    }
+
+    // false when there is not enough recent motion to say where the pen goes
+    bool predict(vec2 &predicted){
+        if(!enabled || count < 3) return false;
+        Uint32 now = timestamps[head];
+        int oldest = 0;
+        while(oldest + 1 < count && now - timestamps[at(oldest + 1)] <= PREDICTION_WINDOW_MS) ++oldest;
+        if(oldest < 2) return false;
+        int middle = oldest/2;
+        double dt_recent = (double)(timestamps[head] - timestamps[at(middle)]);
+        double dt_older = (double)(timestamps[at(middle)] - timestamps[at(oldest)]);
+        if(dt_recent < 1 || dt_older < 1) return false;    // timestamps only have ms resolution
+
+        vec2 v_recent = (positions[head] - positions[at(middle)])/dt_recent;
+        vec2 v_older = (positions[at(middle)] - positions[at(oldest)])/dt_older;
+        vec2 accel = (v_recent - v_older)/((dt_recent + dt_older)/2);
+        double h = PREDICTION_HORIZON_MS;
+        vec2 offset = h*v_recent + (0.5*h*h)*accel;
+        if(dot(offset, v_recent) <= 0) return false;    // decelerating to a stop, don't overshoot backwards
+        double len = norm(offset);
+        if(len < 0.5) return false;
+        if(len > PREDICTION_MAX_DISTANCE) offset = (PREDICTION_MAX_DISTANCE/len)*offset;
+        predicted = positions[head] + offset;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef SVG_H
+#define SVG_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "png.h"
+#include "scene.h"
+
+// Writes a scene as SVG straight to the file, one element per object, so the
+// time and memory needed do not depend on building a document first. Rects and
+// ellipses keep their fill/outline colours (the transparency toggle becomes
+// fill-opacity), lines their stroke style and scribbles their fitted curve as a
+// path of cubic Beziers.
+class SVGWriter{
+private:
+    FILE* file{nullptr};
+    bool failed{false};
+    Uint8 base64Carry[3];
+    int base64Count{0};
+
+    static constexpr const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    // shortest of up to 2 decimals: coordinates stay exact to 1/100 px without the noise
+    static const char* number(char* buffer, double value){
+        snprintf(buffer, 32, "%.2f", value);
+        char* end = buffer + strlen(buffer);
+        while(end > buffer && end[-1] == '0') *--end = '\0';
+        if(end > buffer && end[-1] == '.') *--end = '\0';
+        if(strcmp(buffer, "-0") == 0) strcpy(buffer, "0");
+        return buffer;
+    }
+
+    void paint(const char* attribute, SDL_Color color, double opacity = 1.0){
+        fprintf(file, " %s=\"#%02x%02x%02x\"", attribute, color.r, color.g, color.b);
+        double alpha = opacity*color.a/255.0;
+        char buffer[32];
+        if(alpha < 1.0) fprintf(file, " %s-opacity=\"%s\"", attribute, number(buffer, alpha));
+    }
+
+    void put(const char* data, size_t size){
+        if(failed || size == 0) return;
+        if(fwrite(data, 1, size, file) != size) failed = true;
+    }
+
+    // false once a write failed, so the PNGWriter feeding it stops too
+    bool base64(const Uint8* data, size_t size){
+        char out[4*1024];
+        size_t out_len = 0;
+        for(size_t i = 0; i < size; ++i){
+            base64Carry[base64Count++] = data[i];
+            if(base64Count < 3) continue;
+            Uint32 v = ((Uint32)base64Carry[0] << 16) | ((Uint32)base64Carry[1] << 8) | base64Carry[2];
+            out[out_len++] = alphabet[(v >> 18) & 63];
+            out[out_len++] = alphabet[(v >> 12) & 63];
+            out[out_len++] = alphabet[(v >> 6) & 63];
+            out[out_len++] = alphabet[v & 63];
+            base64Count = 0;
+            if(out_len == sizeof(out)){
+                put(out, out_len);
+                out_len = 0;
+            }
+        }
+        put(out, out_len);
+        return !failed;
+    }
+
+    void base64Finish(){
+        if(base64Count == 0) return;
+        Uint32 v = (Uint32)base64Carry[0] << 16;
+        if(base64Count == 2) v |= (Uint32)base64Carry[1] << 8;
+        char out[4] = {alphabet[(v >> 18) & 63], alphabet[(v >> 12) & 63], base64Count == 2 ? alphabet[(v >> 6) & 63] : '=', '='};
+        put(out, 4);
+        base64Count = 0;
+    }
+
+public:
+    SVGWriter() = default;
+    ~SVGWriter(){if(file != nullptr) fclose(file);}
+    SVGWriter(const SVGWriter&) = delete;
+    SVGWriter& operator=(const SVGWriter&) = delete;
+
+    bool open(const char* path, int width, int height){
+        file = fopen(path, "wb");
+        if(file == nullptr) return false;
+        setvbuf(file, nullptr, _IOFBF, 1 << 16);
+        fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+        fprintf(file, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\">\n", width, height, width, height);
+        return true;
+    }
+
+    // The pixels under every object: a single rect if they are one colour,
+    // otherwise an embedded PNG
+    void writeBackground(const Uint32* pixels, int width, int height){
+        size_t count = (size_t)width*height;
+        if(std::all_of(pixels, pixels + count, [first = pixels[0]](Uint32 p){return p == first;})){
+            fprintf(file, "<rect width=\"%d\" height=\"%d\"", width, height);
+            paint("fill", Canvas::unmapColor(pixels[0]));
+            fprintf(file, "/>\n");
+            return;
+        }
+        fprintf(file, "<image width=\"%d\" height=\"%d\" href=\"data:image/png;base64,", width, height);
+        PNGWriter png;
+        png.open([this](const Uint8* data, size_t size){return base64(data, size);}, width, height);
+        for(int y = 0; y < height; ++y) if(!png.writeRow(pixels + (size_t)y*width)) break;
+        if(!png.finish()) failed = true;
+        base64Finish();
+        fprintf(file, "\"/>\n");
+    }
+
+    void writeObject(const SceneObject &object){
+        char n1[32], n2[32], n3[32], n4[32], n5[32], n6[32];
+        switch(object.type){
+            case SceneObjectType::RECT:
+                if(object.filled){
+                    fprintf(file, "<rect x=\"%s\" y=\"%s\" width=\"%s\" height=\"%s\"", number(n1, object.pos.x - object.size.x/2), number(n2, object.pos.y - object.size.y/2), number(n3, object.size.x), number(n4, object.size.y));
+                    paint("fill", object.fill_color);
+                    fprintf(file, "/>\n");
+                }
+                if(object.outlined && object.size.x >= 1 && object.size.y >= 1){
+                    // the canvas draws a 1 pixel border on the inside
+                    fprintf(file, "<rect x=\"%s\" y=\"%s\" width=\"%s\" height=\"%s\" fill=\"none\"", number(n1, object.pos.x - object.size.x/2 + 0.5), number(n2, object.pos.y - object.size.y/2 + 0.5), number(n3, object.size.x - 1), number(n4, object.size.y - 1));
+                    paint("stroke", object.outline_color);
+                    fprintf(file, "/>\n");
+                }
+                break;
+            case SceneObjectType::ELLIPSE:
+                fprintf(file, "<ellipse cx=\"%s\" cy=\"%s\" rx=\"%s\" ry=\"%s\"", number(n1, object.pos.x), number(n2, object.pos.y), number(n3, object.size.x), number(n4, object.size.y));
+                if(object.filled) paint("fill", object.fill_color);
+                else fprintf(file, " fill=\"none\"");
+                if(object.outlined) paint("stroke", object.outline_color);
+                fprintf(file, "/>\n");
+                break;
+            case SceneObjectType::LINE:{
+                static const char* caps[] = {"butt", "round", "square"};
+                static const char* joins[] = {"round", "bevel", "miter"};
+                fprintf(file, "<line x1=\"%s\" y1=\"%s\" x2=\"%s\" y2=\"%s\" stroke-width=\"%s\" stroke-linecap=\"%s\" stroke-linejoin=\"%s\"", number(n1, object.a.x), number(n2, object.a.y), number(n3, object.b.x), number(n4, object.b.y), number(n5, object.style.width), caps[(int)object.style.cap], joins[(int)object.style.join]);
+                // our limit is relative to the half width, SVG's to the full width
+                if(object.style.join == LineJoin::MITER) fprintf(file, " stroke-miterlimit=\"%s\"", number(n6, std::max(1.0, object.style.miter_limit/2)));
+                paint("stroke", object.outline_color);
+                fprintf(file, "/>\n");
+                break;
+            }
+            default:{
+                if(object.curve.empty()) break;
+                fprintf(file, "<path fill=\"none\" stroke-width=\"%s\" stroke-linecap=\"round\" stroke-linejoin=\"round\"", number(n1, object.brush.size));
+                paint("stroke", object.outline_color, object.brush.opacity);
+                fprintf(file, " d=\"M%s %s", number(n1, object.curve[0].p0.x), number(n2, object.curve[0].p0.y));
+                for(size_t i = 0; i < object.curve.size(); ++i){
+                    const CubicBezier &b = object.curve[i];
+                    if(i > 0 && sqnorm(b.p0 - object.curve[i-1].p3) > 1e-12) fprintf(file, "M%s %s", number(n1, b.p0.x), number(n2, b.p0.y));
+                    fprintf(file, "C%s %s %s %s %s %s", number(n1, b.p1.x), number(n2, b.p1.y), number(n3, b.p2.x), number(n4, b.p2.y), number(n5, b.p3.x), number(n6, b.p3.y));
+                }
+                fprintf(file, "\"/>\n");
+                break;
+            }
+        }
+    }
+
+    // Closes the document; false if anything failed to write
+    bool finish(){
+        if(file == nullptr) return false;
+        fprintf(file, "</svg>\n");
+        if(ferror(file)) failed = true;
+        if(fclose(file) != 0) failed = true;
+        file = nullptr;
+        return !failed;
+    }
+};
+
+inline bool exportSVG(Scene &scene, const char* path){
+    Uint64 start = SDL_GetPerformanceCounter();
+    SVGWriter writer;
+    if(!writer.open(path, scene.getWidth(), scene.getHeight())){
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "SVG export: cannot write %s", path);
+        return false;
+    }
+    writer.writeBackground(scene.getBackground(), scene.getWidth(), scene.getHeight());
+    int count = 0;
+    scene.forEach({0, 0, scene.getWidth(), scene.getHeight()}, [&](const SceneObject &object){
+        writer.writeObject(object);
+        ++count;
+    });
+    if(!writer.finish()){
+        remove(path);
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "SVG export: writing %s failed", path);
+        return false;
+    }
+    double ms = (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency();
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Exported %d objects to %s in %.1f ms", count, path, ms);
+    return true;
+}
+
+#endif
@@ -0,0 +1,590 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "journal.h"
+#include "net.h"
+#include "service.h"
+
+const Uint32 SYNC_HOST_PEER = 0;
+const size_t SYNC_OPERATION_HEADER = 14;    // kind, op, sequence, origin
+const int SYNC_POLL_MS = 10;    // longest the network thread sleeps without looking at new output
+const char* const SYNC_LOADTEST_ADDRESS = "127.0.0.1:5002";    // --sync-loadtest without --host
+const int SYNC_LOADTEST_INTERVAL_MS = 400;    // a simulated peer sends an operation about this often
+const int SYNC_LOADTEST_SETTLE_MS = 5000;    // longest the check at exit waits for the last operations
+
+enum class SyncMessage: Uint8{
+    HELLO = 1,    // host to a new peer: its id and the canvas size
+    OPERATION     // a journal record; from the host with its place in the total order
+};
+
+// A committed operation as the host ordered it
+typedef struct SyncOperation{
+    JournalOp op;
+    Uint64 sequence;
+    Uint32 origin;    // peer that drew it, SYNC_HOST_PEER for the host
+    std::vector<Uint8> payload;
+} SyncOperation;
+
+// Host: writes the history a joining peer starts from
+typedef std::function<void(JournalEncoder&)> SyncHistoryWriter;
+
+// Shares committed operations (journal records, not pixels) between
+// instances. The hosting instance is the sequencer: every operation, its own
+// included, gets the next sequence number there and goes to every peer in
+// that order, so all of them apply the same operations in the same order.
+// Peers draw their own operations at once and send them; receive() returns
+// them again once they are ordered. A peer that joins first gets the host's
+// whole history, as a STATE operation sent to it alone, so undo and redo
+// reach the same states everywhere. A network thread does the socket work
+// and encodes that history; the main thread only queues and takes operations.
+class SyncSession{
+private:
+    struct Peer{
+        std::unique_ptr<NetConnection> connection;
+        Uint32 id;
+        bool welcomed;    // host: has been sent the history, its operations are ordered from then on
+        SyncHistoryWriter history{};    // host: the history still to be encoded and sent to it
+        Uint64 historySequence{0};    // host: the last operation that history includes
+        std::vector<std::vector<Uint8>> held{};    // host: operations ordered after that history, sent once it is
+    };
+
+    std::mutex mutex;
+    std::thread network;
+    std::atomic<bool> stopping{false}, active{false};
+    bool hosting{false};
+    std::string address;
+    NetSocket listener{NET_INVALID_SOCKET};
+    int width{0}, height{0};
+    std::vector<Peer> peers;            // host: every client; client: the host
+    std::deque<SyncOperation> inbox;    // ordered operations not yet taken
+    std::deque<Uint32> joining;         // host: peers waiting for the history
+    std::atomic<Uint32> peerId{SYNC_HOST_PEER};
+    Uint64 lastSequence{0};
+    Uint32 nextPeer{1};
+    Uint64 operationsSent{0}, operationsReceived{0}, payloadBytesSent{0};
+    Uint64 bytesSent{0}, bytesReceived{0};    // of connections that are gone
+
+    static std::vector<Uint8> operationMessage(JournalOp op, Uint64 sequence, Uint32 origin, const Uint8* payload, size_t size){
+        JournalEncoder message;
+        message.put8((Uint8)SyncMessage::OPERATION);
+        message.put8((Uint8)op);
+        message.put64(sequence);
+        message.put32(origin);
+        message.putBytes(payload, size);
+        return message.bytes;
+    }
+
+    // host, mutex held: the next place in the order, to every welcomed peer and the own inbox
+    void sequence(JournalOp op, Uint32 origin, const Uint8* payload, size_t size){
+        Uint64 seq = ++lastSequence;
+        std::vector<Uint8> message = operationMessage(op, seq, origin, payload, size);
+        for(Peer &peer: peers){
+            if(peer.history) peer.held.push_back(message);
+            if(!peer.welcomed) continue;
+            peer.connection->queue(message.data(), message.size());
+            peer.connection->flush();
+        }
+        inbox.push_back({op, seq, origin, std::vector<Uint8>(payload, payload + size)});
+    }
+
+    // mutex held
+    void handleMessage(Peer &peer, const std::vector<Uint8> &message){
+        JournalDecoder in(message.data(), message.size());
+        SyncMessage kind = (SyncMessage)in.get8();
+        if(kind == SyncMessage::HELLO && !hosting){
+            Uint32 id = in.get32();
+            int host_width = (int)in.get32(), host_height = (int)in.get32();
+            if(!in.ok() || host_width != width || host_height != height){
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Sync: the host canvas is %dx%d, this one %dx%d", host_width, host_height, width, height);
+                peer.connection->closed = true;
+                return;
+            }
+            peerId = id;
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Sync: joined %s as peer %u", address.c_str(), id);
+        }
+        else if(kind == SyncMessage::OPERATION){
+            JournalOp op = (JournalOp)in.get8();
+            Uint64 seq = in.get64();
+            Uint32 origin = in.get32();
+            if(!in.ok() || op < JournalOp::OBJECT || op > JournalOp::STATE){
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Sync: malformed operation from peer %u", peer.id);
+                peer.connection->closed = true;
+                return;
+            }
+            size_t header = SYNC_OPERATION_HEADER;
+            if(hosting && (op == JournalOp::STATE || op == JournalOp::VECTOR_MODE)){
+                // a STATE replaces everyone's history and only the host sends one, to a peer that joins
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Sync: peer %u sent an operation only the host may send", peer.id);
+                peer.connection->closed = true;
+                return;
+            }
+            if(hosting) sequence(op, peer.id, message.data() + header, message.size() - header);    // the host decides order and origin
+            else{
+                if(seq != lastSequence + 1 && lastSequence != 0) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Sync: operation %llu after %llu", (unsigned long long)seq, (unsigned long long)lastSequence);
+                lastSequence = seq;
+                inbox.push_back({op, seq, origin, std::vector<Uint8>(message.begin() + header, message.end())});
+            }
+        }
+    }
+
+    // host, mutex held: the encoded history to the peer it was captured for,
+    // then what was ordered while it was being encoded
+    void sendHistory(Uint32 peer_id, const JournalEncoder &state){
+        auto peer = std::find_if(peers.begin(), peers.end(), [peer_id](const Peer &p){return p.id == peer_id;});
+        if(peer == peers.end()) return;    // left in the meantime
+        peer->history = nullptr;
+        if(SYNC_OPERATION_HEADER + state.bytes.size() > NET_MAX_MESSAGE){
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Sync: the history is too large to send to peer %u", peer_id);
+            peer->connection->closed = true;
+            return;
+        }
+        std::vector<Uint8> message = operationMessage(JournalOp::STATE, peer->historySequence, SYNC_HOST_PEER, state.bytes.data(), state.bytes.size());
+        peer->connection->queue(message.data(), message.size());
+        for(const std::vector<Uint8> &operation: peer->held) peer->connection->queue(operation.data(), operation.size());
+        peer->held.clear();
+        peer->connection->flush();
+        peer->welcomed = true;
+    }
+
+    void networkLoop(){
+        std::vector<Uint8> message;
+        while(!stopping){
+            // a joining peer's history is encoded here, with the session unlocked
+            SyncHistoryWriter history;
+            Uint32 history_peer = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for(Peer &peer: peers){
+                    if(!peer.history) continue;
+                    history = peer.history;
+                    history_peer = peer.id;
+                    break;
+                }
+            }
+            if(history){
+                JournalEncoder state;
+                history(state);
+                history = nullptr;
+                std::lock_guard<std::mutex> lock(mutex);
+                sendHistory(history_peer, state);
+            }
+
+            fd_set reads, writes;
+            FD_ZERO(&reads);
+            FD_ZERO(&writes);
+            NetSocket top = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(listener != NET_INVALID_SOCKET){
+                    FD_SET(listener, &reads);
+                    top = std::max(top, listener);
+                }
+                for(Peer &peer: peers){
+                    if(peer.welcomed || !hosting) FD_SET(peer.connection->handle, &reads);    // a new peer's operations wait until it has the history
+                    if(peer.connection->pendingOutput() > 0) FD_SET(peer.connection->handle, &writes);
+                    top = std::max(top, peer.connection->handle);
+                }
+            }
+            timeval timeout = {0, SYNC_POLL_MS*1000};
+            if(select((int)top + 1, &reads, &writes, nullptr, &timeout) < 0) SDL_Delay(SYNC_POLL_MS);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(listener != NET_INVALID_SOCKET && FD_ISSET(listener, &reads)){
+                NetSocket s;
+                while((s = netAccept(listener)) != NET_INVALID_SOCKET){
+                    Peer peer = {std::make_unique<NetConnection>(s), nextPeer++, false};
+                    JournalEncoder hello;
+                    hello.put8((Uint8)SyncMessage::HELLO);
+                    hello.put32(peer.id);
+                    hello.put32((Uint32)width);
+                    hello.put32((Uint32)height);
+                    peer.connection->queue(hello.bytes.data(), hello.bytes.size());
+                    peer.connection->flush();
+                    joining.push_back(peer.id);
+                    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Sync: peer %u connected", peer.id);
+                    peers.push_back(std::move(peer));
+                }
+            }
+            for(Peer &peer: peers){
+                if(FD_ISSET(peer.connection->handle, &reads)){
+                    peer.connection->receive();
+                    while(peer.connection->nextMessage(message)) handleMessage(peer, message);
+                }
+                if(FD_ISSET(peer.connection->handle, &writes)) peer.connection->flush();
+            }
+            for(size_t i = 0; i < peers.size();){
+                if(!peers[i].connection->closed){
+                    ++i;
+                    continue;
+                }
+                if(hosting) SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Sync: peer %u left", peers[i].id);
+                else SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Sync: lost the connection to %s, drawing alone from now on", address.c_str());
+                bytesSent += peers[i].connection->bytesSent;
+                bytesReceived += peers[i].connection->bytesReceived;
+                peers.erase(peers.begin() + i);
+            }
+            if(!hosting && peers.empty()){
+                active = false;
+                return;
+            }
+        }
+    }
+
+    bool start(){
+        stopping = false;
+        active = true;
+        network = std::thread(&SyncSession::networkLoop, this);
+        return true;
+    }
+
+public:
+    SyncSession() = default;
+    ~SyncSession(){close();}
+    SyncSession(const SyncSession&) = delete;
+    SyncSession& operator=(const SyncSession&) = delete;
+
+    // Listens at host_address ("port", "host:port" or "unix:/path") and orders every operation
+    bool host(const std::string &host_address, int canvas_width, int canvas_height){
+        listener = netListen(host_address);
+        if(listener == NET_INVALID_SOCKET) return false;
+        address = host_address;
+        hosting = true;
+        width = canvas_width;
+        height = canvas_height;
+        peerId = SYNC_HOST_PEER;
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Sync: hosting at %s", address.c_str());
+        return start();
+    }
+
+    // Connects to a hosting instance; its canvas and history replace this one's once they arrive
+    bool join(const std::string &host_address, int canvas_width, int canvas_height){
+        NetSocket s = netConnect(host_address);
+        if(s == NET_INVALID_SOCKET) return false;
+        address = host_address;
+        hosting = false;
+        width = canvas_width;
+        height = canvas_height;
+        peers.push_back({std::make_unique<NetConnection>(s), SYNC_HOST_PEER, true});
+        return start();
+    }
+
+    bool isActive(){return active;}
+    bool isHost(){return hosting && active;}
+    Uint32 getPeerId(){return peerId;}
+
+    // Host: the place of the last operation ordered; peer: of the last one received
+    Uint64 getLastSequence(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return lastSequence;
+    }
+
+    // Sends a committed local operation to be ordered
+    void submit(JournalOp op, const JournalEncoder &payload){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!active) return;
+        ++operationsSent;
+        payloadBytesSent += payload.bytes.size();
+        if(hosting){
+            sequence(op, SYNC_HOST_PEER, payload.bytes.data(), payload.bytes.size());
+            return;
+        }
+        std::vector<Uint8> message = operationMessage(op, 0, 0, payload.bytes.data(), payload.bytes.size());
+        peers[0].connection->queue(message.data(), message.size());
+        peers[0].connection->flush();
+    }
+
+    // The next ordered operation, from any peer, this one included
+    bool receive(SyncOperation &out){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(inbox.empty()) return false;
+        out = std::move(inbox.front());
+        inbox.pop_front();
+        ++operationsReceived;
+        return true;
+    }
+
+    // Host: a peer that connected and needs the history before it can take part
+    bool takeJoinRequest(Uint32 &peer){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(joining.empty()) return false;
+        peer = joining.front();
+        joining.pop_front();
+        return true;
+    }
+
+    // Host: sends the new peer the history as it stands after every operation
+    // ordered so far, as a STATE operation to it alone; its own operations are
+    // ordered from then on. Nothing can be ordered in between: with the session
+    // locked, apply takes what is still waiting (like receive()), then capture
+    // returns a writer of the state the peer starts from. It should only hold
+    // on to the snapshots: the network thread runs it, and holds back what is
+    // ordered meanwhile until the state is on its way.
+    void welcome(Uint32 peer_id, const std::function<void(SyncOperation&)> &apply, const std::function<SyncHistoryWriter()> &capture){
+        std::lock_guard<std::mutex> lock(mutex);
+        while(!inbox.empty()){
+            SyncOperation operation = std::move(inbox.front());
+            inbox.pop_front();
+            ++operationsReceived;
+            apply(operation);
+        }
+        auto peer = std::find_if(peers.begin(), peers.end(), [peer_id](const Peer &p){return p.id == peer_id;});
+        if(peer == peers.end()) return;    // left again already
+        peer->history = capture();
+        peer->historySequence = lastSequence;
+    }
+
+    void close(){
+        if(!network.joinable()) return;
+        stopping = true;
+        network.join();
+        for(Peer &peer: peers){
+            peer.connection->flush();
+            bytesSent += peer.connection->bytesSent;
+            bytesReceived += peer.connection->bytesReceived;
+        }
+        peers.clear();
+        netClose(listener);
+        listener = NET_INVALID_SOCKET;
+        if(hosting && netIsUnixAddress(address)) remove(address.substr(5).c_str());
+        active = false;
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Sync: %llu operations sent (%llu payload bytes), %llu applied; %llu bytes sent, %llu received in all", (unsigned long long)operationsSent, (unsigned long long)payloadBytesSent, (unsigned long long)operationsReceived, (unsigned long long)bytesSent, (unsigned long long)bytesReceived);
+    }
+};
+
+// --sync-loadtest: peers in this process join the hosting session over
+// loopback and send random operations while it runs. Each keeps its own
+// canvas and undo history the way an instance does (a history step per
+// drawing, undo and redo moving between them) with the snapshots kept
+// encoded. At exit the host orders and applies what is still on its way,
+// then every peer's canvas is compared with the host's.
+class SyncLoadTest{
+private:
+    struct Peer{
+        SyncSession session;
+        RenderWorker worker;
+        std::vector<std::vector<Uint8>> history;    // journal images, the history from the host first
+        int current{0};
+        bool joined{false};    // has the host's history
+        Uint64 sequence{0};    // of the last ordered operation applied
+        Uint64 submitted{0}, ownApplied{0};
+        Uint64 nextSubmit{0};
+        std::mt19937 random;
+    };
+
+    std::vector<std::unique_ptr<Peer>> peers;
+    SyncSession* host{nullptr};
+    RenderRecordFn drawRecord;
+    std::thread runner;
+    std::atomic<bool> stopping{false};
+    int width{0}, height{0};
+
+    void storeStep(Peer &peer){
+        JournalEncoder image;
+        encodeJournalImage(image, peer.worker.canvas->getPixels(), width, height);
+        peer.history.resize(peer.current + 1);
+        peer.history.push_back(std::move(image.bytes));
+        ++peer.current;
+    }
+
+    void loadStep(Peer &peer){
+        JournalDecoder in(peer.history[peer.current].data(), peer.history[peer.current].size());
+        decodeJournalImage(in, peer.worker.canvas->getPixels(), width, height);
+    }
+
+    // The history a joining peer gets (encodeSyncHistory): the current step, the number of steps, every snapshot
+    bool install(Peer &peer, JournalDecoder &in){
+        int current = (int)in.get32(), count = (int)in.get32();
+        if(!in.ok() || count <= 0 || current < 0 || current >= count) return false;
+        peer.history.clear();
+        for(int i = 0; i < count; ++i){
+            if(!decodeJournalImage(in, peer.worker.canvas->getPixels(), width, height)) return false;
+            JournalEncoder image;
+            encodeJournalImage(image, peer.worker.canvas->getPixels(), width, height);
+            peer.history.push_back(std::move(image.bytes));
+        }
+        peer.current = current;
+        loadStep(peer);
+        return true;
+    }
+
+    // Like applyOrderedOperation: every drawing that succeeds is a step, undo and redo stop at the ends
+    void apply(Peer &peer, SyncOperation &operation){
+        JournalDecoder in(operation.payload.data(), operation.payload.size());
+        peer.sequence = operation.sequence;
+        if(operation.op == JournalOp::STATE){
+            peer.joined = install(peer, in);
+            if(!peer.joined) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Sync load test: peer %u got a damaged history", peer.session.getPeerId());
+            return;
+        }
+        if(!peer.joined) return;
+        if(operation.origin == peer.session.getPeerId()) ++peer.ownApplied;
+        if(operation.op == JournalOp::UNDO){
+            if(peer.current > 0){
+                --peer.current;
+                loadStep(peer);
+            }
+        }
+        else if(operation.op == JournalOp::REDO){
+            if(peer.current + 1 < (int)peer.history.size()){
+                ++peer.current;
+                loadStep(peer);
+            }
+        }
+        else if(drawRecord(peer.worker, operation.op, in)) storeStep(peer);
+    }
+
+    void receive(Peer &peer){
+        SyncOperation operation;
+        while(peer.session.receive(operation)) apply(peer, operation);
+    }
+
+    double coordinate(Peer &peer, int limit){
+        return std::uniform_real_distribution<double>(0.0, (double)limit)(peer.random);
+    }
+
+    // A random operation of any kind a peer may send, every point on the canvas
+    void submitRandom(Peer &peer){
+        std::mt19937 &random = peer.random;
+        auto pick = [&random](int n){return std::uniform_int_distribution<int>(0, n - 1)(random);};
+        auto color = [&pick]{return SDL_Color{(Uint8)pick(256), (Uint8)pick(256), (Uint8)pick(256), 255};};
+        JournalEncoder payload;
+        JournalOp op;
+        int kind = pick(10);
+        if(kind < 3){
+            op = JournalOp::OBJECT;
+            SceneObject object;
+            object.type = (SceneObjectType)pick(3);
+            object.pos = vec2(coordinate(peer, width), coordinate(peer, height));
+            object.size = vec2(1 + pick(100), 1 + pick(100));
+            object.a = object.pos;
+            object.b = vec2(coordinate(peer, width), coordinate(peer, height));
+            object.style.width = 1 + pick(12);
+            object.style.cap = (LineCap)pick((int)LineCap::NUM_CAPS);
+            object.fill_color = color();
+            object.outline_color = color();
+            object.filled = pick(2) == 0;
+            encodeSceneObject(payload, object);
+        }
+        else if(kind < 6){
+            op = JournalOp::SCRIBBLE;
+            BrushSettings brush;
+            brush.size = 1 + pick(30);
+            brush.hardness = pick(11)/10.0;
+            brush.opacity = 0.2 + pick(9)/10.0;
+            brush.flow = 0.2 + pick(9)/10.0;
+            brush.spacing = 0.05 + pick(10)/20.0;
+            encodeBrushSettings(payload, brush);
+            payload.putColor(color());
+            int count = 2 + pick(40);
+            payload.put32((Uint32)count);
+            vec2 pos(coordinate(peer, width), coordinate(peer, height));
+            for(int i = 0; i < count; ++i){
+                payload.putVec2(pos);
+                pos = vec2(std::clamp(pos.x + pick(41) - 20, 0.0, width - 1.0), std::clamp(pos.y + pick(41) - 20, 0.0, height - 1.0));
+            }
+        }
+        else if(kind < 7){
+            op = JournalOp::ERASE;
+            int count = 2 + pick(10);
+            payload.put32((Uint32)count);
+            for(int i = 0; i < count; ++i) payload.putVec2(vec2(coordinate(peer, width), coordinate(peer, height)));
+        }
+        else if(kind < 8){
+            op = JournalOp::FILL;
+            payload.putColor(color());
+            payload.put32((Uint32)pick(width));
+            payload.put32((Uint32)pick(height));
+        }
+        else op = kind < 9 ? JournalOp::UNDO : JournalOp::REDO;
+        peer.session.submit(op, payload);
+        ++peer.submitted;
+    }
+
+    void run(){
+        while(!stopping){
+            Uint64 now = SDL_GetTicks64();
+            for(auto &peer: peers){
+                receive(*peer);
+                if(!peer->joined || !peer->session.isActive() || now < peer->nextSubmit) continue;
+                submitRandom(*peer);
+                peer->nextSubmit = now + SYNC_LOADTEST_INTERVAL_MS/2 + peer->random() % SYNC_LOADTEST_INTERVAL_MS;
+            }
+            SDL_Delay(SYNC_POLL_MS);
+        }
+    }
+
+    // Every peer still connected has applied all the host ordered, its own operations included
+    bool settled(){
+        for(auto &peer: peers){
+            if(!peer->session.isActive()) continue;
+            if(!peer->joined || peer->ownApplied < peer->submitted || peer->sequence < host->getLastSequence()) return false;
+        }
+        return true;
+    }
+
+public:
+    ~SyncLoadTest(){
+        if(!runner.joinable()) return;
+        stopping = true;
+        runner.join();
+    }
+
+    // Joins count peers to the session host runs at address; draw_record draws their operations
+    bool start(SyncSession &hosting, const std::string &address, int count, int canvas_width, int canvas_height, RenderRecordFn draw_record){
+        host = &hosting;
+        drawRecord = draw_record;
+        width = canvas_width;
+        height = canvas_height;
+        for(int i = 0; i < count; ++i){
+            peers.push_back(std::make_unique<Peer>());
+            Peer &peer = *peers.back();
+            peer.worker.canvas = std::make_unique<Canvas>(width, height);
+            peer.random.seed((unsigned)i + 1);
+            if(!peer.session.join(address, width, height)) return false;
+        }
+        stopping = false;
+        runner = std::thread(&SyncLoadTest::run, this);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Sync load test: %d peers joined %s", count, address.c_str());
+        return true;
+    }
+
+    // Stops sending, lets host_apply (the host's applySyncedOperations) take
+    // what is still on its way until every peer has it too, then compares each
+    // peer's canvas with pixels (the host canvas) and logs how many match
+    void stop(const std::function<void()> &host_apply, const Uint32* pixels, int canvas_width, int canvas_height){
+        if(!runner.joinable()) return;
+        stopping = true;
+        runner.join();
+        Uint64 deadline = SDL_GetTicks64() + SYNC_LOADTEST_SETTLE_MS;
+        do{
+            host_apply();
+            for(auto &peer: peers) receive(*peer);
+            if(settled()) break;
+            SDL_Delay(SYNC_POLL_MS);
+        } while(SDL_GetTicks64() < deadline);
+        host_apply();
+        int matching = 0, connected = 0;
+        Uint64 submitted = 0;
+        for(auto &peer: peers){
+            submitted += peer->submitted;
+            if(peer->session.isActive()) ++connected;
+            if(peer->joined && canvas_width == width && canvas_height == height && memcmp(peer->worker.canvas->getPixels(), pixels, (size_t)width*height*sizeof(Uint32)) == 0) ++matching;
+            peer->session.close();
+        }
+        if(!peers.empty()) SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Sync load test: %zu peers sent %llu operations, %d still connected, %d match the host canvas at exit", peers.size(), (unsigned long long)submitted, connected, matching);
+        peers.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef TIMELAPSE_H
+#define TIMELAPSE_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pool.h"
+
+const int TIMELAPSE_TILE_SIZE = 64;
+const Uint32 TIMELAPSE_QUANTIZE_MASK = 0xFCFCFC00;    // 6 bits per colour channel: smaller changes do not survive 4:2:0 video anyway
+const int TIMELAPSE_FPS = 30;
+
+// Records the canvas as a raw YUV4MPEG2 (4:2:0) stream any encoder reads,
+// e.g. ffmpeg -i session.y4m session.mp4. capture() only copies the pixels
+// into a pooled buffer and queues it; a writer thread hashes every tile of the
+// frame and drops it if no tile differs from the last frame written
+// (ignoring the two low bits of each channel), otherwise converts and
+// appends it. The queue is not bounded: frames are never dropped, a slow disk
+// only costs memory until it catches up.
+class TimelapseRecorder{
+private:
+    std::string path;
+    FILE* file{nullptr};
+    int width{0}, height{0};
+    Uint32 intervalMs{0};        // 0: one frame per history step
+    Uint64 lastCapture{0};
+    ResourcePool* pool{nullptr};
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<BufferLease> queue;
+    bool stopping{false};
+    size_t queuePeak{0};
+    // writer thread only
+    std::vector<Uint64> tileHashes;
+    std::vector<Uint8> planes;
+    Uint64 framesCaptured{0}, framesWritten{0};
+    bool failed{false};
+
+    Uint64 hashTile(const Uint32* pixels, int tile_x, int tile_y){
+        int x0 = tile_x*TIMELAPSE_TILE_SIZE, y0 = tile_y*TIMELAPSE_TILE_SIZE;
+        int x1 = std::min(width, x0 + TIMELAPSE_TILE_SIZE), y1 = std::min(height, y0 + TIMELAPSE_TILE_SIZE);
+        Uint64 h = 1469598103934665603ull;    // FNV-1a over whole pixels
+        for(int y = y0; y < y1; ++y){
+            const Uint32* row = pixels + (size_t)y*width;
+            for(int x = x0; x < x1; ++x) h = (h ^ (row[x] & TIMELAPSE_QUANTIZE_MASK))*1099511628211ull;
+        }
+        return h;
+    }
+
+    // true if any tile changed since the last frame written
+    bool changed(const Uint32* pixels){
+        int tiles_x = (width + TIMELAPSE_TILE_SIZE - 1)/TIMELAPSE_TILE_SIZE, tiles_y = (height + TIMELAPSE_TILE_SIZE - 1)/TIMELAPSE_TILE_SIZE;
+        bool first = tileHashes.empty(), any = first;
+        if(first) tileHashes.resize((size_t)tiles_x*tiles_y);
+        for(int ty = 0; ty < tiles_y; ++ty){
+            for(int tx = 0; tx < tiles_x; ++tx){
+                Uint64 h = hashTile(pixels, tx, ty);
+                Uint64 &old = tileHashes[(size_t)ty*tiles_x + tx];
+                if(h != old) any = true;
+                old = h;
+            }
+        }
+        return any;
+    }
+
+    // BT.601 full range, chroma averaged over 2x2 blocks
+    void writeFrame(const Uint32* pixels){
+        int chroma_w = (width + 1)/2, chroma_h = (height + 1)/2;
+        size_t luma_size = (size_t)width*height, chroma_size = (size_t)chroma_w*chroma_h;
+        planes.resize(luma_size + 2*chroma_size);
+        Uint8* luma = planes.data();
+        Uint8* cb = luma + luma_size;
+        Uint8* cr = cb + chroma_size;
+        for(int y = 0; y < height; ++y){
+            const Uint32* row = pixels + (size_t)y*width;
+            for(int x = 0; x < width; ++x){
+                int r = row[x] >> 24, g = (row[x] >> 16) & 0xFF, b = (row[x] >> 8) & 0xFF;
+                luma[(size_t)y*width + x] = (Uint8)((19595*r + 38470*g + 7471*b + 32768) >> 16);
+            }
+        }
+        for(int cy = 0; cy < chroma_h; ++cy){
+            for(int cx = 0; cx < chroma_w; ++cx){
+                int r = 0, g = 0, b = 0, n = 0;
+                for(int y = 2*cy; y < std::min(height, 2*cy + 2); ++y){
+                    for(int x = 2*cx; x < std::min(width, 2*cx + 2); ++x){
+                        Uint32 p = pixels[(size_t)y*width + x];
+                        r += p >> 24;
+                        g += (p >> 16) & 0xFF;
+                        b += (p >> 8) & 0xFF;
+                        ++n;
+                    }
+                }
+                r /= n; g /= n; b /= n;
+                cb[(size_t)cy*chroma_w + cx] = (Uint8)std::clamp((-11059*r - 21709*g + 32768*b + (128 << 16) + 32768) >> 16, 0, 255);
+                cr[(size_t)cy*chroma_w + cx] = (Uint8)std::clamp((32768*r - 27439*g - 5329*b + (128 << 16) + 32768) >> 16, 0, 255);
+            }
+        }
+        if(fputs("FRAME\n", file) == EOF || fwrite(planes.data(), 1, planes.size(), file) != planes.size()) failed = true;
+    }
+
+    void writerLoop(){
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+            wake.wait(lock, [this]{return stopping || !queue.empty();});
+            if(queue.empty()) break;
+            BufferLease frame = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            ++framesCaptured;
+            if(!failed && changed(frame.as<Uint32>())){
+                writeFrame(frame.as<Uint32>());
+                ++framesWritten;
+            }
+            frame = BufferLease();    // back to the pool before waiting
+            lock.lock();
+        }
+    }
+
+public:
+    TimelapseRecorder() = default;
+    ~TimelapseRecorder(){stop();}
+    TimelapseRecorder(const TimelapseRecorder&) = delete;
+    TimelapseRecorder& operator=(const TimelapseRecorder&) = delete;
+
+    // interval_ms 0 records a frame per capture() call, otherwise due() says when to capture
+    bool start(const std::string &output_path, int canvas_width, int canvas_height, Uint32 interval_ms, ResourcePool &buffers){
+        file = fopen(output_path.c_str(), "wb");
+        if(file == nullptr) return false;
+        path = output_path;
+        width = canvas_width;
+        height = canvas_height;
+        intervalMs = interval_ms;
+        pool = &buffers;
+        fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, TIMELAPSE_FPS);
+        stopping = false;
+        lastCapture = SDL_GetTicks64();
+        writer = std::thread(&TimelapseRecorder::writerLoop, this);
+        return true;
+    }
+
+    bool isRecording(){return writer.joinable();}
+    bool isTimed(){return intervalMs > 0;}
+    bool due(){return isRecording() && intervalMs > 0 && SDL_GetTicks64() - lastCapture >= intervalMs;}
+
+    // Queues a copy of pixels (the whole canvas); cheap enough to call every frame
+    void capture(const Uint32* pixels){
+        if(!isRecording()) return;
+        lastCapture = SDL_GetTicks64();
+        BufferLease frame = pool->acquireBuffer((size_t)width*height*sizeof(Uint32));
+        std::copy(pixels, pixels + (size_t)width*height, frame.as<Uint32>());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(frame));
+            queuePeak = std::max(queuePeak, queue.size());
+        }
+        wake.notify_one();
+    }
+
+    // Writes every queued frame, then closes the file
+    void stop(){
+        if(!isRecording()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        if(fclose(file) != 0) failed = true;
+        file = nullptr;
+        if(failed) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Timelapse: writing %s failed", path.c_str());
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Timelapse: %llu of %llu frames written to %s (%llu unchanged skipped, at most %zu queued)", (unsigned long long)framesWritten, (unsigned long long)framesCaptured, path.c_str(), (unsigned long long)(framesCaptured - framesWritten), queuePeak);
+    }
+};
+
+#endif
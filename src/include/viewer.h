@@ -0,0 +1,395 @@
+#ifndef VIEWER_H
+#define VIEWER_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "journal.h"
+#include "net.h"
+#include "paintdoc.h"
+
+const int VIEWER_TILE_SIZE = 64;
+const double VIEWER_RATE_LIMIT = 4.0*(1 << 20);    // bytes per second to each viewer
+const double VIEWER_BURST = 1 << 20;               // bytes a viewer may get at once after being idle
+const size_t VIEWER_MAX_QUEUED = 256 << 10;        // unsent bytes after which a viewer gets nothing new until it catches up
+const int VIEWER_POLL_MS = 5;
+const int VIEWER_SLOW_CLIENT_MS = 250;             // load test: every fourth viewer reads this rarely
+const char* const VIEWER_LOADTEST_ADDRESS = "127.0.0.1:5001";    // --viewer-loadtest without --broadcast
+
+enum class ViewerMessage: Uint8{
+    HELLO = 1,    // width, height, tile size
+    TILES         // generation, count, then x, y (in tiles), codec, size and payload of each tile
+};
+
+// Streams the canvas to read-only viewers as compressed tiles. publish()
+// copies the region that changed this frame into a frame of its own and
+// stamps the tiles it touches with a generation, nothing else, so its cost
+// does not depend on how many viewers watch. A network thread encodes each
+// changed tile once and sends every viewer the tiles whose generation it has
+// not seen, within a byte rate per viewer. A viewer whose socket backs up is
+// skipped; when it drains, it gets the latest version of each tile, not the
+// states in between.
+class ViewerBroadcast{
+private:
+    struct EncodedTile{
+        Uint64 generation{0};
+        TileCodec codec{TileCodec::RAW};
+        std::vector<Uint8> payload;
+    };
+    struct Viewer{
+        std::unique_ptr<NetConnection> connection;
+        std::vector<Uint64> sent;    // generation of each tile it has
+        size_t cursor{0};            // tile to start from next time, so a rate limited viewer gets every part in turn
+        double tokens{VIEWER_BURST};
+        Uint64 lastRefill{0};
+    };
+
+    std::mutex mutex;
+    std::thread network;
+    std::atomic<bool> stopping{false};
+    std::string address;
+    NetSocket listener{NET_INVALID_SOCKET};
+    int width{0}, height{0}, tilesX{0}, tilesY{0};
+    // shared with the main thread
+    std::vector<Uint32> frame;
+    std::vector<Uint64> tileGeneration;
+    Uint64 generation{0};
+    // network thread
+    std::vector<EncodedTile> encoded;
+    Uint64 encodedGeneration{0};    // newest generation encoded so far
+    std::vector<Uint32> scratch;
+    std::vector<Viewer> viewers;
+    std::atomic<int> viewerCount{0};
+    int viewerPeak{0};
+    Uint64 tilesSent{0}, bytesSent{0}, backedUp{0};
+    // main thread
+    Uint64 publishCount{0}, publishTicks{0}, publishMaxTicks{0};
+
+    size_t tileIndex(int tx, int ty){return (size_t)ty*tilesX + tx;}
+    int tileWidth(int tx){return std::min(VIEWER_TILE_SIZE, width - tx*VIEWER_TILE_SIZE);}
+    int tileHeight(int ty){return std::min(VIEWER_TILE_SIZE, height - ty*VIEWER_TILE_SIZE);}
+
+    // Copies the tiles changed since they were last encoded, then encodes them outside the lock
+    void encodeChangedTiles(){
+        std::vector<size_t> changed;
+        std::vector<Uint64> generations;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            encodedGeneration = generation;
+            for(int ty = 0; ty < tilesY; ++ty){
+                for(int tx = 0; tx < tilesX; ++tx){
+                    size_t t = tileIndex(tx, ty);
+                    if(tileGeneration[t] == encoded[t].generation) continue;
+                    int w = tileWidth(tx), h = tileHeight(ty);
+                    Uint32* dst = scratch.data() + t*VIEWER_TILE_SIZE*VIEWER_TILE_SIZE;
+                    for(int y = 0; y < h; ++y) memcpy(dst + (size_t)y*w, frame.data() + (size_t)(ty*VIEWER_TILE_SIZE + y)*width + tx*VIEWER_TILE_SIZE, (size_t)w*sizeof(Uint32));
+                    changed.push_back(t);
+                    generations.push_back(tileGeneration[t]);
+                }
+            }
+        }
+        for(size_t i = 0; i < changed.size(); ++i){
+            size_t t = changed[i];
+            int tx = (int)(t % tilesX), ty = (int)(t/tilesX);
+            EncodedTile &tile = encoded[t];
+            tile.codec = encodePaintTile(scratch.data() + t*VIEWER_TILE_SIZE*VIEWER_TILE_SIZE, tileWidth(tx), tileWidth(tx), tileHeight(ty), tile.payload);
+            tile.generation = generations[i];
+        }
+    }
+
+    // Queues the tiles viewer has not seen, as far as its byte budget goes
+    void serve(Viewer &viewer, Uint64 now){
+        double seconds = (double)(now - viewer.lastRefill)/SDL_GetPerformanceFrequency();
+        viewer.lastRefill = now;
+        viewer.tokens = std::min(VIEWER_BURST, viewer.tokens + seconds*VIEWER_RATE_LIMIT);
+        viewer.connection->flush();
+        if(viewer.connection->pendingOutput() >= VIEWER_MAX_QUEUED){
+            ++backedUp;
+            return;
+        }
+        JournalEncoder message;
+        message.put8((Uint8)ViewerMessage::TILES);
+        message.put64(encodedGeneration);
+        message.put32(0);    // count, patched below
+        Uint32 count = 0;
+        size_t tiles = encoded.size();
+        size_t t = viewer.cursor;
+        for(size_t i = 0; i < tiles && viewer.tokens > 0; ++i, t = (t + 1) % tiles){
+            const EncodedTile &tile = encoded[t];
+            if(tile.generation <= viewer.sent[t]) continue;
+            message.bytes.push_back((Uint8)(t % tilesX));
+            message.bytes.push_back((Uint8)((t % tilesX) >> 8));
+            message.bytes.push_back((Uint8)(t/tilesX));
+            message.bytes.push_back((Uint8)((t/tilesX) >> 8));
+            message.put8((Uint8)tile.codec);
+            message.put32((Uint32)tile.payload.size());
+            message.putBytes(tile.payload.data(), tile.payload.size());
+            viewer.tokens -= (double)tile.payload.size() + 9;
+            viewer.sent[t] = tile.generation;
+            ++count;
+        }
+        viewer.cursor = t;
+        if(count == 0) return;
+        for(int s = 0; s < 32; s += 8) message.bytes[9 + s/8] = (Uint8)(count >> s);
+        viewer.connection->queue(message.bytes.data(), message.bytes.size());
+        viewer.connection->flush();
+        tilesSent += count;
+        bytesSent += message.bytes.size();
+    }
+
+    void networkLoop(){
+        while(!stopping){
+            fd_set reads, writes;
+            FD_ZERO(&reads);
+            FD_ZERO(&writes);
+            FD_SET(listener, &reads);
+            NetSocket top = listener;
+            for(Viewer &viewer: viewers){
+                FD_SET(viewer.connection->handle, &reads);    // viewers send nothing: readable means closed
+                if(viewer.connection->pendingOutput() > 0) FD_SET(viewer.connection->handle, &writes);
+                top = std::max(top, viewer.connection->handle);
+            }
+            timeval timeout = {0, VIEWER_POLL_MS*1000};
+            if(select((int)top + 1, &reads, &writes, nullptr, &timeout) < 0) SDL_Delay(VIEWER_POLL_MS);
+
+            Uint64 now = SDL_GetPerformanceCounter();
+            if(FD_ISSET(listener, &reads)){
+                NetSocket s;
+                while((s = netAccept(listener)) != NET_INVALID_SOCKET){
+                    Viewer viewer;
+                    viewer.connection = std::make_unique<NetConnection>(s);
+                    viewer.sent.assign(encoded.size(), 0);
+                    viewer.lastRefill = now;
+                    JournalEncoder hello;
+                    hello.put8((Uint8)ViewerMessage::HELLO);
+                    hello.put32((Uint32)width);
+                    hello.put32((Uint32)height);
+                    hello.put32((Uint32)VIEWER_TILE_SIZE);
+                    viewer.connection->queue(hello.bytes.data(), hello.bytes.size());
+                    viewers.push_back(std::move(viewer));
+                }
+                viewerCount = (int)viewers.size();
+                viewerPeak = std::max(viewerPeak, (int)viewers.size());
+            }
+            encodeChangedTiles();
+            for(Viewer &viewer: viewers){
+                if(FD_ISSET(viewer.connection->handle, &reads)){
+                    viewer.connection->receive();
+                    std::vector<Uint8> ignored;
+                    while(viewer.connection->nextMessage(ignored)){}
+                }
+                if(!viewer.connection->closed) serve(viewer, now);
+            }
+            size_t before = viewers.size();
+            viewers.erase(std::remove_if(viewers.begin(), viewers.end(), [](const Viewer &viewer){return viewer.connection->closed;}), viewers.end());
+            if(viewers.size() != before) viewerCount = (int)viewers.size();
+        }
+    }
+
+public:
+    ViewerBroadcast() = default;
+    ~ViewerBroadcast(){stop();}
+    ViewerBroadcast(const ViewerBroadcast&) = delete;
+    ViewerBroadcast& operator=(const ViewerBroadcast&) = delete;
+
+    // Listens for viewers at broadcast_address; pixels is the canvas as it is now
+    bool start(const std::string &broadcast_address, const Uint32* pixels, int canvas_width, int canvas_height){
+        listener = netListen(broadcast_address);
+        if(listener == NET_INVALID_SOCKET) return false;
+        address = broadcast_address;
+        width = canvas_width;
+        height = canvas_height;
+        tilesX = (width + VIEWER_TILE_SIZE - 1)/VIEWER_TILE_SIZE;
+        tilesY = (height + VIEWER_TILE_SIZE - 1)/VIEWER_TILE_SIZE;
+        frame.assign(pixels, pixels + (size_t)width*height);
+        generation = 1;
+        tileGeneration.assign((size_t)tilesX*tilesY, generation);
+        encoded.assign(tileGeneration.size(), EncodedTile());
+        scratch.resize(tileGeneration.size()*VIEWER_TILE_SIZE*VIEWER_TILE_SIZE);
+        stopping = false;
+        network = std::thread(&ViewerBroadcast::networkLoop, this);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Viewers: broadcasting at %s", address.c_str());
+        return true;
+    }
+
+    bool isRunning(){return network.joinable();}
+    int getViewerCount(){return viewerCount;}
+
+    // Takes the part of the canvas that changed this frame; cheap, call it every frame
+    void publish(const Uint32* pixels, SDL_Rect dirty){
+        if(!isRunning() || SDL_RectEmpty(&dirty)) return;
+        Uint64 start = SDL_GetPerformanceCounter();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++generation;
+            for(int y = dirty.y; y < dirty.y + dirty.h; ++y) memcpy(frame.data() + (size_t)y*width + dirty.x, pixels + (size_t)y*width + dirty.x, (size_t)dirty.w*sizeof(Uint32));
+            for(int ty = dirty.y/VIEWER_TILE_SIZE; ty <= (dirty.y + dirty.h - 1)/VIEWER_TILE_SIZE; ++ty){
+                for(int tx = dirty.x/VIEWER_TILE_SIZE; tx <= (dirty.x + dirty.w - 1)/VIEWER_TILE_SIZE; ++tx) tileGeneration[tileIndex(tx, ty)] = generation;
+            }
+        }
+        Uint64 ticks = SDL_GetPerformanceCounter() - start;
+        ++publishCount;
+        publishTicks += ticks;
+        publishMaxTicks = std::max(publishMaxTicks, ticks);
+    }
+
+    void stop(){
+        if(!isRunning()) return;
+        stopping = true;
+        network.join();
+        viewers.clear();
+        netClose(listener);
+        listener = NET_INVALID_SOCKET;
+        if(netIsUnixAddress(address)) remove(address.substr(5).c_str());
+        double ms = 1000.0/SDL_GetPerformanceFrequency();
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Viewers: at most %d watching, %llu tiles (%llu KB) sent, %llu times a viewer was backed up; publish %.3f ms on average, %.3f ms at most over %llu frames", viewerPeak, (unsigned long long)tilesSent, (unsigned long long)(bytesSent >> 10), (unsigned long long)backedUp, publishCount > 0 ? publishTicks*ms/publishCount : 0.0, publishMaxTicks*ms, (unsigned long long)publishCount);
+    }
+};
+
+// The receiving end: keeps a copy of the broadcast canvas up to date
+class ViewerClient{
+private:
+    NetConnection connection;
+    std::vector<Uint8> message;
+    std::vector<Uint32> pixels;
+    SDL_Rect dirty{0, 0, 0, 0};
+    int width{0}, height{0}, tileSize{0};
+    bool damaged{false};
+
+    void handleMessage(){
+        JournalDecoder in(message.data(), message.size());
+        ViewerMessage kind = (ViewerMessage)in.get8();
+        if(kind == ViewerMessage::HELLO){
+            width = (int)in.get32();
+            height = (int)in.get32();
+            tileSize = (int)in.get32();
+            if(!in.ok() || width <= 0 || height <= 0 || width > 32768 || height > 32768 || tileSize <= 0){
+                connection.closed = true;
+                return;
+            }
+            pixels.assign((size_t)width*height, 0xFFFFFFFF);
+            return;
+        }
+        if(kind != ViewerMessage::TILES || tileSize == 0) return;
+        lastGeneration = in.get64();
+        Uint32 count = in.get32();
+        for(Uint32 i = 0; i < count && in.ok(); ++i){
+            int tx = in.get8() | in.get8() << 8;
+            int ty = in.get8() | in.get8() << 8;
+            TileCodec codec = (TileCodec)in.get8();
+            Uint32 size = in.get32();
+            const Uint8* payload = in.getBytes(size);
+            SDL_Rect rect = {tx*tileSize, ty*tileSize, 0, 0};
+            if(payload == nullptr || rect.x >= width || rect.y >= height) break;
+            rect.w = std::min(tileSize, width - rect.x);
+            rect.h = std::min(tileSize, height - rect.y);
+            if(!decodePaintTile(codec, payload, size, pixels.data() + (size_t)rect.y*width + rect.x, width, rect.w, rect.h)) damaged = true;
+            if(SDL_RectEmpty(&dirty)) dirty = rect;
+            else SDL_UnionRect(&dirty, &rect, &dirty);
+            ++tilesReceived;
+        }
+        ++updatesReceived;
+    }
+
+public:
+    Uint64 lastGeneration{0}, updatesReceived{0}, tilesReceived{0};
+
+    bool connect(const std::string &address){
+        connection.handle = netConnect(address);
+        return connection.handle != NET_INVALID_SOCKET;
+    }
+
+    NetSocket getSocket(){return connection.handle;}
+    bool isConnected(){return connection.handle != NET_INVALID_SOCKET && !connection.closed;}
+    bool isDamaged(){return damaged;}
+    Uint64 getBytesReceived(){return connection.bytesReceived;}
+    int getWidth(){return width;}
+    int getHeight(){return height;}
+    const Uint32* getPixels(){return pixels.data();}
+
+    // Reads and decodes whatever has arrived; false once the broadcast is gone
+    bool poll(){
+        if(connection.handle == NET_INVALID_SOCKET) return false;
+        connection.receive();
+        while(connection.nextMessage(message)) handleMessage();
+        return !connection.closed;
+    }
+
+    // Region updated since the last call
+    SDL_Rect takeDirty(){
+        SDL_Rect rect = dirty;
+        dirty = {0, 0, 0, 0};
+        return rect;
+    }
+};
+
+// --viewer-loadtest: many viewers in one thread of this process, every
+// fourth one reading only now and then like a viewer on a slow link
+class ViewerLoadTest{
+private:
+    std::vector<std::unique_ptr<ViewerClient>> clients;
+    std::thread runner;
+    std::atomic<bool> stopping{false};
+
+    void run(){
+        Uint64 last_slow_read = 0;
+        while(!stopping){
+            Uint64 now = SDL_GetTicks64();
+            bool slow_turn = now - last_slow_read >= (Uint64)VIEWER_SLOW_CLIENT_MS;
+            if(slow_turn) last_slow_read = now;
+            fd_set reads;
+            FD_ZERO(&reads);
+            NetSocket top = 0;
+            for(size_t i = 0; i < clients.size(); ++i){
+                if(!clients[i]->isConnected() || (i % 4 == 3 && !slow_turn)) continue;
+                FD_SET(clients[i]->getSocket(), &reads);
+                top = std::max(top, clients[i]->getSocket());
+            }
+            timeval timeout = {0, VIEWER_POLL_MS*1000};
+            if(select((int)top + 1, &reads, nullptr, nullptr, &timeout) < 0) SDL_Delay(VIEWER_POLL_MS);
+            for(size_t i = 0; i < clients.size(); ++i){
+                if(clients[i]->isConnected() && FD_ISSET(clients[i]->getSocket(), &reads)) clients[i]->poll();
+            }
+        }
+    }
+
+public:
+    ~ViewerLoadTest(){stop();}
+
+    bool start(const std::string &address, int count){
+        for(int i = 0; i < count; ++i){
+            clients.push_back(std::make_unique<ViewerClient>());
+            if(!clients.back()->connect(address)) return false;
+        }
+        stopping = false;
+        runner = std::thread(&ViewerLoadTest::run, this);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Viewer load test: %d viewers connected to %s", count, address.c_str());
+        return true;
+    }
+
+    // Compares every viewer's copy with pixels (the host canvas now) and logs what each got
+    void stop(const Uint32* pixels = nullptr, int width = 0, int height = 0){
+        if(!runner.joinable()) return;
+        SDL_Delay(2*VIEWER_SLOW_CLIENT_MS);    // the last frames still on their way
+        stopping = true;
+        runner.join();
+        int matching = 0;
+        Uint64 least = ~0ull, most = 0, total = 0;
+        for(size_t i = 0; i < clients.size(); ++i){
+            clients[i]->poll();
+            if(pixels != nullptr && clients[i]->getWidth() == width && clients[i]->getHeight() == height && memcmp(clients[i]->getPixels(), pixels, (size_t)width*height*sizeof(Uint32)) == 0) ++matching;
+            least = std::min(least, clients[i]->getBytesReceived());
+            most = std::max(most, clients[i]->getBytesReceived());
+            total += clients[i]->getBytesReceived();
+        }
+        if(!clients.empty()) SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Viewer load test: %zu viewers, %llu to %llu KB received each (%llu KB in all), %d up to date at exit", clients.size(), (unsigned long long)(least >> 10), (unsigned long long)(most >> 10), (unsigned long long)(total >> 10), matching);
+        clients.clear();
+    }
+};
+
+#endif
@@ -2,13 +2,41 @@
 #include <vector>
 #include <queue>
 #include <deque>
+#include <memory>
 #include <string>
 #include <string.h>
+#include <atomic>
+#include <csignal>
+#include <thread>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include "vec2.h"
 #include "shape.h"
 #include "button.h"
+#include "canvas.h"
+#include "pool.h"
+#include "arena.h"
+#include "line.h"
+#include "brush.h"
+#include "jobs.h"
+#include "scheduler.h"
+#include "input.h"
+#include "latency.h"
+#include "smoothing.h"
+#include "curvefit.h"
+#include "scene.h"
+#include "export.h"
+#include "svg.h"
+#include "qoi.h"
+#include "paintdoc.h"
+#include "imageload.h"
+#include "autosave.h"
+#include "journal.h"
+#include "timelapse.h"
+#include "gif.h"
+#include "sync.h"
+#include "viewer.h"
+#include "service.h"
 #include "tinyfiledialogs.h"
 using namespace std;
  
@@ -19,6 +47,12 @@ const int TARGET_FPS = 240;
 const int FRAME_DELAY_MS = (1000/TARGET_FPS);
 const double ERASER_SIDE_LEN = 15;
 const double g = 0.5;
+const double SLICE_BUDGET_MS = 4.0;    // per-frame time given to long running operations
+const size_t STROKE_RESERVED_POINTS = 1024;
+const double STROKE_FIT_TOLERANCE = 0.75;    // max distance in pixels between a scribble and its fitted curve
+const double MIN_STROKE_WIDTH = 1.0;
+const double MAX_STROKE_WIDTH = JOURNAL_MAX_WIDTH;
+const long long FILL_SLICE_CHECK_INTERVAL = 4096;    // pixels filled between budget checks (power of 2)
 
 enum class ColorsEnum: int{
     BLACK,
@@ -59,6 +93,18 @@ enum class ToolsEnum: int{
     NUM_TOOLS
 };
 
+const char* toolName(ToolsEnum tool){
+    switch(tool){
+        case ToolsEnum::ERASER: return "eraser";
+        case ToolsEnum::BUCKETFILL: return "bucketfill";
+        case ToolsEnum::LINE: return "line";
+        case ToolsEnum::SCRIBBLE: return "scribble";
+        case ToolsEnum::RECT: return "rect";
+        case ToolsEnum::ELLIPSE: return "ellipse";
+        default: return "other";
+    }
+}
+
 typedef struct Buttons{
     vector<Button*> tool_buttons;
     vector<Button*> color_buttons;
@@ -86,7 +132,6 @@ typedef struct Color{
 } Color;
 
 typedef struct Texture{
-    SDL_Texture* canvas_texture{nullptr};
     SDL_Texture* canvas_overlay_texture{nullptr};
     SDL_Texture* toolbox_texture{nullptr};
     SDL_Texture* toolbox_overlay_texture{nullptr};
@@ -95,15 +140,45 @@ typedef struct Texture{
 typedef struct Object{
     Rect draw_rect;
     Ellipse draw_ellipse;
-    SDL_FRect eraser_rect;
 } Object;
 
+// Compact description of a committed scribble, enough to re-render it at any scale
+typedef struct StrokeRecord{
+    vector<CubicBezier> curve;    // fitted brush path, empty for edits that are not scribbles
+    BrushSettings brush;
+    SDL_Color color;
+} StrokeRecord;
+
+// One object of the vector scene before and after an edit
+typedef struct SceneChange{
+    int id;
+    bool was_alive;
+    bool is_alive;
+    SceneObject before;
+    SceneObject after;
+} SceneChange;
+
+typedef struct SceneEdit{
+    Uint32 generation{0};    // the vector mode session the changes belong to
+    vector<SceneChange> changes;    // empty for raster edits
+} SceneEdit;
+
 typedef struct History{
-    deque<SDL_Texture*> draw_history;
+    deque<shared_ptr<BufferLease>> draw_history;    // canvas snapshots, leased from resource_pool; shared while a joining peer's copy is encoded
+    deque<StrokeRecord> stroke_history;    // the scribble that produced each snapshot
+    deque<SceneEdit> scene_history;    // what each snapshot changed in the vector scene
+    deque<int> document_state;    // state of document still to be decoded into each snapshot, -1 once in memory
+    shared_ptr<PaintDocument> document;    // the opened project file, mapped until every snapshot is decoded
     int curr_history_idx{0};
     int max_valid_history_idx{0};
 } History;
 
+typedef struct Stroke{
+    StrokeArena arena;    // reset at SDL_MOUSEBUTTONUP
+    ArenaVector<PointerSample> samples{ArenaAllocator<PointerSample>(&arena)};    // every raw sample of the active scribble/eraser stroke
+    ArenaVector<vec2> path{ArenaAllocator<vec2>(&arena)};    // positions the brush was moved to, after smoothing
+} Stroke;
+
 typedef struct Cursor{
     SDL_Cursor* draw_cursor{nullptr};
 } Cursor;
@@ -112,11 +187,39 @@ typedef struct Context{
     Buttons buttons;
     Key key;
     Mouse mouse;
+    MotionCoalescer motion;    // pending preview position of this frame
     Color color;
     Texture texture;
     Object object;
     History history;
+    Stroke stroke;
+    StrokeStyle stroke_style;    // width, caps and joins of the Line tool; its width is also the brush size
+    BrushEngine brush;    // dab based Scribble tool
+    StrokeStabilizer stabilizer;    // optional smoothing of the Scribble path
+    StrokePredictor predictor;    // short extrapolation of the Scribble path, overlay only
     Cursor cursor;
+    Scheduler scheduler;
+    ImageDecoder image_decoder;    // threads of images being opened, joined before SDL quits
+    LatencyTracker latency;    // input-to-present histograms per tool
+    RecoverySession recovery;    // names of this session's recovery file and journal, locked while it runs
+    Autosave autosave;    // recovery file, rewritten tile by tile while idle
+    Journal journal;    // every committed operation since the recovery file was written
+    int journal_base{0};    // history step the recovery file holds; replay starts here
+    int journal_max{0};    // last history step replay can recreate from the records
+    Uint64 journal_checkpoint{0};    // last sequence the recovery file is known to cover
+    TimelapseRecorder timelapse;    // --timelapse: the canvas after every step, as video
+    SyncSession sync;    // --host / --join: committed operations shared with other instances
+    deque<SyncOperation> sync_pending;    // local operations drawn but not ordered by the host yet
+    bool sync_applying{false};    // applying an ordered operation, nothing to share
+    ViewerBroadcast viewers;    // --broadcast: the canvas streamed to read-only viewers
+    ViewerClient view;    // --view: this window only shows a broadcast canvas
+    Canvas* canvas{nullptr};
+    Scene* scene{nullptr};    // committed objects, kept while vector mode is on
+    bool vector_mode{false};
+    Uint32 scene_generation{0};
+    SceneEdit scene_edit;    // changes of the edit in progress
+    int moving_object{-1};    // Ctrl+drag in vector mode
+    SceneObject moving_original;
     bool is_drawing{false};
     ToolsEnum selected_tool = ToolsEnum::LINE;
     char filename[256] = "";
@@ -124,6 +227,8 @@ typedef struct Context{
 
 SDL_Window* window{nullptr};
 SDL_Renderer* renderer{nullptr};
+ResourcePool resource_pool;    // recycled pixel buffers
+JobSystem* job_system{nullptr};    // shared worker pool for pixel kernels (export, GIF frames, image loading, .paint tiles)
 
 SDL_Texture* ellipse_solid_texture;
 SDL_Texture* ellipse_outline_texture;
@@ -134,24 +239,6 @@ pair<double,double> solveQuadratic(double a, double b, double c){
     return {(-b-sqrt(D))/(2*a), (-b+sqrt(D))/(2*a)};
 }
 
-SDL_Texture* copyTexture(SDL_Texture* texture, SDL_Renderer* renderer){
-    int texture_width, texture_height;
-    Uint32 format;
-    SDL_BlendMode texture_blend_mode;
-    Uint8 texture_alpha_mod;
-    if(SDL_QueryTexture(texture, &format, nullptr, &texture_width, &texture_height) < 0) return nullptr;
-    SDL_GetTextureBlendMode(texture, &texture_blend_mode);
-    SDL_GetTextureAlphaMod(texture, &texture_alpha_mod);
-    SDL_Texture* newTexture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_TARGET, texture_width, texture_height);
-    SDL_SetTextureBlendMode(newTexture, texture_blend_mode);
-    SDL_SetTextureAlphaMod(newTexture, texture_alpha_mod);
-    SDL_Texture* prev_rendering_target = SDL_GetRenderTarget(renderer);
-    SDL_SetRenderTarget(renderer, newTexture);
-    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-    SDL_SetRenderTarget(renderer, prev_rendering_target);
-    return newTexture;    
-}
-
 // initializing static variables
 SDL_Texture* Ellipse::fillTexture{nullptr};
 SDL_Texture* Ellipse::outlineTexture{nullptr};
@@ -528,114 +615,940 @@ void updateToolBoxOverlay(Context &context, SDL_Renderer* renderer){
         // SDL_RenderFillRectF(renderer, &temp_rect);
         Ellipse::drawEllipseSolid(renderer, selection_fill_color, temp_rect);
     }
+
+    // stroke width indicator under the line/scribble buttons
+    SDL_FRect width_rect;
+    double indicator_diameter = min(context.stroke_style.width, 20.0);
+    width_rect.w = width_rect.h = indicator_diameter;
+    width_rect.x = (context.buttons.tool_buttons[static_cast<int>(ToolsEnum::LINE)]->getPosX() + context.buttons.tool_buttons[static_cast<int>(ToolsEnum::SCRIBBLE)]->getPosX() + context.buttons.tool_buttons[static_cast<int>(ToolsEnum::SCRIBBLE)]->getWidth())/2 - indicator_diameter/2;
+    width_rect.y = context.buttons.tool_buttons[static_cast<int>(ToolsEnum::LINE)]->getPosY() + context.buttons.tool_buttons[static_cast<int>(ToolsEnum::LINE)]->getHeight() + 12 - indicator_diameter/2;
+    Ellipse::drawEllipseSolid(renderer, context.color.outline_color, width_rect);
+
+    if(context.scheduler.busy()){
+        int toolbox_width, toolbox_height;
+        SDL_QueryTexture(context.texture.toolbox_overlay_texture, nullptr, nullptr, &toolbox_width, &toolbox_height);
+        SDL_FRect progress_rect;
+        progress_rect.x = 0;
+        progress_rect.y = toolbox_height - 4;
+        progress_rect.w = toolbox_width*context.scheduler.currentProgress();
+        progress_rect.h = 4;
+        SDL_SetRenderDrawColor(renderer, selection_outline_color.r, selection_outline_color.g, selection_outline_color.b, selection_outline_color.a);
+        SDL_RenderFillRectF(renderer, &progress_rect);
+    }
 }
 
-void saveHistory(Context &context, SDL_Renderer* renderer){
-    if(context.history.curr_history_idx == context.history.draw_history.size()-1){
-        context.history.draw_history.push_back(copyTexture(context.texture.canvas_texture, renderer));
-        ++context.history.curr_history_idx;
+// GPU preview of a Line tool stroke on the overlay: a quad of the stroke width
+void drawLinePreview(SDL_Renderer* renderer, vec2 a, vec2 b, const StrokeStyle &style, SDL_Color color){
+    vec2 d = b - a;
+    double len = norm(d);
+    if(style.width <= 1.0 || len < 1e-9){
+        SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+        SDL_RenderDrawLineF(renderer, a.x, a.y, b.x, b.y);
+        return;
     }
-    else{
-        SDL_DestroyTexture(context.history.draw_history[context.history.curr_history_idx+1]);
-        context.history.draw_history[++context.history.curr_history_idx] = copyTexture(context.texture.canvas_texture, renderer);
+    vec2 n = (style.width/2)*vec2(-d.y/len, d.x/len);
+    vec2 corners[4] = {a + n, b + n, b - n, a - n};
+    SDL_Vertex vertices[4];
+    for(int i = 0; i < 4; ++i){
+        vertices[i].position = {(float)corners[i].x, (float)corners[i].y};
+        vertices[i].color = color;
+        vertices[i].tex_coord = {0, 0};
+    }
+    const int indices[6] = {0, 1, 2, 0, 2, 3};
+    SDL_RenderGeometry(renderer, nullptr, vertices, 4, indices, 6);
+}
+
+// Where the shape being drawn ends: context.mouse.curr_pos, or with Shift held
+// the corner of a square (Rect, Ellipse) or the end of a horizontal, vertical or
+// diagonal line (Line)
+vec2 snappedShapeEnd(Context &context){
+    vec2 start = context.mouse.initial_pos, end = context.mouse.curr_pos;
+    if(!context.key.shift_pressed) return end;
+    if(context.selected_tool == ToolsEnum::RECT || context.selected_tool == ToolsEnum::ELLIPSE){
+        int side_len = (int)min(abs(end.x - start.x), abs(end.y - start.y));
+        return vec2(start.x + (end.x > start.x ? 1 : -1)*side_len, start.y + (end.y > start.y ? 1 : -1)*side_len);
+    }
+    if(context.selected_tool != ToolsEnum::LINE) return end;
+    double d_x = abs(end.x - start.x);
+    double d_y = abs(end.y - start.y);
+    if(d_x == 0 && d_y == 0) return end;    // a click without moving: nothing to snap
+    if(d_x < 0.4*d_y) return vec2(start.x, end.y);
+    if(d_y < 0.4*d_x) return vec2(end.x, start.y);
+    return vec2(start.x + min(d_x, d_y)*(end.x - start.x)/d_x, start.y + min(d_x, d_y)*(end.y - start.y)/d_y);
+}
+
+// Redraws the Rect, Ellipse or Line preview on the overlay for context.mouse.curr_pos
+void updateShapePreview(Context &context){
+    if(context.selected_tool == ToolsEnum::RECT){
+        if(context.is_drawing){
+            vec2 modified_mouse_pos = snappedShapeEnd(context);
+            context.object.draw_rect.setWidth(abs(modified_mouse_pos.x-context.mouse.initial_pos.x));
+            context.object.draw_rect.setHeight(abs(modified_mouse_pos.y-context.mouse.initial_pos.y));
+            context.object.draw_rect.setPos((context.mouse.initial_pos.x+modified_mouse_pos.x)/2, (context.mouse.initial_pos.y+modified_mouse_pos.y)/2);
+            SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
+            SDL_SetRenderDrawColor(renderer, context.color.fill_color.r, context.color.fill_color.g, context.color.fill_color.b, 0);
+            SDL_RenderClear(renderer);
+            context.object.draw_rect.draw(renderer);
+        }
+    }
+
+    else if(context.selected_tool == ToolsEnum::ELLIPSE){
+        if(context.is_drawing){
+            vec2 modified_mouse_pos = snappedShapeEnd(context);
+            context.object.draw_ellipse.setRadii(abs(modified_mouse_pos.x-context.mouse.initial_pos.x)/2,abs(modified_mouse_pos.y-context.mouse.initial_pos.y)/2);
+            context.object.draw_ellipse.setPos((context.mouse.initial_pos.x+modified_mouse_pos.x)/2, (context.mouse.initial_pos.y+modified_mouse_pos.y)/2);
+            SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
+            SDL_SetRenderDrawColor(renderer, context.color.fill_color.r, context.color.fill_color.g, context.color.fill_color.b, 0);
+            SDL_RenderClear(renderer);
+            context.object.draw_ellipse.draw(renderer);
+        }
+    }
+
+    else if(context.selected_tool == ToolsEnum::LINE){
+        if(context.is_drawing){
+            vec2 modified_mouse_pos = snappedShapeEnd(context);
+            SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+            SDL_RenderClear(renderer);
+            drawLinePreview(renderer, context.mouse.initial_pos, modified_mouse_pos, context.stroke_style, context.color.outline_color);
+        }
+    }
+}
+
+// Applies the coalesced preview motion, if any, before the next non-motion event or the frame's render
+void flushMotion(Context &context){
+    PointerSample sample;
+    if(!context.motion.take(sample)) return;
+    context.mouse.curr_pos = sample.pos;
+    if(context.moving_object >= 0) context.scene->update(*context.canvas, context.moving_object, translateSceneObject(context.moving_original, context.mouse.curr_pos - context.mouse.initial_pos));
+    else updateShapePreview(context);
+}
+
+// Draws the predicted continuation of the Scribble stroke on the overlay. The
+// canvas only ever receives real samples; the guess is redrawn every frame.
+void updateStrokePrediction(Context &context){
+    SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    vec2 predicted;
+    if(!context.predictor.predict(predicted)) return;
+    StrokeStyle style;
+    style.width = context.brush.settings.size;
+    drawLinePreview(renderer, context.stabilizer.getPos(), predicted, style, context.color.outline_color);
+}
+
+void beginStroke(Context &context, const PointerSample &sample){
+    context.stroke.samples.reserve(STROKE_RESERVED_POINTS);
+    context.stroke.samples.push_back(sample);
+    context.stroke.path.reserve(STROKE_RESERVED_POINTS);
+    context.stroke.path.push_back(sample.pos);
+}
+
+void endStroke(Context &context){
+    SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Stroke: %zu samples, %zu arena bytes, %llu heap allocations", context.stroke.samples.size(), context.stroke.arena.bytesUsed(), (unsigned long long)context.stroke.arena.getHeapAllocations());
+    ArenaVector<PointerSample>(context.stroke.samples.get_allocator()).swap(context.stroke.samples);
+    ArenaVector<vec2>(context.stroke.path.get_allocator()).swap(context.stroke.path);    // release the storage before the arena is reused
+    context.stroke.arena.reset();
+}
+
+// A buffer for one history snapshot of the canvas
+shared_ptr<BufferLease> newSnapshotBuffer(Context &context){
+    return make_shared<BufferLease>(resource_pool.acquireBuffer((size_t)context.canvas->getPitch()*context.canvas->getHeight()));
+}
+
+// The pixels of history step idx; steps of an opened project are decoded from the file on first use
+Uint32* historySnapshot(Context &context, int idx){
+    History &history = context.history;
+    if(history.document_state[idx] >= 0){
+        if(!history.draw_history[idx]) history.draw_history[idx] = newSnapshotBuffer(context);
+        if(!history.document->readState(history.document_state[idx], history.draw_history[idx]->as<Uint32>(), context.canvas->getWidth(), context.canvas->getHeight(), *job_system)){
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Project file: undo state %d is damaged", history.document_state[idx]);
+        }
+        history.document_state[idx] = -1;
+        if(find_if(history.document_state.begin(), history.document_state.end(), [](int state){return state >= 0;}) == history.document_state.end()) history.document = nullptr;
+    }
+    return history.draw_history[idx]->as<Uint32>();
+}
+
+void saveHistory(Context &context){
+    if(context.history.curr_history_idx == context.history.draw_history.size()-1){
+        context.history.draw_history.push_back(newSnapshotBuffer(context));
+        context.history.stroke_history.emplace_back();
+        context.history.scene_history.emplace_back();
+        context.history.document_state.push_back(-1);
     }
+    int idx = ++context.history.curr_history_idx;
+    // a redo step is overwritten in place, unless a joining peer's copy of the history still reads it
+    if(!context.history.draw_history[idx] || context.history.draw_history[idx].use_count() > 1) context.history.draw_history[idx] = newSnapshotBuffer(context);
+    context.history.document_state[idx] = -1;
+    context.canvas->store(context.history.draw_history[idx]->as<Uint32>());
+    context.history.stroke_history[context.history.curr_history_idx] = StrokeRecord();
+    context.history.scene_history[context.history.curr_history_idx] = move(context.scene_edit);
+    context.scene_edit = SceneEdit();
     context.history.max_valid_history_idx = context.history.curr_history_idx;
+    context.journal_max = context.history.curr_history_idx;
+    if(!context.timelapse.isTimed()) context.timelapse.capture(context.canvas->getPixels());
     return;
 }
 
-inline void handleUndo(Context &context, SDL_Renderer* renderer){
-    if(context.history.curr_history_idx > 0) context.texture.canvas_texture = copyTexture(context.history.draw_history[--context.history.curr_history_idx], renderer);
+// Journals the whole canvas: for edits that can't be replayed from their
+// inputs, and for undo/redo to steps the replay would not have. The journal
+// writer encodes it, here it is only copied.
+void journalState(Context &context){
+    if(!context.journal.isOpen()) return;
+    context.journal.appendImage(JournalOp::STATE, context.canvas->getPixels(), context.canvas->getWidth(), context.canvas->getHeight());
+    context.journal_base = context.journal_max = context.history.curr_history_idx;
+}
+
+// Replays (forward) or reverts a history step in the vector scene, after the
+// snapshot it leads to has been loaded; only the scene state changes here.
+void applySceneEdit(Context &context, const SceneEdit &edit, bool forward){
+    if(!context.vector_mode) return;
+    if(edit.changes.empty() || edit.generation != context.scene_generation){
+        // a raster step from before vector mode was entered: start the scene over from the pixels it leaves
+        context.scene->reset(context.canvas->getPixels());
+        return;
+    }
+    if(forward) for(auto &change: edit.changes) context.scene->restore(change.id, change.after, change.is_alive);
+    else for(auto it = edit.changes.rbegin(); it != edit.changes.rend(); ++it) context.scene->restore(it->id, it->before, it->was_alive);
+}
+
+// In a shared session a local operation is only drawn (local echo) and sent;
+// it becomes a history step, and a journal record, once the host has ordered
+// it. False outside a session: the caller commits it itself.
+bool shareOperation(Context &context, JournalOp op, const JournalEncoder &payload){
+    if(!context.sync.isActive() || context.sync_applying) return false;
+    context.sync.submit(op, payload);
+    context.sync_pending.push_back({op, 0, context.sync.getPeerId(), payload.bytes});
+    return true;
+}
+
+// Draws a committed shape or line and saves it as a history step; in vector
+// mode the object also stays in the scene. Scribbles are already on the canvas (drawn)
+// as brush dabs; in vector mode those are redrawn from the fitted curve the scene
+// keeps, so later redraws of the area (moves, erases) match them pixel for pixel.
+void commitObject(Context &context, SceneObject object, bool drawn = false){
+    if(!drawn){
+        context.scene->renderObject(*context.canvas, object);
+        JournalEncoder payload;
+        encodeSceneObject(payload, object);
+        if(shareOperation(context, JournalOp::OBJECT, payload)) return;
+        context.journal.append(JournalOp::OBJECT, payload);
+    }
+    if(context.vector_mode){
+        context.scene_edit.generation = context.scene_generation;
+        SDL_Rect bounds = sceneObjectBounds(object);    // covers the dabs too: they lie within STROKE_FIT_TOLERANCE of the curve
+        int id = context.scene->add(object);
+        if(drawn) context.scene->renderRegion(*context.canvas, bounds);
+        context.scene_edit.changes.push_back({id, false, true, SceneObject(), move(object)});
+    }
+    saveHistory(context);
+}
+
+// Vector mode eraser: deletes every object under pos
+void eraseObjectsAt(Context &context, vec2 pos){
+    int id;
+    while((id = context.scene->hitTest(pos)) >= 0){
+        SceneObject object = context.scene->get(id);
+        context.scene->remove(*context.canvas, id);
+        context.scene_edit.generation = context.scene_generation;
+        context.scene_edit.changes.push_back({id, true, false, object, move(object)});
+    }
+}
+
+// Vector mode bucket fill: recolours the topmost object under pos, false if there is none
+bool recolorObjectAt(Context &context, vec2 pos, SDL_Color color){
+    int id = context.scene->hitTest(pos);
+    if(id < 0) return false;
+    SceneObject before = context.scene->get(id);
+    SceneObject after = before;
+    if(after.type == SceneObjectType::RECT || after.type == SceneObjectType::ELLIPSE){
+        after.fill_color = color;
+        after.filled = true;
+    }
+    else after.outline_color = color;
+    context.scene->update(*context.canvas, id, after);
+    context.scene_edit.generation = context.scene_generation;
+    context.scene_edit.changes.push_back({id, true, true, move(before), move(after)});
+    return true;
+}
+
+inline void handleUndo(Context &context){
+    if(context.history.curr_history_idx > 0){
+        int undone_idx = context.history.curr_history_idx--;
+        context.canvas->load(historySnapshot(context, context.history.curr_history_idx));
+        applySceneEdit(context, context.history.scene_history[undone_idx], false);
+        if(context.history.curr_history_idx >= context.journal_base) context.journal.append(JournalOp::UNDO, JournalEncoder());
+        else journalState(context);
+    }
     return;
 }
 
-inline void handleRedo(Context &context, SDL_Renderer* renderer){
-    if(context.history.curr_history_idx < context.history.max_valid_history_idx) context.texture.canvas_texture = copyTexture(context.history.draw_history[++context.history.curr_history_idx], renderer);
+inline void handleRedo(Context &context){
+    if(context.history.curr_history_idx < context.history.max_valid_history_idx){
+        context.canvas->load(historySnapshot(context, ++context.history.curr_history_idx));
+        applySceneEdit(context, context.history.scene_history[context.history.curr_history_idx], true);
+        if(context.history.curr_history_idx <= context.journal_max) context.journal.append(JournalOp::REDO, JournalEncoder());
+        else journalState(context);
+    }
     return;
 }
 
-void saveTexture(SDL_Renderer* renderer, SDL_Texture* texture){
-    if(texture == nullptr) return;
-    int texture_width, texture_height;
-    SDL_BlendMode texture_blend_mode;
-    SDL_QueryTexture(texture, nullptr, nullptr, &texture_width, &texture_height);
-    SDL_Texture* prev_render_target = SDL_GetRenderTarget(renderer);
-    SDL_GetTextureBlendMode(texture, &texture_blend_mode);
-    SDL_Surface* surface = SDL_CreateRGBSurface(0, texture_width, texture_height, 32, 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
-    SDL_SetSurfaceBlendMode(surface, texture_blend_mode);
-    SDL_SetRenderTarget(renderer, texture);
-    SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_RGBA8888, surface->pixels, surface->pitch);
-    SDL_SetRenderTarget(renderer, prev_render_target);
+// The current pixels become the scene background either way
+void setVectorMode(Context &context, bool on){
+    context.vector_mode = on;
+    ++context.scene_generation;
+    context.scene->reset(context.canvas->getPixels());
+    JournalEncoder payload;
+    payload.put8(on ? 1 : 0);
+    context.journal.append(JournalOp::VECTOR_MODE, payload);
+}
 
-    const char *filetypes[] = { "*.png" };
+void clearHistory(Context &context){
+    context.history.draw_history.clear();
+    context.history.stroke_history.clear();
+    context.history.scene_history.clear();
+    context.history.document_state.clear();
+    context.history.document = nullptr;
+    context.history.curr_history_idx = 0;
+    context.history.max_valid_history_idx = 0;
+}
+
+// Starts a new document from what the canvas shows: one history step, no scene objects
+void resetHistory(Context &context){
+    clearHistory(context);
+    context.history.draw_history.push_back(newSnapshotBuffer(context));
+    context.canvas->store(context.history.draw_history.back()->as<Uint32>());
+    context.history.stroke_history.emplace_back();
+    context.history.scene_history.emplace_back();
+    context.history.document_state.push_back(-1);
+    ++context.scene_generation;
+    context.scene->reset(context.canvas->getPixels());
+}
+
+// Writes the canvas and its whole undo history as a .paint project
+bool saveDocument(Context &context, const char* path){
+    History &history = context.history;
+    int state_count = history.max_valid_history_idx + 1;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < state_count; ++i) historySnapshot(context, i);    // path may be the file that is still mapped
+    fill(history.document_state.begin(), history.document_state.end(), -1);    // redo states past the last edit are dead
+    history.document = nullptr;
+    bool ok = writePaintDocument(path, context.canvas->getWidth(), context.canvas->getHeight(), state_count, history.curr_history_idx, [&context](int state){
+        return (const Uint32*)historySnapshot(context, state);
+    }, *job_system);
+    if(!ok) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Cannot write project %s", path);
+    else SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Saved %s (%d undo states) in %.1f ms", path, state_count, (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency());
+    return ok;
+}
+
+// Maps a .paint project and shows its current state; the other undo states
+// are only decoded when undo/redo reaches them
+bool openDocument(Context &context, const char* path){
+    Uint64 start = SDL_GetPerformanceCounter();
+    auto document = make_shared<PaintDocument>();
+    if(!document->open(path)){
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s is not a valid project file", path);
+        return false;
+    }
+    if(document->getWidth() != context.canvas->getWidth() || document->getHeight() != context.canvas->getHeight()){
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Project is %dx%d, the canvas shows its top left corner", document->getWidth(), document->getHeight());
+    }
+    History &history = context.history;
+    clearHistory(context);
+    for(int state = 0; state < document->getStateCount(); ++state){
+        history.draw_history.emplace_back();
+        history.stroke_history.emplace_back();
+        history.scene_history.emplace_back();
+        history.document_state.push_back(state);
+    }
+    history.document = document;
+    history.curr_history_idx = document->getCurrentState();
+    history.max_valid_history_idx = document->getStateCount() - 1;
+    context.canvas->load(historySnapshot(context, history.curr_history_idx));
+    ++context.scene_generation;
+    context.scene->reset(context.canvas->getPixels());
+    journalState(context);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Opened %s (%d undo states) in %.1f ms", path, document->getStateCount(), (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency());
+    return true;
+}
+
+// A .paint project, or any picture SDL_image reads (decoded in the background).
+// Either replaces the drawing and its undo history, so that is confirmed first.
+void openPath(Context &context, const string &path){
+    if(context.history.max_valid_history_idx > 0 && tinyfd_messageBox("Open", "Opening replaces the drawing and its undo history. Continue?", "yesno", "question", 0) != 1) return;
+    if(path.size() >= 7 && path.substr(path.size()-6, 6) == ".paint"){
+        openDocument(context, path.c_str());
+        return;
+    }
+    auto loaded = make_shared<bool>(false);
+    context.scheduler.start("Open image", [&context, path, loaded](TimeSlice &slice){
+        return openImage(*context.canvas, *job_system, context.image_decoder, path, loaded, slice);
+    }, [&context, loaded](bool){
+        if(!*loaded) return;
+        resetHistory(context);
+        journalState(context);
+    });
+}
+
+void openFile(Context &context){
+    const char *filetypes[] = { "*.paint", "*.png", "*.qoi", "*.jpg", "*.jpeg", "*.bmp", "*.gif", "*.tga", "*.tif", "*.webp" };
+    const char *filename = tinyfd_openFileDialog("Open", "", 10, filetypes, "Projects and images", 0);
+    if(filename) openPath(context, filename);
+}
+
+// Streams the canvas into path through a PNGWriter or QOIWriter, a row per
+// slice. Rows are compressed straight from the CPU pixels: no GPU readback, no
+// copy of the image; the canvas is locked while the task runs. Removes the
+// partial file if cancelled.
+template<typename Writer>
+SlicedTask saveRows(Canvas &canvas, string path, TimeSlice &slice){
+    Uint64 start = SDL_GetPerformanceCounter();
+    Writer writer;
+    bool ok = writer.open(path.c_str(), canvas.getWidth(), canvas.getHeight());
+    for(int y = 0; y < canvas.getHeight() && ok && !slice.cancelled(); ++y){
+        ok = writer.writeRow(canvas.getRow(y));
+        co_await slice.yield((double)(y + 1)/canvas.getHeight());
+    }
+    if(slice.cancelled()){
+        writer.finish();
+        remove(path.c_str());
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Save cancelled");
+        co_return;
+    }
+    if(!writer.finish() || !ok){
+        remove(path.c_str());
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Cannot write %s", path.c_str());
+    }
+    else SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Saved %s in %.1f ms", path.c_str(), (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency());
+}
+
+// PNG or QOI of the pixels (encoded in the background), SVG of the scene or a
+// .paint project, by the extension of the name
+void saveCanvas(Context &context){
+    const char *filetypes[] = { "*.png", "*.qoi", "*.svg", "*.paint" };
     const char *filename = tinyfd_saveFileDialog(
         "Save Image",          // Dialog title
         "image.png",           // Default filename
-        1,                     // Number of file types
+        4,                     // Number of file types
         filetypes,             // File types array
         NULL                   // Optional description for the file types
     );
+    if (!filename) return;
 
-    if (filename) {
-        string filename_str(filename);
-        if(filename_str.size() < 5 || filename_str.substr(filename_str.size()-4, 4) != ".png") filename_str += ".png";
-        IMG_SavePNG(surface, filename_str.c_str()); 
+    string filename_str(filename);
+    if(filename_str.size() >= 7 && filename_str.substr(filename_str.size()-6, 6) == ".paint"){
+        saveDocument(context, filename_str.c_str());
+        return;
     }
+    if(filename_str.size() >= 5 && filename_str.substr(filename_str.size()-4, 4) == ".svg"){
+        if(!context.vector_mode) context.scene->reset(context.canvas->getPixels());
+        exportSVG(*context.scene, filename_str.c_str());
+        return;
+    }
+    if(filename_str.size() >= 5 && filename_str.substr(filename_str.size()-4, 4) == ".qoi"){
+        context.scheduler.start("Save", [&context, filename_str](TimeSlice &slice){
+            return saveRows<QOIWriter>(*context.canvas, filename_str, slice);
+        });
+        return;
+    }
+    if(filename_str.size() < 5 || filename_str.substr(filename_str.size()-4, 4) != ".png") filename_str += ".png";
+    context.scheduler.start("Save", [&context, filename_str](TimeSlice &slice){
+        return saveRows<PNGWriter>(*context.canvas, filename_str, slice);
+    });
+}
 
-    SDL_FreeSurface(surface);
+// Asks for a scale and a file, then re-rasterizes the scene into it in the background
+void exportScaledImage(Context &context){
+    const char* scale_text = tinyfd_inputBox("Export Image", "Scale factor (e.g. 2, 4, 10):", "2");
+    if(scale_text == nullptr) return;
+    double scale = atof(scale_text);
+    if(!(scale > 0) || scale > EXPORT_MAX_SCALE){
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Export: scale must be in (0, %g]", EXPORT_MAX_SCALE);
+        return;
+    }
+
+    const char *filetypes[] = { "*.png" };
+    const char *filename = tinyfd_saveFileDialog("Export Image", "export.png", 1, filetypes, NULL);
+    if(filename == nullptr) return;
+    string path(filename);
+    if(path.size() < 5 || path.substr(path.size()-4, 4) != ".png") path += ".png";
+
+    // in raster mode everything is background; vector mode keeps its objects so they are redrawn sharp
+    if(!context.vector_mode) context.scene->reset(context.canvas->getPixels());
+    context.scheduler.start("Export", [&context, scale, path](TimeSlice &slice){
+        return exportScaled(*context.scene, *job_system, scale, path, slice);
+    });
+}
+
+// Asks for a dithering mode and a file, then encodes the undo history up to
+// the current step as an animated GIF in the background, one frame per step
+void exportAnimation(Context &context){
+    const char* dither_text = tinyfd_inputBox("Export Animation", "Dithering (none, ordered, floyd):", "ordered");
+    if(dither_text == nullptr) return;
+    string dither_name(dither_text);
+    GifDither dither;
+    if(dither_name == "none") dither = GifDither::NONE;
+    else if(dither_name == "ordered") dither = GifDither::ORDERED;
+    else if(dither_name == "floyd") dither = GifDither::FLOYD_STEINBERG;
+    else{
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Export animation: unknown dithering \"%s\"", dither_text);
+        return;
+    }
+
+    const char *filetypes[] = { "*.gif" };
+    const char *filename = tinyfd_saveFileDialog("Export Animation", "animation.gif", 1, filetypes, NULL);
+    if(filename == nullptr) return;
+    string path(filename);
+    if(path.size() < 5 || path.substr(path.size()-4, 4) != ".gif") path += ".gif";
+
+    // decoded here, as the job threads must not touch the history; it can't change while the export runs
+    auto frames = make_shared<vector<const Uint32*>>();
+    for(int i = 0; i <= context.history.curr_history_idx; ++i) frames->push_back(historySnapshot(context, i));
+    int width = context.canvas->getWidth(), height = context.canvas->getHeight();
+    context.scheduler.start("Export animation", [frames, width, height, dither, path](TimeSlice &slice){
+        return exportGIF([frames](int k){return (*frames)[k];}, (int)frames->size(), width, height, dither, GIF_FRAME_DELAY, *job_system, path, slice);
+    });
 }
 
-void bucketFill(SDL_Renderer* renderer, SDL_Texture* texture, SDL_Color fill_color, SDL_Point start_point){
-    if(texture == nullptr) return;
-    int texture_width, texture_height;
-    SDL_BlendMode texture_blend_mode;
-    SDL_QueryTexture(texture, nullptr, nullptr, &texture_width, &texture_height);
-    SDL_GetTextureBlendMode(texture, &texture_blend_mode);
-    SDL_Surface* surface = SDL_CreateRGBSurface(0, texture_width, texture_height, 32, 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
-    SDL_SetSurfaceBlendMode(surface, texture_blend_mode);
-    SDL_SetRenderTarget(renderer, texture);
-    SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_RGBA8888, surface->pixels, surface->pitch);
-    Uint32 start_pixel_color = *((Uint32*)surface->pixels + start_point.y*surface->w + start_point.x);
-    Uint32 fill_pixel_color = SDL_MapRGBA(SDL_AllocFormat(SDL_PIXELFORMAT_RGBA8888), fill_color.r, fill_color.g, fill_color.b, fill_color.a);
-    if(start_pixel_color == fill_pixel_color) return;
-    queue<SDL_Point> q;
+SlicedTask bucketFill(Canvas &canvas, SDL_Color fill_color, SDL_Point start_point, TimeSlice &slice){
+    int canvas_width = canvas.getWidth(), canvas_height = canvas.getHeight();
+    if(!canvas.contains(start_point.x, start_point.y)) co_return;
+    Uint32* pixels = canvas.getPixels();
+    Uint32 start_pixel_color = pixels[start_point.y*canvas_width + start_point.x];
+    Uint32 fill_pixel_color = Canvas::mapColor(fill_color);
+    if(start_pixel_color == fill_pixel_color) co_return;
+    // every pixel is queued at most once, so a canvas sized index buffer never wraps
+    BufferLease queue_lease = resource_pool.acquireBuffer((size_t)canvas_width*canvas_height*sizeof(Uint32));
+    Uint32* q = queue_lease.as<Uint32>();
+    size_t q_head = 0, q_tail = 0;
     SDL_Point test_point;
-    q.push(start_point);
-    *((Uint32*)surface->pixels + start_point.y*surface->w + start_point.x) = fill_pixel_color;
-    while(!q.empty()){
-        start_point = q.front(); q.pop();
+    SDL_Rect filled_rect = {start_point.x, start_point.y, 1, 1};
+    q[q_tail++] = start_point.y*canvas_width + start_point.x;
+    pixels[start_point.y*canvas_width + start_point.x] = fill_pixel_color;
+    const double total_pixels = (double)canvas_width*canvas_height;
+    while(q_head < q_tail){
+        if(q_head % FILL_SLICE_CHECK_INTERVAL == 0){
+            canvas.markDirty(filled_rect);    // show the fill progressing
+            co_await slice.yield(q_head/total_pixels);
+            if(slice.cancelled()) co_return;
+        }
+        start_point = {(int)(q[q_head] % canvas_width), (int)(q[q_head] / canvas_width)};
+        ++q_head;
+        if(start_point.x < filled_rect.x){filled_rect.w += filled_rect.x - start_point.x; filled_rect.x = start_point.x;}
+        if(start_point.y < filled_rect.y){filled_rect.h += filled_rect.y - start_point.y; filled_rect.y = start_point.y;}
+        filled_rect.w = max(filled_rect.w, start_point.x - filled_rect.x + 1);
+        filled_rect.h = max(filled_rect.h, start_point.y - filled_rect.y + 1);
+
         test_point = {start_point.x - 1, start_point.y};
-        if(test_point.x >=0 && test_point.y >=0 && test_point.x < texture_width && test_point.y < texture_height && *((Uint32*)surface->pixels + test_point.y*surface->w + test_point.x) == start_pixel_color){
-            *((Uint32*)surface->pixels + test_point.y*surface->w + test_point.x) = fill_pixel_color;
-            q.push(test_point);
+        if(test_point.x >=0 && test_point.y >=0 && test_point.x < canvas_width && test_point.y < canvas_height && pixels[test_point.y*canvas_width + test_point.x] == start_pixel_color){
+            pixels[test_point.y*canvas_width + test_point.x] = fill_pixel_color;
+            q[q_tail++] = test_point.y*canvas_width + test_point.x;
         }
 
         test_point = {start_point.x + 1, start_point.y};
-        if(test_point.x >=0 && test_point.y >=0 && test_point.x < texture_width && test_point.y < texture_height && *((Uint32*)surface->pixels + test_point.y*surface->w + test_point.x) == start_pixel_color){
-            *((Uint32*)surface->pixels + test_point.y*surface->w + test_point.x) = fill_pixel_color;
-            q.push(test_point);
+        if(test_point.x >=0 && test_point.y >=0 && test_point.x < canvas_width && test_point.y < canvas_height && pixels[test_point.y*canvas_width + test_point.x] == start_pixel_color){
+            pixels[test_point.y*canvas_width + test_point.x] = fill_pixel_color;
+            q[q_tail++] = test_point.y*canvas_width + test_point.x;
         }
         
         test_point = {start_point.x, start_point.y - 1};
-        if(test_point.x >=0 && test_point.y >=0 && test_point.x < texture_width && test_point.y < texture_height && *((Uint32*)surface->pixels + test_point.y*surface->w + test_point.x) == start_pixel_color){
-            *((Uint32*)surface->pixels + test_point.y*surface->w + test_point.x) = fill_pixel_color;
-            q.push(test_point);
+        if(test_point.x >=0 && test_point.y >=0 && test_point.x < canvas_width && test_point.y < canvas_height && pixels[test_point.y*canvas_width + test_point.x] == start_pixel_color){
+            pixels[test_point.y*canvas_width + test_point.x] = fill_pixel_color;
+            q[q_tail++] = test_point.y*canvas_width + test_point.x;
         }
         
         test_point = {start_point.x, start_point.y + 1};
-        if(test_point.x >=0 && test_point.y >=0 && test_point.x < texture_width && test_point.y < texture_height && *((Uint32*)surface->pixels + test_point.y*surface->w + test_point.x) == start_pixel_color){
-            *((Uint32*)surface->pixels + test_point.y*surface->w + test_point.x) = fill_pixel_color;
-            q.push(test_point);
+        if(test_point.x >=0 && test_point.y >=0 && test_point.x < canvas_width && test_point.y < canvas_height && pixels[test_point.y*canvas_width + test_point.x] == start_pixel_color){
+            pixels[test_point.y*canvas_width + test_point.x] = fill_pixel_color;
+            q[q_tail++] = test_point.y*canvas_width + test_point.x;
+        }
+    }
+    canvas.markDirty(filled_rect);
+}
+
+// One position of a scribble or eraser record, false if it is not a number.
+// Positions further off the canvas than its own size are pulled in to that
+// distance: a stroke that left the window is drawn as it was, and no segment
+// is longer than three canvas sides.
+bool readRecordPoint(JournalDecoder &in, Canvas &canvas, vec2 &pos){
+    pos = in.getVec2();
+    if(!in.ok() || !isfinite(pos.x) || !isfinite(pos.y)) return false;
+    double margin = max(canvas.getWidth(), canvas.getHeight());
+    pos.x = clamp(pos.x, -margin, canvas.getWidth() + margin);
+    pos.y = clamp(pos.y, -margin, canvas.getHeight() + margin);
+    return true;
+}
+
+// Redraws a journalled scribble with the brush settings it was drawn with;
+// the brush positions are added to path if there is one. Nothing is drawn
+// when a position is not a number or the dabs would cover more than
+// JOURNAL_MAX_PIXELS.
+bool drawBrushRecord(BrushEngine &brush, Canvas &canvas, JournalDecoder &in, SDL_Color &color, ArenaVector<vec2>* path){
+    brush.settings = decodeBrushSettings(in);
+    color = in.getColor();
+    Uint32 count = in.get32();
+    if(!in.ok() || count == 0 || count > JOURNAL_MAX_POINTS) return false;
+    JournalDecoder scan = in;
+    vec2 pos, prev;
+    double length = 0.0;
+    for(Uint32 i = 0; i < count; ++i){
+        if(!readRecordPoint(scan, canvas, pos)) return false;
+        if(i > 0) length += norm(pos - prev);
+        prev = pos;
+    }
+    double side = 2*ceil(brush.settings.size/2) + 3;    // of a dab mask
+    if((length/brush.dabSpacing() + 1)*side*side > JOURNAL_MAX_PIXELS) return false;
+    readRecordPoint(in, canvas, pos);
+    if(path != nullptr) path->push_back(pos);
+    brush.begin(canvas, pos, color);
+    for(Uint32 i = 1; i < count; ++i){
+        readRecordPoint(in, canvas, pos);
+        brush.strokeTo(canvas, pos, color);
+        if(path != nullptr) path->push_back(pos);
+    }
+    return true;
+}
+
+// The brush positions are left in context.stroke.path
+bool drawScribbleRecord(Context &context, JournalDecoder &in, SDL_Color &color){
+    return drawBrushRecord(context.brush, *context.canvas, in, color, &context.stroke.path);
+}
+
+// Same limits as drawBrushRecord; a capsule costs the part of its bounding box on the canvas
+bool drawEraseRecord(Canvas &canvas, JournalDecoder &in){
+    Uint32 count = in.get32();
+    if(!in.ok() || count == 0 || count > JOURNAL_MAX_POINTS) return false;
+    JournalDecoder scan = in;
+    vec2 prev, pos;
+    double pixels = 0.0;
+    for(Uint32 i = 0; i < count; ++i){
+        if(!readRecordPoint(scan, canvas, pos)) return false;
+        if(i == 0) prev = pos;
+        pixels += min((double)canvas.getWidth(), fabs(pos.x - prev.x) + ERASER_SIDE_LEN + 2)*min((double)canvas.getHeight(), fabs(pos.y - prev.y) + ERASER_SIDE_LEN + 2);
+        prev = pos;
+    }
+    if(pixels > JOURNAL_MAX_PIXELS) return false;
+    readRecordPoint(in, canvas, prev);
+    pos = prev;
+    canvas.fillCapsule(pos, pos, ERASER_SIDE_LEN/2, {255, 255, 255, 255});
+    for(Uint32 i = 1; i < count; ++i){
+        readRecordPoint(in, canvas, pos);
+        if(i + 1 < count) canvas.fillCapsule(prev, pos, ERASER_SIDE_LEN/2, {255, 255, 255, 255});
+        prev = pos;
+    }
+    canvas.fillCapsule(pos, pos, ERASER_SIDE_LEN/2, {255, 255, 255, 255});
+    return true;
+}
+
+// Runs a journalled bucket fill to the end before returning; needs no
+// scheduler, so render service workers can use it on their own canvas
+bool drawFillRecord(Canvas &canvas, JournalDecoder &in){
+    SDL_Color fill_color = in.getColor();
+    SDL_Point seed;
+    seed.x = (int)in.get32();
+    seed.y = (int)in.get32();
+    if(!in.ok()) return false;
+    TimeSlice slice;    // never cancelled, every yield just returns here
+    SlicedTask fill = bucketFill(canvas, fill_color, seed, slice);
+    while(!fill.done()) fill.resume();
+    return true;
+}
+
+// Redoes one journalled operation the way the live session did it
+void applyJournalRecord(Context &context, JournalOp op, JournalDecoder &in){
+    Canvas &canvas = *context.canvas;
+    switch(op){
+        case JournalOp::OBJECT:{
+            SceneObject object = decodeSceneObject(in);
+            if(in.ok()) commitObject(context, object);
+            break;
+        }
+        case JournalOp::SCRIBBLE:{
+            SDL_Color color;
+            if(!drawScribbleRecord(context, in, color)) break;
+            StrokeRecord record;
+            record.curve = fitStroke(context.stroke.path.data(), context.stroke.path.size(), STROKE_FIT_TOLERANCE, context.stroke.arena);
+            record.brush = context.brush.settings;
+            record.color = color;
+            endStroke(context);
+            commitObject(context, makeStrokeObject(record.curve, record.brush, record.color), true);
+            context.history.stroke_history[context.history.curr_history_idx] = move(record);
+            break;
+        }
+        case JournalOp::ERASE:
+            if(drawEraseRecord(canvas, in)) saveHistory(context);
+            break;
+        case JournalOp::FILL:
+            if(drawFillRecord(canvas, in)) saveHistory(context);
+            break;
+        case JournalOp::UNDO:
+            handleUndo(context);
+            break;
+        case JournalOp::REDO:
+            handleRedo(context);
+            break;
+        case JournalOp::VECTOR_MODE:{
+            bool on = in.get8() != 0;
+            if(in.ok()) setVectorMode(context, on);
+            break;
+        }
+        case JournalOp::STATE:{
+            BufferLease buffer = resource_pool.acquireBuffer((size_t)canvas.getPitch()*canvas.getHeight());
+            if(!decodeJournalImage(in, buffer.as<Uint32>(), canvas.getWidth(), canvas.getHeight())) break;
+            canvas.load(buffer.as<Uint32>());
+            resetHistory(context);
+            break;
+        }
+        default:
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Journal: unknown record %d", (int)op);
+            break;
+    }
+}
+
+// The pixels of a local operation that is still waiting for its turn
+void drawPendingOperation(Context &context, const SyncOperation &operation){
+    JournalDecoder in(operation.payload.data(), operation.payload.size());
+    BrushSettings brush = context.brush.settings;
+    switch(operation.op){
+        case JournalOp::OBJECT:{
+            SceneObject object = decodeSceneObject(in);
+            if(in.ok()) context.scene->renderObject(*context.canvas, object);
+            break;
+        }
+        case JournalOp::SCRIBBLE:{
+            SDL_Color color;
+            drawScribbleRecord(context, in, color);
+            endStroke(context);
+            break;
+        }
+        case JournalOp::ERASE:
+            drawEraseRecord(*context.canvas, in);
+            break;
+        case JournalOp::FILL:
+            drawFillRecord(*context.canvas, in);
+            break;
+        default:
+            break;    // undo and redo only show once they are ordered
+    }
+    context.brush.settings = brush;
+}
+
+// Host: the whole undo history for a peer that joins, as a writer of the
+// current step, the number of steps, then every snapshot as a journal image.
+// Only the snapshots are shared here; the session's network thread encodes
+// them, and saveHistory leaves a snapshot alone while it is shared.
+SyncHistoryWriter captureSyncHistory(Context &context){
+    int count = context.history.max_valid_history_idx + 1;
+    vector<shared_ptr<BufferLease>> snapshots;
+    for(int i = 0; i < count; ++i){
+        historySnapshot(context, i);    // steps of an opened project are read from the file now
+        snapshots.push_back(context.history.draw_history[i]);
+    }
+    int current = context.history.curr_history_idx, width = context.canvas->getWidth(), height = context.canvas->getHeight();
+    return [snapshots, current, width, height](JournalEncoder &out){
+        out.put32((Uint32)current);
+        out.put32((Uint32)snapshots.size());
+        for(const shared_ptr<BufferLease> &snapshot: snapshots) encodeJournalImage(out, snapshot->as<Uint32>(), width, height);
+    };
+}
+
+// Peer: replaces the history with the host's (captureSyncHistory)
+bool installSyncHistory(Context &context, JournalDecoder &in){
+    Canvas &canvas = *context.canvas;
+    int current = (int)in.get32(), count = (int)in.get32();
+    if(!in.ok() || count <= 0 || current < 0 || current >= count) return false;
+    History &history = context.history;
+    clearHistory(context);
+    for(int i = 0; i < count; ++i){
+        BufferLease buffer = resource_pool.acquireBuffer((size_t)canvas.getPitch()*canvas.getHeight());
+        if(!decodeJournalImage(in, buffer.as<Uint32>(), canvas.getWidth(), canvas.getHeight())){
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Sync: the history from the host is damaged");
+            resetHistory(context);
+            return false;
+        }
+        history.draw_history.push_back(make_shared<BufferLease>(move(buffer)));
+        history.stroke_history.emplace_back();
+        history.scene_history.emplace_back();
+        history.document_state.push_back(-1);
+    }
+    history.curr_history_idx = current;
+    history.max_valid_history_idx = count - 1;
+    canvas.load(historySnapshot(context, current));
+    ++context.scene_generation;
+    context.scene->reset(canvas.getPixels());
+    journalState(context);
+    return true;
+}
+
+// An operation in the host's order, from any peer: a history step and a journal record like a local one
+void applyOrderedOperation(Context &context, const SyncOperation &operation){
+    JournalDecoder in(operation.payload.data(), operation.payload.size());
+    if(operation.op == JournalOp::STATE){    // only ever the host's history, sent to a peer that joins
+        installSyncHistory(context, in);
+        return;
+    }
+    BrushSettings brush = context.brush.settings;
+    context.sync_applying = true;
+    applyJournalRecord(context, operation.op, in);
+    context.sync_applying = false;
+    context.brush.settings = brush;
+    // objects, undo and redo journal themselves
+    if(operation.op == JournalOp::SCRIBBLE || operation.op == JournalOp::ERASE || operation.op == JournalOp::FILL){
+        JournalEncoder record;
+        record.bytes = operation.payload;
+        context.journal.append(operation.op, record);
+    }
+}
+
+// Applies what the host has ordered since the last frame on top of the last
+// ordered state, then draws the local operations still waiting for their turn
+// again; every peer ends up with the same history. Waits while a stroke or a
+// long operation is in progress.
+void applySyncedOperations(Context &context){
+    if(context.is_drawing || context.scheduler.busy() || context.moving_object >= 0) return;
+    bool reloaded = false;
+    auto reload = [&context, &reloaded]{
+        if(!reloaded) context.canvas->load(historySnapshot(context, context.history.curr_history_idx));    // drops the local echo
+        reloaded = true;
+    };
+    auto apply = [&context, &reload](SyncOperation &operation){
+        reload();
+        if(operation.origin == context.sync.getPeerId() && !context.sync_pending.empty()) context.sync_pending.pop_front();
+        applyOrderedOperation(context, operation);
+    };
+    SyncOperation operation;
+    while(context.sync.receive(operation)) apply(operation);
+    if(!context.sync.isActive() && !context.sync_pending.empty()){
+        // the host is gone: what was still waiting for it stays as local edits
+        reload();
+        for(const SyncOperation &pending: context.sync_pending) applyOrderedOperation(context, pending);
+        context.sync_pending.clear();
+    }
+    if(reloaded) for(const SyncOperation &pending: context.sync_pending) drawPendingOperation(context, pending);
+    Uint32 peer;
+    while(context.sync.takeJoinRequest(peer)){
+        // the host orders its own operations as it submits them, so none are pending and the history is the ordered state
+        context.sync.welcome(peer, apply, [&context]{return captureSyncHistory(context);});
+    }
+}
+
+// One record of a render service request, drawn like the journal replays it
+// but onto the worker's canvas: no history, scene or journal involved
+bool drawServiceRecord(RenderWorker &worker, JournalOp op, JournalDecoder &in){
+    Canvas &canvas = *worker.canvas;
+    switch(op){
+        case JournalOp::OBJECT:{
+            SceneObject object = decodeSceneObject(in);
+            if(!in.ok()) return false;
+            rasterizeSceneObject(canvas, object, worker.rasterizer);
+            return true;
+        }
+        case JournalOp::SCRIBBLE:{
+            SDL_Color color;
+            return drawBrushRecord(worker.brush, canvas, in, color, nullptr);
         }
+        case JournalOp::ERASE:
+            return drawEraseRecord(canvas, in);
+        case JournalOp::FILL:
+            return drawFillRecord(canvas, in);
+        case JournalOp::STATE:
+            return decodeJournalImage(in, canvas.getPixels(), canvas.getWidth(), canvas.getHeight());
+        default:
+            return false;    // undo, redo and vector mode mean nothing in a single batch
     }
+}
+
+atomic<bool> service_stop_requested{false};
 
-    SDL_Texture* temp_texture = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_SetRenderTarget(renderer, texture);
-    SDL_RenderCopy(renderer, temp_texture, nullptr, nullptr);
-    SDL_DestroyTexture(temp_texture);
+// --serve: no window, only the render service until SIGINT or SIGTERM
+int runRenderService(const char* address, int workers){
+    RenderService service;
+    if(!service.start(address, workers, drawServiceRecord)){
+        cerr << "Render service: " << SDL_GetError() << endl;
+        return -1;
+    }
+    signal(SIGINT, [](int){service_stop_requested = true;});
+    signal(SIGTERM, [](int){service_stop_requested = true;});
+    while(!service_stop_requested) SDL_Delay(100);
+    service.stop();
+    return 0;
+}
+
+// Offers to recover a session that did not exit cleanly (its lock is free):
+// the recovery file with the journal replayed on top. Then writes both for
+// this session under its own lock; a clean exit deletes them.
+void startAutosave(Context &context){
+    char* pref_path = SDL_GetPrefPath("sdl-paint", "paint");
+    string dir = pref_path != nullptr ? pref_path : "";
+    SDL_free(pref_path);
+    // this session's files are locked before looking for abandoned ones, so nobody takes them for one
+    context.recovery.open(dir, RecoverySession::newId());
+    if(!context.recovery.lock()) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Cannot lock the recovery files of this session in %s", dir.c_str());
+    context.autosave.open(context.recovery.recoveryPath, context.canvas->getWidth(), context.canvas->getHeight());
+
+    Uint64 last_sequence = 0;
+    bool recovered = false;
+    for(auto &session: RecoverySession::findAbandoned(dir)){
+        if(!session->hasFiles()){
+            session->unlock(true);
+            continue;
+        }
+        if(recovered) continue;    // offered next time; unlocked as it goes out of scope
+        if(tinyfd_messageBox("Recover drawing", "A previous session did not end properly. Restore its autosaved drawing?", "yesno", "question", 1) != 1){
+            session->unlock(true);
+            continue;
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        Uint64 checkpoint = 0;
+        if(openDocument(context, session->recoveryPath.c_str())){
+            checkpoint = Autosave::readSequence(session->recoveryPath);
+            resetHistory(context);    // the file stays mapped otherwise, and it is about to be deleted
+        }
+        int records = 0;
+        last_sequence = Journal::replay(session->journalPath, checkpoint, [&context, &records](JournalOp op, JournalDecoder &in, Uint64){
+            applyJournalRecord(context, op, in);
+            ++records;
+        });
+        // a checkpoint of the recovered canvas in this session's file; the old files go once it is on disk
+        context.autosave.start(context.canvas->getPixels(), last_sequence);
+        context.autosave.stop(false);
+        session->unlock(!context.autosave.hasFailed());
+        recovered = true;
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Recovered session %s with %d journal records in %.0f ms", session->id.c_str(), records, (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency());
+    }
+    context.journal_base = context.journal_max = context.history.curr_history_idx;
+    if(!context.journal.open(context.recovery.journalPath, last_sequence + 1)) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Cannot write the journal %s", context.recovery.journalPath.c_str());
 }
 
 int main(int argc, char** argv){
 
+    const char* latency_report_path{nullptr};    // --latency-report <file.csv>
+    const char* timelapse_path{nullptr};    // --timelapse <file.y4m>
+    Uint32 timelapse_interval_ms{0};    // --timelapse-interval <ms>, otherwise a frame per history step
+    const char* sync_host_address{nullptr};    // --host <[host:]port | unix:path>
+    const char* sync_join_address{nullptr};    // --join <[host:]port | unix:path>
+    const char* broadcast_address{nullptr};    // --broadcast <[host:]port | unix:path>
+    const char* view_address{nullptr};    // --view <[host:]port | unix:path>
+    int viewer_loadtest_count{0};    // --viewer-loadtest <viewers>
+    int sync_loadtest_count{0};    // --sync-loadtest <peers>
+    const char* serve_address{nullptr};    // --serve <unix:path | [host:]port>
+    int serve_workers = max(1, (int)thread::hardware_concurrency());    // --serve-workers <count>
+    for(int i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "--latency-report") == 0 && i + 1 < argc) latency_report_path = argv[++i];
+        else if(strcmp(argv[i], "--timelapse") == 0 && i + 1 < argc) timelapse_path = argv[++i];
+        else if(strcmp(argv[i], "--timelapse-interval") == 0 && i + 1 < argc) timelapse_interval_ms = (Uint32)max(0, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--host") == 0 && i + 1 < argc) sync_host_address = argv[++i];
+        else if(strcmp(argv[i], "--join") == 0 && i + 1 < argc) sync_join_address = argv[++i];
+        else if(strcmp(argv[i], "--broadcast") == 0 && i + 1 < argc) broadcast_address = argv[++i];
+        else if(strcmp(argv[i], "--view") == 0 && i + 1 < argc) view_address = argv[++i];
+        else if(strcmp(argv[i], "--viewer-loadtest") == 0 && i + 1 < argc) viewer_loadtest_count = max(0, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--sync-loadtest") == 0 && i + 1 < argc) sync_loadtest_count = max(0, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc) serve_address = argv[++i];
+        else if(strcmp(argv[i], "--serve-workers") == 0 && i + 1 < argc) serve_workers = max(1, atoi(argv[++i]));
+    }
+    if(serve_address != nullptr) return runRenderService(serve_address, serve_workers);
+
     // Initialization
     if(!init()){
         cerr << "Initialization failed: " << SDL_GetError();
@@ -644,13 +1557,20 @@ int main(int argc, char** argv){
 
     initEllipseTextures();
 
+    job_system = new JobSystem();
+    job_system->enableTiming(latency_report_path != nullptr);    // per-task times are logged at exit
+
     Context context;
 
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
 
-    context.texture.canvas_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+    context.canvas = new Canvas(SCREEN_WIDTH, SCREEN_HEIGHT);
+    context.scene = new Scene(SCREEN_WIDTH, SCREEN_HEIGHT);
+    if(!context.canvas->createTexture(renderer)){
+        cerr << "Canvas texture creation failed: " << SDL_GetError();
+        return -1;
+    }
     context.texture.canvas_overlay_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
-    SDL_SetTextureBlendMode(context.texture.canvas_texture, SDL_BLENDMODE_BLEND);
     SDL_SetTextureBlendMode(context.texture.canvas_overlay_texture, SDL_BLENDMODE_BLEND);
 
 
@@ -664,18 +1584,39 @@ int main(int argc, char** argv){
     initializeCursors(context);
     SDL_SetCursor(context.cursor.draw_cursor);
 
-    SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    SDL_RenderClear(renderer);
+    context.canvas->clear({255, 255, 255, 255});
 
     Uint64 start_time, elapsed_time;
     
     context.color.fill_color = context.color.colors[static_cast<int>(ColorsEnum::WHITE)];
     context.color.outline_color = context.color.colors[static_cast<int>(ColorsEnum::BLACK)];
-     
-    context.object.eraser_rect.w = context.object.eraser_rect.h = ERASER_SIDE_LEN;
-    vec2 modified_mouse_pos;
-    context.history.draw_history.push_back(copyTexture(context.texture.canvas_texture, renderer));
+
+    resetHistory(context);
+    if(view_address != nullptr){
+        // a viewer draws nothing, so it has nothing to recover
+        if(!context.view.connect(view_address)) cerr << "Cannot watch " << view_address << ": " << SDL_GetError() << endl;
+    }
+    else startAutosave(context);
+    if(timelapse_path != nullptr){
+        if(context.timelapse.start(timelapse_path, context.canvas->getWidth(), context.canvas->getHeight(), timelapse_interval_ms, resource_pool)) context.timelapse.capture(context.canvas->getPixels());
+        else cerr << "Could not write timelapse to " << timelapse_path << endl;
+    }
+    if(sync_loadtest_count > 0 && sync_host_address == nullptr && sync_join_address == nullptr) sync_host_address = SYNC_LOADTEST_ADDRESS;
+    SyncLoadTest sync_loadtest;
+    if(sync_host_address != nullptr || sync_join_address != nullptr){
+        if(context.vector_mode) setVectorMode(context, false);    // a recovered session may have left it on
+        bool hosting = sync_host_address != nullptr;
+        string address = hosting ? sync_host_address : sync_join_address;
+        bool started = hosting ? context.sync.host(address, context.canvas->getWidth(), context.canvas->getHeight()) : context.sync.join(address, context.canvas->getWidth(), context.canvas->getHeight());
+        if(!started) cerr << "Shared session: " << SDL_GetError() << endl;
+        else if(hosting && sync_loadtest_count > 0 && !sync_loadtest.start(context.sync, address, sync_loadtest_count, context.canvas->getWidth(), context.canvas->getHeight(), drawServiceRecord)) cerr << "Sync load test: " << SDL_GetError() << endl;
+    }
+    if(viewer_loadtest_count > 0 && broadcast_address == nullptr) broadcast_address = VIEWER_LOADTEST_ADDRESS;
+    ViewerLoadTest viewer_loadtest;
+    if(broadcast_address != nullptr){
+        if(!context.viewers.start(broadcast_address, context.canvas->getPixels(), context.canvas->getWidth(), context.canvas->getHeight())) cerr << "Cannot broadcast: " << SDL_GetError() << endl;
+        else if(viewer_loadtest_count > 0 && !viewer_loadtest.start(broadcast_address, viewer_loadtest_count)) cerr << "Viewer load test: " << SDL_GetError() << endl;
+    }
 
     updateToolBoxOverlay(context, renderer);
 
@@ -686,11 +1627,20 @@ int main(int argc, char** argv){
 
         SDL_Event event;
         while(SDL_PollEvent(&event)){
+            Uint64 input_stamp = context.latency.stamp(event);
+            bool was_drawing = context.is_drawing, was_busy = context.scheduler.busy();
+            if(event.type != SDL_MOUSEMOTION) flushMotion(context);    // keep event order for clicks and keys
+            if(context.view.isConnected() && event.type != SDL_QUIT) continue;    // read-only
             switch(event.type){
                 case SDL_QUIT:
                     running = false;
                     break;
                 
+                case SDL_DROPFILE:
+                    if(!context.scheduler.busy() && !context.is_drawing && context.moving_object < 0 && !context.sync.isActive()) openPath(context, event.drop.file);
+                    SDL_free(event.drop.file);
+                    break;
+
                 case SDL_WINDOWEVENT:
                     if (event.window.event == SDL_WINDOWEVENT_FOCUS_GAINED) {
                         // initializeToolboxAndButtons(renderer, toolbox_texture, toolbox_overlay_texture, toolbox_bounds_rect, color_buttons, tool_buttons);
@@ -708,8 +1658,14 @@ int main(int argc, char** argv){
                             handleColorButtons(context);
                             updateToolBoxOverlay(context, renderer);
                         }
-                        else{
-                            if(context.selected_tool == ToolsEnum::RECT){
+                        else if(!context.scheduler.busy()){    // canvas is locked while a long operation runs
+                            if(context.vector_mode && context.key.ctrl_pressed){
+                                // Ctrl+drag moves the object under the cursor
+                                context.moving_object = context.scene->hitTest(context.mouse.initial_pos);
+                                if(context.moving_object >= 0) context.moving_original = context.scene->get(context.moving_object);
+                            }
+
+                            else if(context.selected_tool == ToolsEnum::RECT){
                                 context.is_drawing = true;
                                 context.object.draw_rect.setWidth(0);
                                 context.object.draw_rect.setHeight(0);
@@ -747,198 +1703,186 @@ int main(int argc, char** argv){
                                 SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
                                 SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
                                 SDL_RenderClear(renderer);
-                                SDL_SetRenderDrawColor(renderer, context.color.outline_color.r, context.color.outline_color.g, context.color.outline_color.b, context.color.outline_color.a);
-                                SDL_RenderDrawPoint(renderer, context.mouse.initial_pos.x, context.mouse.initial_pos.y);
+                                drawLinePreview(renderer, context.mouse.initial_pos, context.mouse.initial_pos, context.stroke_style, context.color.outline_color);
                             }
 
                             else if(context.selected_tool == ToolsEnum::SCRIBBLE){
                                 context.is_drawing = true;
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                                SDL_SetRenderDrawColor(renderer, context.color.outline_color.r, context.color.outline_color.g, context.color.outline_color.b, context.color.outline_color.a);
-                                SDL_RenderDrawPoint(renderer, context.mouse.initial_pos.x, context.mouse.initial_pos.y);
+                                PointerSample sample = {context.mouse.initial_pos, event.button.timestamp};
+                                beginStroke(context, sample);
+                                context.stabilizer.begin(sample);
+                                context.predictor.reset();
+                                context.predictor.push(sample.pos, sample.timestamp);
+                                context.brush.settings.size = context.stroke_style.width;
+                                context.brush.begin(*context.canvas, context.mouse.initial_pos, context.color.outline_color);
                             }
                             
                             else if(context.selected_tool == ToolsEnum::ERASER){
                                 context.is_drawing = true;
-                                context.object.eraser_rect.x = context.mouse.initial_pos.x - ERASER_SIDE_LEN/2;
-                                context.object.eraser_rect.y = context.mouse.initial_pos.y - ERASER_SIDE_LEN/2;
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                                Ellipse::drawEllipseSolid(renderer, {255, 255, 255, 255}, context.object.eraser_rect);
+                                beginStroke(context, {context.mouse.initial_pos, event.button.timestamp});
+                                if(context.vector_mode) eraseObjectsAt(context, context.mouse.initial_pos);
+                                else context.canvas->fillCapsule(context.mouse.initial_pos, context.mouse.initial_pos, ERASER_SIDE_LEN/2, {255, 255, 255, 255});
+                            }
+
+                            else if(context.selected_tool == ToolsEnum::BUCKETFILL && context.vector_mode){
+                                if(recolorObjectAt(context, context.mouse.initial_pos, context.color.fill_color)){
+                                    saveHistory(context);
+                                    journalState(context);
+                                }
                             }
 
                             else if(context.selected_tool == ToolsEnum::BUCKETFILL){
-                                bucketFill(renderer, context.texture.canvas_texture, context.color.fill_color, {event.button.x, event.button.y});
-                                saveHistory(context, renderer);
+                                SDL_Color fill_color = context.color.fill_color;
+                                SDL_Point seed = {event.button.x, event.button.y};
+                                context.scheduler.start("Bucket fill", [&context, fill_color, seed](TimeSlice &slice){
+                                    return bucketFill(*context.canvas, fill_color, seed, slice);
+                                }, [&context, fill_color, seed](bool completed){
+                                    if(!completed){
+                                        context.canvas->load(historySnapshot(context, context.history.curr_history_idx));    // drop the partial fill
+                                        for(const SyncOperation &pending: context.sync_pending) drawPendingOperation(context, pending);
+                                        return;
+                                    }
+                                    JournalEncoder payload;
+                                    payload.putColor(fill_color);
+                                    payload.put32((Uint32)seed.x);
+                                    payload.put32((Uint32)seed.y);
+                                    if(shareOperation(context, JournalOp::FILL, payload)) return;
+                                    saveHistory(context);
+                                    context.journal.append(JournalOp::FILL, payload);
+                                });
                             }
                         }
                     }
 
                     else if(event.button.button == SDL_BUTTON_RIGHT){
-                        // bucketFill(renderer, canvas_texture, {0,0,255,255}, {event.button.x, event.button.y});
+                        // eyedropper: pick the canvas colour under the cursor into the selected colour slot
+                        if(event.button.y >= toolbox_bounds_rect.y + toolbox_bounds_rect.h && context.canvas->contains(event.button.x, event.button.y)){
+                            SDL_Color picked_color = Canvas::unmapColor(context.canvas->getPixel(event.button.x, event.button.y));
+                            if(context.color.is_fill_color_selected) context.color.fill_color = picked_color;
+                            else context.color.outline_color = picked_color;
+                            if(context.color.is_transparent) context.color.fill_color.a = 128;
+                            else context.color.fill_color.a = 255;
+                            updateToolBoxOverlay(context, renderer);
+                        }
                     }
 
                     break;
 
                 case SDL_MOUSEMOTION:
-                    context.mouse.curr_pos = {event.button.x,event.button.y};
-
-                    if(context.selected_tool == ToolsEnum::RECT){
-                        if(context.is_drawing){
-                            if(context.key.shift_pressed){
-                                int square_side_len = min(abs(context.mouse.curr_pos.x-context.mouse.initial_pos.x),abs(context.mouse.curr_pos.y-context.mouse.initial_pos.y));
-                                modified_mouse_pos.x = context.mouse.initial_pos.x + (context.mouse.curr_pos.x > context.mouse.initial_pos.x ? 1 : -1)*square_side_len;
-                                modified_mouse_pos.y = context.mouse.initial_pos.y + (context.mouse.curr_pos.y > context.mouse.initial_pos.y ? 1 : -1)*square_side_len;
-                            }
-                            else modified_mouse_pos = context.mouse.curr_pos;
-                            context.object.draw_rect.setWidth(abs(modified_mouse_pos.x-context.mouse.initial_pos.x));
-                            context.object.draw_rect.setHeight(abs(modified_mouse_pos.y-context.mouse.initial_pos.y));
-                            context.object.draw_rect.setPos((context.mouse.initial_pos.x+modified_mouse_pos.x)/2, (context.mouse.initial_pos.y+modified_mouse_pos.y)/2);
-                            SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                            SDL_SetRenderDrawColor(renderer, context.color.fill_color.r, context.color.fill_color.g, context.color.fill_color.b, 0);
-                            SDL_RenderClear(renderer);
-                            context.object.draw_rect.draw(renderer);
+                    if(context.is_drawing && (context.selected_tool == ToolsEnum::SCRIBBLE || context.selected_tool == ToolsEnum::ERASER)){
+                        // strokes consume every sample, the path between them is what gets drawn
+                        PointerSample sample = motionSample(event);
+                        context.mouse.curr_pos = sample.pos;
+                        context.stroke.samples.push_back(sample);
+                        if(context.selected_tool == ToolsEnum::SCRIBBLE){
+                            vec2 pen_pos = context.stabilizer.filter(sample);
+                            context.brush.strokeTo(*context.canvas, pen_pos, context.color.outline_color);
+                            context.stroke.path.push_back(pen_pos);
+                            context.predictor.push(pen_pos, sample.timestamp);
                         }
+                        else if(context.vector_mode) eraseObjectsAt(context, context.mouse.curr_pos);
+                        else context.canvas->fillCapsule(context.mouse.initial_pos, context.mouse.curr_pos, ERASER_SIDE_LEN/2, {255, 255, 255, 255});
+                        context.mouse.initial_pos = context.mouse.curr_pos;
                     }
-                        
-                    else if(context.selected_tool == ToolsEnum::ELLIPSE){
-                        if(context.is_drawing){
-                            if(context.key.shift_pressed){
-                                int square_side_len = min(abs(context.mouse.curr_pos.x-context.mouse.initial_pos.x),abs(context.mouse.curr_pos.y-context.mouse.initial_pos.y));
-                                modified_mouse_pos.x = context.mouse.initial_pos.x + (context.mouse.curr_pos.x > context.mouse.initial_pos.x ? 1 : -1)*square_side_len;
-                                modified_mouse_pos.y = context.mouse.initial_pos.y + (context.mouse.curr_pos.y > context.mouse.initial_pos.y ? 1 : -1)*square_side_len;
-                            }
-                            else modified_mouse_pos = context.mouse.curr_pos;
-                            context.object.draw_ellipse.setRadii(abs(modified_mouse_pos.x-context.mouse.initial_pos.x)/2,abs(modified_mouse_pos.y-context.mouse.initial_pos.y)/2);
-                            context.object.draw_ellipse.setPos((context.mouse.initial_pos.x+modified_mouse_pos.x)/2, (context.mouse.initial_pos.y+modified_mouse_pos.y)/2);
-                            SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                            SDL_SetRenderDrawColor(renderer, context.color.fill_color.r, context.color.fill_color.g, context.color.fill_color.b, 0);
-                            SDL_RenderClear(renderer);
-                            context.object.draw_ellipse.draw(renderer);
-                        }
-                    }
-
-                    else if(context.selected_tool == ToolsEnum::LINE){
-                        if(context.is_drawing){
-                            if(context.key.shift_pressed){
-                                double d_x = abs(context.mouse.curr_pos.x - context.mouse.initial_pos.x);
-                                double d_y = abs(context.mouse.curr_pos.y - context.mouse.initial_pos.y);
-                                if(d_x < 0.4*d_y){
-                                    modified_mouse_pos.x = context.mouse.initial_pos.x;
-                                    modified_mouse_pos.y = context.mouse.curr_pos.y;
-                                }
-                                else if(d_y < 0.4*d_x){
-                                    modified_mouse_pos.x = context.mouse.curr_pos.x;
-                                    modified_mouse_pos.y = context.mouse.initial_pos.y;
-                                }
-                                else{
-                                    modified_mouse_pos.x = context.mouse.initial_pos.x + min(d_x, d_y)*(context.mouse.curr_pos.x - context.mouse.initial_pos.x)/d_x;
-                                    modified_mouse_pos.y = context.mouse.initial_pos.y + min(d_x, d_y)*(context.mouse.curr_pos.y - context.mouse.initial_pos.y)/d_y;
-                                }
-                            }
-                            else modified_mouse_pos = context.mouse.curr_pos;
-                            SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-                            SDL_RenderClear(renderer);
-                            SDL_SetRenderDrawColor(renderer, context.color.outline_color.r, context.color.outline_color.g, context.color.outline_color.b, context.color.outline_color.a);
-                            SDL_RenderDrawLineF(renderer, context.mouse.initial_pos.x, context.mouse.initial_pos.y, modified_mouse_pos.x, modified_mouse_pos.y);
-                        }
-                    }
-
-                    else if(context.selected_tool == ToolsEnum::SCRIBBLE){
-                        if(context.is_drawing){
-                            SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                            SDL_SetRenderDrawColor(renderer, context.color.outline_color.r, context.color.outline_color.g, context.color.outline_color.b, context.color.outline_color.a);
-                            SDL_RenderDrawLineF(renderer, context.mouse.initial_pos.x, context.mouse.initial_pos.y, context.mouse.curr_pos.x, context.mouse.curr_pos.y);
-                            context.mouse.initial_pos = context.mouse.curr_pos;
-                        }
-                    }
-
-                    else if(context.selected_tool == ToolsEnum::ERASER){                        
-                        if(context.is_drawing){
-                            context.object.eraser_rect.x = context.mouse.curr_pos.x - ERASER_SIDE_LEN/2;
-                            context.object.eraser_rect.y = context.mouse.curr_pos.y - ERASER_SIDE_LEN/2;
-                            SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                            Rect::drawRotatedFillRectangle(renderer, {(float)(context.mouse.initial_pos.x + context.mouse.curr_pos.x)/2, (float)(context.mouse.initial_pos.y + context.mouse.curr_pos.y)/2}, distance(context.mouse.curr_pos, context.mouse.initial_pos), ERASER_SIDE_LEN, 180*atan2(context.mouse.curr_pos.y-context.mouse.initial_pos.y, context.mouse.curr_pos.x-context.mouse.initial_pos.x)/M_PI, {255, 255, 255, 255});
-                            SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                            Ellipse::drawEllipseSolid(renderer, {255, 255, 255, 255}, context.object.eraser_rect);
-                            context.mouse.initial_pos = context.mouse.curr_pos;
-                        }
-                    }
-                        
+                    else context.motion.push(motionSample(event));    // previews only need the last position of the frame
                     break;
                 
                 case SDL_MOUSEBUTTONUP:
                     if(event.button.button == SDL_BUTTON_LEFT){
-                        if(context.selected_tool == ToolsEnum::RECT){
+                        if(context.moving_object >= 0){
+                            SceneObject moved = context.scene->get(context.moving_object);
+                            if(context.mouse.curr_pos.x != context.mouse.initial_pos.x || context.mouse.curr_pos.y != context.mouse.initial_pos.y){
+                                context.scene_edit.generation = context.scene_generation;
+                                context.scene_edit.changes.push_back({context.moving_object, true, true, move(context.moving_original), move(moved)});
+                                saveHistory(context);
+                                journalState(context);
+                            }
+                            context.moving_object = -1;
+                        }
+
+                        else if(context.selected_tool == ToolsEnum::RECT){
                             if(context.is_drawing){
                                 context.is_drawing = false;
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                                context.object.draw_rect.draw(renderer);
                                 SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
                                 SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
                                 SDL_RenderClear(renderer);
-                                saveHistory(context, renderer);
+                                commitObject(context, makeRectObject(context.object.draw_rect));
                             }
                         }
 
                         else if(context.selected_tool == ToolsEnum::ELLIPSE){
                             if(context.is_drawing){
                                 context.is_drawing = false;
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                                SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-                                context.object.draw_ellipse.draw(renderer);
                                 SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
                                 SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
                                 SDL_RenderClear(renderer);
-                                saveHistory(context, renderer);
+                                commitObject(context, makeEllipseObject(context.object.draw_ellipse));
                             }
                         }
 
                         else if(context.selected_tool == ToolsEnum::LINE){
                             if(context.is_drawing){
                                 context.is_drawing = false;
-                                if(context.key.shift_pressed){
-                                    double d_x = abs(context.mouse.curr_pos.x - context.mouse.initial_pos.x);
-                                    double d_y = abs(context.mouse.curr_pos.y - context.mouse.initial_pos.y);
-                                    if(d_x < 0.4*d_y){
-                                        modified_mouse_pos.x = context.mouse.initial_pos.x;
-                                        modified_mouse_pos.y = context.mouse.curr_pos.y;
-                                    }
-                                    else if(d_y < 0.4*d_x){
-                                        modified_mouse_pos.x = context.mouse.curr_pos.x;
-                                        modified_mouse_pos.y = context.mouse.initial_pos.y;
-                                    }
-                                    else{
-                                        modified_mouse_pos.x = context.mouse.initial_pos.x + min(d_x, d_y)*(context.mouse.curr_pos.x - context.mouse.initial_pos.x)/d_x;
-                                        modified_mouse_pos.y = context.mouse.initial_pos.y + min(d_x, d_y)*(context.mouse.curr_pos.y - context.mouse.initial_pos.y)/d_y;
-                                    }
-                                }
-                                else modified_mouse_pos = context.mouse.curr_pos;
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                                SDL_SetRenderDrawColor(renderer, context.color.outline_color.r, context.color.outline_color.g, context.color.outline_color.b, context.color.outline_color.a);
-                                SDL_RenderDrawLineF(renderer, context.mouse.initial_pos.x, context.mouse.initial_pos.y, modified_mouse_pos.x, modified_mouse_pos.y);
+                                vec2 end_pos = snappedShapeEnd(context);
                                 SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
                                 SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
                                 SDL_RenderClear(renderer);
-                                saveHistory(context, renderer);
+                                commitObject(context, makeLineObject(context.mouse.initial_pos, end_pos, context.stroke_style, context.color.outline_color));
                             }
                         }
 
                         else if(context.selected_tool == ToolsEnum::SCRIBBLE){
                             if(context.is_drawing){
                                 context.is_drawing = false;
-                                saveHistory(context, renderer);
+                                vec2 end_pos = context.stabilizer.finish();
+                                context.brush.strokeTo(*context.canvas, end_pos, context.color.outline_color);
+                                context.stroke.path.push_back(end_pos);
+                                SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
+                                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+                                SDL_RenderClear(renderer);    // drop the last prediction
+                                StrokeRecord record;
+                                record.curve = fitStroke(context.stroke.path.data(), context.stroke.path.size(), STROKE_FIT_TOLERANCE, context.stroke.arena);
+                                record.brush = context.brush.settings;
+                                record.color = context.color.outline_color;
+                                SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Scribble: %zu brush positions fitted to %zu cubic segments", context.stroke.path.size(), record.curve.size());
+                                bool shared = false;
+                                if(context.journal.isOpen() || context.sync.isActive()){
+                                    JournalEncoder payload;
+                                    encodeBrushSettings(payload, record.brush);
+                                    payload.putColor(record.color);
+                                    payload.put32((Uint32)context.stroke.path.size());
+                                    for(vec2 p: context.stroke.path) payload.putVec2(p);
+                                    shared = shareOperation(context, JournalOp::SCRIBBLE, payload);
+                                    if(!shared) context.journal.append(JournalOp::SCRIBBLE, payload);
+                                }
+                                endStroke(context);
+                                if(!shared){
+                                    commitObject(context, makeStrokeObject(record.curve, record.brush, record.color), true);
+                                    context.history.stroke_history[context.history.curr_history_idx] = move(record);
+                                }
                             }                                
                         }
 
                         else if(context.selected_tool == ToolsEnum::ERASER){
                             if(context.is_drawing){
                                 context.is_drawing = false;
-                                context.object.eraser_rect.x = context.mouse.curr_pos.x - ERASER_SIDE_LEN/2;
-                                context.object.eraser_rect.y = context.mouse.curr_pos.y - ERASER_SIDE_LEN/2;
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_texture);
-                                Ellipse::drawEllipseSolid(renderer, {255, 255, 255, 255}, context.object.eraser_rect);
-                                saveHistory(context, renderer);
+                                if(!context.vector_mode){
+                                    context.canvas->fillCapsule(context.mouse.curr_pos, context.mouse.curr_pos, ERASER_SIDE_LEN/2, {255, 255, 255, 255});
+                                    // every capsule end: the samples, then where the stroke ended
+                                    JournalEncoder payload;
+                                    payload.put32((Uint32)context.stroke.samples.size() + 1);
+                                    for(const PointerSample &sample: context.stroke.samples) payload.putVec2(sample.pos);
+                                    payload.putVec2(context.mouse.curr_pos);
+                                    if(!shareOperation(context, JournalOp::ERASE, payload)){
+                                        saveHistory(context);
+                                        context.journal.append(JournalOp::ERASE, payload);
+                                    }
+                                }
+                                else if(!context.scene_edit.changes.empty()){
+                                    saveHistory(context);
+                                    journalState(context);
+                                }
+                                endStroke(context);
                             }
                         }
                     }
@@ -949,62 +1893,7 @@ int main(int argc, char** argv){
                         if(context.key.shift_pressed) break;
 
                         context.key.shift_pressed = true;
-                        
-                        if(context.selected_tool == ToolsEnum::RECT){
-                            if(context.is_drawing){
-                                vec2 modified_mouse_pos;
-                                int side_len = (int)min(abs(context.mouse.curr_pos.x-context.mouse.initial_pos.x),abs(context.mouse.curr_pos.y-context.mouse.initial_pos.y));
-                                modified_mouse_pos.x = context.mouse.initial_pos.x + (context.mouse.curr_pos.x > context.mouse.initial_pos.x ? 1 : -1)*side_len;
-                                modified_mouse_pos.y = context.mouse.initial_pos.y + (context.mouse.curr_pos.y > context.mouse.initial_pos.y ? 1 : -1)*side_len;
-                                context.object.draw_rect.setWidth(abs(modified_mouse_pos.x-context.mouse.initial_pos.x));
-                                context.object.draw_rect.setHeight(abs(modified_mouse_pos.y-context.mouse.initial_pos.y));
-                                context.object.draw_rect.setPos((context.mouse.initial_pos.x+modified_mouse_pos.x)/2, (context.mouse.initial_pos.y+modified_mouse_pos.y)/2);
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                                SDL_SetRenderDrawColor(renderer, context.color.fill_color.r, context.color.fill_color.g, context.color.fill_color.b, 0);
-                                SDL_RenderClear(renderer);
-                                context.object.draw_rect.draw(renderer);
-                            }
-                        }
-                                
-                        else if(context.selected_tool == ToolsEnum::ELLIPSE){
-                            if(context.is_drawing){
-                                vec2 modified_mouse_pos;
-                                int side_len = (int)min(abs(context.mouse.curr_pos.x-context.mouse.initial_pos.x),abs(context.mouse.curr_pos.y-context.mouse.initial_pos.y));
-                                modified_mouse_pos.x = context.mouse.initial_pos.x + (context.mouse.curr_pos.x > context.mouse.initial_pos.x ? 1 : -1)*side_len;
-                                modified_mouse_pos.y = context.mouse.initial_pos.y + (context.mouse.curr_pos.y > context.mouse.initial_pos.y ? 1 : -1)*side_len;
-                                context.object.draw_ellipse.setRadii(abs(modified_mouse_pos.x-context.mouse.initial_pos.x)/2, abs(modified_mouse_pos.y-context.mouse.initial_pos.y)/2);
-                                context.object.draw_ellipse.setPos((context.mouse.initial_pos.x+modified_mouse_pos.x)/2, (context.mouse.initial_pos.y+modified_mouse_pos.y)/2);
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                                SDL_SetRenderDrawColor(renderer, context.color.fill_color.r, context.color.fill_color.g, context.color.fill_color.b, 0);
-                                SDL_RenderClear(renderer);
-                                context.object.draw_ellipse.draw(renderer);
-                            }
-                        }
-
-                        else if(context.selected_tool == ToolsEnum::LINE){
-                            if(context.is_drawing){
-                                double d_x = abs(context.mouse.curr_pos.x - context.mouse.initial_pos.x);
-                                double d_y = abs(context.mouse.curr_pos.y - context.mouse.initial_pos.y);
-                                if(d_x < 0.4*d_y){
-                                    modified_mouse_pos.x = context.mouse.initial_pos.x;
-                                    modified_mouse_pos.y = context.mouse.curr_pos.y;
-                                }
-                                else if(d_y < 0.4*d_x){
-                                    modified_mouse_pos.x = context.mouse.curr_pos.x;
-                                    modified_mouse_pos.y = context.mouse.initial_pos.y;
-                                }
-                                else{
-                                    modified_mouse_pos.x = context.mouse.initial_pos.x + min(d_x, d_y)*(context.mouse.curr_pos.x - context.mouse.initial_pos.x)/d_x;
-                                    modified_mouse_pos.y = context.mouse.initial_pos.y + min(d_x, d_y)*(context.mouse.curr_pos.y - context.mouse.initial_pos.y)/d_y;
-                                }
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-                                SDL_RenderClear(renderer);
-                                SDL_SetRenderDrawColor(renderer, context.color.outline_color.r, context.color.outline_color.g, context.color.outline_color.b, context.color.outline_color.a);
-                                SDL_RenderDrawLineF(renderer, context.mouse.initial_pos.x, context.mouse.initial_pos.y, modified_mouse_pos.x, modified_mouse_pos.y);
-                            }
-                        }
-
+                        updateShapePreview(context);
                     }
 
                     else if(event.key.keysym.sym == SDLK_LCTRL || event.key.keysym.sym == SDLK_RCTRL){
@@ -1035,16 +1924,64 @@ int main(int argc, char** argv){
                     //     if(!context.is_drawing) context.selected_tool = ToolsEnum::BUCKETFILL;
                     // }
 
+                    else if((event.key.keysym.sym == SDLK_LEFTBRACKET || event.key.keysym.sym == SDLK_RIGHTBRACKET) && context.key.shift_pressed){
+                        double hardness = context.brush.settings.hardness + (event.key.keysym.sym == SDLK_LEFTBRACKET ? -0.1 : 0.1);
+                        context.brush.settings.hardness = min(1.0, max(0.0, hardness));
+                    }
+
+                    else if(event.key.keysym.sym == SDLK_LEFTBRACKET || event.key.keysym.sym == SDLK_RIGHTBRACKET){
+                        double step = context.stroke_style.width < 8 ? 1 : 4;
+                        if(event.key.keysym.sym == SDLK_LEFTBRACKET) context.stroke_style.width = max(MIN_STROKE_WIDTH, context.stroke_style.width - step);
+                        else context.stroke_style.width = min(MAX_STROKE_WIDTH, context.stroke_style.width + step);
+                        updateToolBoxOverlay(context, renderer);
+                    }
+
+                    else if(event.key.keysym.sym == SDLK_q){
+                        if(!context.is_drawing){
+                            context.stabilizer.mode = static_cast<SmoothingMode>((static_cast<int>(context.stabilizer.mode) + 1) % static_cast<int>(SmoothingMode::NUM_MODES));
+                            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Scribble smoothing: %s", smoothingModeName(context.stabilizer.mode));
+                        }
+                    }
+
+                    else if(event.key.keysym.sym == SDLK_v){
+                        if(context.sync.isActive()) SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Vector mode is not available in a shared session");
+                        else if(!context.is_drawing && context.moving_object < 0 && !context.scheduler.busy()){
+                            setVectorMode(context, !context.vector_mode);
+                            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Vector mode: %s", context.vector_mode ? "on" : "off");
+                        }
+                    }
+
+                    else if(event.key.keysym.sym == SDLK_p){
+                        context.predictor.enabled = !context.predictor.enabled;
+                        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Scribble prediction: %s", context.predictor.enabled ? "on" : "off");
+                    }
+
+                    else if(event.key.keysym.sym == SDLK_ESCAPE){
+                        context.scheduler.cancelAll();
+                    }
+
                     else if(event.key.keysym.sym == SDLK_z){
-                        if(context.key.ctrl_pressed) handleUndo(context, renderer);
+                        if(context.key.ctrl_pressed && !context.scheduler.busy() && context.moving_object < 0 && !shareOperation(context, JournalOp::UNDO, JournalEncoder())) handleUndo(context);
                     }
 
                     else if(event.key.keysym.sym == SDLK_y){
-                        if(context.key.ctrl_pressed) handleRedo(context, renderer);
+                        if(context.key.ctrl_pressed && !context.scheduler.busy() && context.moving_object < 0 && !shareOperation(context, JournalOp::REDO, JournalEncoder())) handleRedo(context);
                     }
 
                     else if(event.key.keysym.sym == SDLK_s){
-                        if(context.key.ctrl_pressed) saveTexture(renderer, context.texture.canvas_texture);
+                        if(context.key.ctrl_pressed && !context.scheduler.busy()) saveCanvas(context);
+                    }
+
+                    else if(event.key.keysym.sym == SDLK_o){
+                        if(context.key.ctrl_pressed && !context.scheduler.busy() && !context.is_drawing && context.moving_object < 0 && !context.sync.isActive()) openFile(context);
+                    }
+
+                    else if(event.key.keysym.sym == SDLK_e){
+                        if(context.key.ctrl_pressed && !context.scheduler.busy() && !context.is_drawing && context.moving_object < 0) exportScaledImage(context);
+                    }
+
+                    else if(event.key.keysym.sym == SDLK_g){
+                        if(context.key.ctrl_pressed && !context.scheduler.busy() && !context.is_drawing && context.moving_object < 0) exportAnimation(context);
                     }
 
                     break;
@@ -1052,39 +1989,7 @@ int main(int argc, char** argv){
                 case SDL_KEYUP:
                     if(event.key.keysym.sym == SDLK_LSHIFT || event.key.keysym.sym == SDLK_RSHIFT){
                         context.key.shift_pressed = false;
-
-                        if(context.selected_tool == ToolsEnum::RECT){
-                            if(context.is_drawing){
-                                context.object.draw_rect.setWidth(abs(context.mouse.curr_pos.x-context.mouse.initial_pos.x));
-                                context.object.draw_rect.setHeight(abs(context.mouse.curr_pos.y-context.mouse.initial_pos.y));
-                                context.object.draw_rect.setPos((context.mouse.initial_pos.x+context.mouse.curr_pos.x)/2, (context.mouse.initial_pos.y+context.mouse.curr_pos.y)/2);
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                                SDL_SetRenderDrawColor(renderer, context.color.fill_color.r, context.color.fill_color.g, context.color.fill_color.b, 0);
-                                SDL_RenderClear(renderer);
-                                context.object.draw_rect.draw(renderer);
-                            }
-                        }
-                                
-                        else if(context.selected_tool == ToolsEnum::ELLIPSE){
-                            if(context.is_drawing){
-                                context.object.draw_ellipse.setRadii(abs(context.mouse.curr_pos.x-context.mouse.initial_pos.x)/2, abs(context.mouse.curr_pos.y-context.mouse.initial_pos.y)/2);
-                                context.object.draw_ellipse.setPos((context.mouse.initial_pos.x+context.mouse.curr_pos.x)/2, (context.mouse.initial_pos.y+context.mouse.curr_pos.y)/2);
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                                SDL_SetRenderDrawColor(renderer, context.color.fill_color.r, context.color.fill_color.g, context.color.fill_color.b, 0);
-                                SDL_RenderClear(renderer);
-                                context.object.draw_ellipse.draw(renderer);
-                            }
-                        }
-
-                        else if(context.selected_tool == ToolsEnum::LINE){
-                            if(context.is_drawing){
-                                SDL_SetRenderTarget(renderer, context.texture.canvas_overlay_texture);
-                                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-                                SDL_RenderClear(renderer);
-                                SDL_SetRenderDrawColor(renderer, context.color.outline_color.r, context.color.outline_color.g, context.color.outline_color.b, context.color.outline_color.a);
-                                SDL_RenderDrawLineF(renderer, context.mouse.initial_pos.x, context.mouse.initial_pos.y, context.mouse.curr_pos.x, context.mouse.curr_pos.y);
-                            }
-                        }
+                        updateShapePreview(context);
                     }
 
                     else if(event.key.keysym.sym == SDLK_LCTRL || event.key.keysym.sym == SDLK_RCTRL){
@@ -1096,18 +2001,51 @@ int main(int argc, char** argv){
                 default:
                     break;
             }
+
+            // inputs that changed the canvas or a preview, closed by the next present
+            bool is_pointer = event.type == SDL_MOUSEMOTION || event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_MOUSEBUTTONUP;
+            if(is_pointer && (was_drawing || context.is_drawing || (!was_busy && context.scheduler.busy()))) context.latency.track(toolName(context.selected_tool), input_stamp);
+        }
+        flushMotion(context);
+        if(context.is_drawing && context.selected_tool == ToolsEnum::SCRIBBLE) updateStrokePrediction(context);
+        applySyncedOperations(context);
+        if(context.view.isConnected() && context.view.poll()){
+            SDL_Rect updated = context.view.takeDirty();
+            SDL_Rect bounds = {0, 0, min(context.canvas->getWidth(), context.view.getWidth()), min(context.canvas->getHeight(), context.view.getHeight())};    // canvases of another size are cropped
+            if(SDL_IntersectRect(&updated, &bounds, &updated)){
+                for(int y = updated.y; y < updated.y + updated.h; ++y) memcpy(context.canvas->getRow(y) + updated.x, context.view.getPixels() + (size_t)y*context.view.getWidth() + updated.x, (size_t)updated.w*sizeof(Uint32));
+                context.canvas->markDirty(updated);
+            }
+        }
+
+        if(context.scheduler.busy()){
+            context.scheduler.resume(SLICE_BUDGET_MS);
+            updateToolBoxOverlay(context, renderer);    // progress bar, removed once the operation is done
         }
         
         SDL_SetRenderTarget(renderer, nullptr);
         SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0);
         SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, context.texture.canvas_texture, nullptr, nullptr);
+        context.autosave.markDirty(context.canvas->getDirtyRect());
+        context.viewers.publish(context.canvas->getPixels(), context.canvas->getDirtyRect());
+        context.canvas->upload();
+        SDL_RenderCopy(renderer, context.canvas->getTexture(), nullptr, nullptr);
         SDL_RenderCopy(renderer, context.texture.canvas_overlay_texture, nullptr, nullptr);
         SDL_RenderCopyF(renderer, context.texture.toolbox_texture, nullptr, &toolbox_bounds_rect);
         SDL_RenderCopyF(renderer, context.texture.toolbox_overlay_texture, nullptr, &toolbox_bounds_rect);        
         
         SDL_RenderPresent(renderer);
-        
+        context.latency.presented();
+
+        if(!context.is_drawing && !context.scheduler.busy() && context.moving_object < 0 && context.autosave.due()){
+            context.autosave.start(context.canvas->getPixels(), context.journal.lastSequence());
+            context.journal_base = context.journal_max = context.history.curr_history_idx;
+        }
+        if(context.timelapse.due()) context.timelapse.capture(context.canvas->getPixels());
+        if(context.autosave.getSavedSequence() > context.journal_checkpoint){
+            context.journal_checkpoint = context.autosave.getSavedSequence();
+            context.journal.checkpointed(context.journal_checkpoint);
+        }
 
         elapsed_time = SDL_GetTicks64() - start_time;
         if (elapsed_time < FRAME_DELAY_MS){
@@ -1116,13 +2054,39 @@ int main(int argc, char** argv){
         }
         // else cout << "FPS = " << 1000/elapsed_time << endl;
     }
-    SDL_DestroyTexture(context.texture.canvas_texture);
+    // export tiles may still be running on the job system: let cancelled operations wind down first
+    context.scheduler.cancelAll();
+    while(context.scheduler.busy()) context.scheduler.resume(SLICE_BUDGET_MS);
+    sync_loadtest.stop([&context]{applySyncedOperations(context);}, context.canvas->getPixels(), context.canvas->getWidth(), context.canvas->getHeight());
+    context.sync.close();
+    viewer_loadtest.stop(context.canvas->getPixels(), context.canvas->getWidth(), context.canvas->getHeight());
+    context.viewers.stop();
+    context.autosave.stop(true);    // a clean exit needs no recovery
+    context.journal.close(true);
+    context.recovery.unlock(true);
+    context.timelapse.stop();
+    context.image_decoder.stop();
+    delete context.canvas;
+    context.canvas = nullptr;
+    delete context.scene;
+    context.scene = nullptr;
+    SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Input: %llu preview motion events, %llu preview redraws", (unsigned long long)context.motion.getReceived(), (unsigned long long)context.motion.getApplied());
+    context.latency.log();
+    if(latency_report_path != nullptr && !context.latency.exportCSV(latency_report_path)) cerr << "Could not write latency report to " << latency_report_path << endl;
+    PoolStats pool_stats = resource_pool.getStats();
+    SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Resource pool: %llu allocations, %llu reuses, %llu bytes", (unsigned long long)pool_stats.allocations, (unsigned long long)pool_stats.reuses, (unsigned long long)pool_stats.bytes_allocated);
+    for(auto &[name, stats]: job_system->getTaskStats()){
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Jobs: %s ran %llu times, %.2f ms mean, %.2f ms max", name.c_str(), (unsigned long long)stats.count, stats.total_ns/1e6/max<Uint64>(stats.count, 1), stats.max_ns/1e6);
+    }
+    resource_pool.trim();
     SDL_DestroyTexture(context.texture.canvas_overlay_texture);
     SDL_DestroyTexture(context.texture.toolbox_texture);
     SDL_DestroyTexture(context.texture.toolbox_overlay_texture);
     SDL_DestroyTexture(ellipse_solid_texture);
     SDL_DestroyTexture(ellipse_outline_texture);
     SDL_FreeCursor(context.cursor.draw_cursor);
+    delete job_system;
+    job_system = nullptr;
     SDL_CloseAudio();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);